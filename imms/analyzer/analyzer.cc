@@ -24,26 +24,36 @@
 #include <string>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <vector>
 
 #include <immsutil.h>
 #include <appname.h>
 #include <song.h>
 #include <immsdb.h>
+#include <scanner.h>
 
 #include "analyzer.h"
 #include "strmanip.h"
-#include "melfilter.h"
-#include "fftprovider.h"
-#include "soxprovider.h"
+#include "frontend.h"
+#include "decoder.h"
 #include "mfcckeeper.h"
 #include "beatkeeper.h"
-#include "hanning.h"
 
 using std::cout;
 using std::cerr;
 using std::endl;
-
-typedef uint16_t sample_t;
+using std::ifstream;
+using std::ofstream;
 
 const string AppName = ANALYZER_APP;
 
@@ -60,20 +70,22 @@ const string AppName = ANALYZER_APP;
 // MFCC is meant to capture the type of the song; 
 // i.e. what instruments are used, type of vocals, etc.
 //
-// As of IMMS 1.2 Analyzer is a separate application, and called as needed.
+// As of IMMS 1.2 Analyzer is a separate application. immsd keeps one
+// running in worker mode and feeds it the songs that need analyzing.
 // Analyzer is an optional component; if not used IMMS will simply use its 
 // other sources to determine the next song.
 class Analyzer
 {
 public:
-    Analyzer() : hanwin(WINDOWSIZE) { }
+    Analyzer() { }
     int analyze(const string &path);
+    // Only decodes and does the maths - leaves the database alone.
+    // Returns 1 if the file is too short to say anything about.
+    int compute(const string &path, MixtureModel &mm, float *beats);
 protected:
     FFTWisdom wisdom;
-    FFTProvider<WINDOWSIZE> pcmfft;
+    MelFrontEnd frontend;
     FFTProvider<NUMMEL> specfft;
-    MelFilterBank mfbank;
-    HanningWindow hanwin;
 };
 
 // Calculate acoustic stats for a song and write them to the database.
@@ -101,11 +113,24 @@ int Analyzer::analyze(const string &path)
         return 0;
     }
 
-    FILE *p = run_sox(path, SAMPLERATE);
+    MixtureModel mm;
+    float beats[BEATSSIZE];
+    int r = compute(path, mm, beats);
+    if (r || test_mode)
+        return std::min(r, 0);
+
+    song.set_acoustic(mm, beats);
+    return 0;
+}
+
+// Calculate acoustic stats for a song.
+int Analyzer::compute(const string &path, MixtureModel &mm, float *beats)
+{
+    std::auto_ptr<AudioDecoder> decoder(open_decoder(path, SAMPLERATE));
 
-    if (!p)
+    if (!decoder.get())
     {
-        LOG(ERROR) << "Could not open pipe!" << endl;
+        LOG(ERROR) << "Could not decode " << path << endl;
         return -4;
     }
 
@@ -113,38 +138,20 @@ int Analyzer::analyze(const string &path)
 
     size_t frames = 0;
 
-    sample_t indata[WINDOWSIZE];
-    vector<double> outdata(NUMFREQS);
+    float indata[WINDOWSIZE];
 
     MFCCKeeper mfcckeeper;
     BeatManager beatkeeper;
 
-    int r = fread(indata, sizeof(sample_t), OVERLAP, p);
-
-    if (r != OVERLAP)
+    if (decoder->read(indata, OVERLAP) != OVERLAP)
         return -5;
 
-    while (fread(indata + OVERLAP, sizeof(sample_t), READSIZE, p) ==
-            READSIZE && ++frames < MAXFRAMES)
+    while (decoder->read(indata + OVERLAP, READSIZE) == READSIZE
+            && ++frames < MAXFRAMES)
     {
-        // calculate MFCCs:
-        for (int i = 0; i < WINDOWSIZE; ++i)
-            pcmfft.input()[i] = (double)indata[i];
-
-        // window the data
-        hanwin.apply(pcmfft.input(), WINDOWSIZE);
-
-        // fft to get the spectrum
-        pcmfft.execute();
-
-        // calculate the power spectrum
-        for (int i = 0; i < NUMFREQS; ++i)
-            outdata[i] = pow(pcmfft.output()[i][0], 2) +
-                pow(pcmfft.output()[i][1], 2);
-
-        // apply mel filter bank
-        vector<double> melfreqs;
-        mfbank.apply(outdata, melfreqs);
+        // calculate MFCCs: window the data, fft to get the spectrum,
+        // take its power and apply the mel filter bank
+        vector<double> &melfreqs = frontend.process(indata);
 
         beatkeeper.process(melfreqs);
 
@@ -163,27 +170,408 @@ int Analyzer::analyze(const string &path)
         mfcckeeper.process(cepstrum);
 
         // finally shift the already read data
-        memmove(indata, indata + READSIZE, OVERLAP * sizeof(sample_t));
+        memmove(indata, indata + READSIZE, OVERLAP * sizeof(float));
     }
 
-    r = pclose(p);
-    if (r == -1)
-        LOG(ERROR) << "pclose failed: " << strerror(errno) << endl;
-    if (r > 0)
-        LOG(INFO) << "sox process returned " << r << endl;
+    // done with sox, if it was used
+    decoder.reset();
 
 #ifdef DEBUG
     cerr << "obtained " << frames << " frames" << endl;
 #endif
 
     // did we read enough data?
-    if (test_mode || frames < 100)
-        return 0;
+    if (frames < 100)
+        return 1;
 
     mfcckeeper.finalize();
     beatkeeper.finalize();
 
-    song.set_acoustic(mfcckeeper.get_result(), beatkeeper.get_result());
+    mm = mfcckeeper.get_result();
+    memcpy(beats, beatkeeper.get_result(), sizeof(float) * BEATSSIZE);
+    return 0;
+}
+
+// Locking: ".analyzer_lock" is held only while a song is being analyzed,
+// so immsd's long-lived worker and a one-off "analyzer <file>" take turns
+// song by song rather than shutting each other out. A batch run takes
+// ".analyzer_batch_lock" instead, for as long as it runs, since only one
+// can use the checkpoint; it does not wait for the others, but skips
+// whatever isanalyzed() already. At worst a song gets analyzed twice, and
+// the second result just replaces the first.
+#define ANALYZER_LOCK       ".analyzer_lock"
+#define BATCH_LOCK          ".analyzer_batch_lock"
+
+static int analyze_locked(Analyzer &analyzer, const string &path)
+{
+    while (true)
+    {
+        StackLockFile lock(get_imms_root(ANALYZER_LOCK));
+        if (lock.isok())
+            return analyzer.analyze(path);
+        sleep(1);
+    }
+}
+
+// Worker mode: take songs from immsd over its socket, one at a time, for
+// as long as it is around. The FFT plans and the database connection
+// stay set up between songs.
+static int serve(Analyzer &analyzer)
+{
+    int fd = socket_connect(get_imms_root("socket"));
+    if (fd < 0)
+    {
+        LOG(ERROR) << "Could not connect to immsd: " << strerror(errno) << endl;
+        return -8;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    string request = "Analyzer\n";
+    write_all(fd, request.c_str(), request.length());
+
+    string line;
+    while (read_line(fd, line))
+    {
+        if (line.compare(0, 8, "Analyze "))
+            break;
+
+        struct timeval start, end;
+        gettimeofday(&start, 0);
+
+        int r = analyze_locked(analyzer, path_normalize(line.substr(8)));
+
+        gettimeofday(&end, 0);
+
+        string reply = "Analyzed " + itos(r) + " "
+            + itos(usec_diff(start, end) / 1000) + "\n";
+        if (!write_all(fd, reply.c_str(), reply.length()))
+            break;
+    }
+
+    close(fd);
+    return 0;
+}
+
+// Batch mode: analyze a whole library with several worker processes.
+//
+// The workers are forked off a fully set up Analyzer, so each gets its own
+// copy of the FFT plans and buffers, and only decode and compute. The parent
+// identifies the files, hands them out one at a time, and is the only one
+// writing to the database: results are committed BATCH_COMMIT at a time.
+// Every file dealt with is then noted in the checkpoint file, which lets
+// an interrupted run pick up where it left off. The checkpoint is removed
+// once everything was done.
+//
+// Nothing goes into the checkpoint before its results are in the database.
+// A failed commit keeps them around and is tried again as the next songs
+// come in; after BATCH_RETRIES failures in a row the run is stopped.
+
+#define BATCH_COMMIT        20
+#define BATCH_RETRIES       3
+#define BATCH_CHECKPOINT    ".analyzer_batch"
+
+struct BatchResult
+{
+    int result;
+    MixtureModel mm;
+    float beats[BEATSSIZE];
+};
+
+struct BatchWorker
+{
+    BatchWorker() : pid(-1), jobs(-1), results(-1), uid(-1) {}
+    pid_t pid;
+    int jobs, results;
+    // what it is working on; uid is -1 when idle
+    int uid;
+    string path;
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void interrupt(int signum)
+{
+    interrupted = 1;
+}
+
+class BatchAnalyzer : public WorkerPool
+{
+public:
+    BatchAnalyzer(Analyzer &analyzer, const vector<string> &files)
+        : analyzer(analyzer), files(files), next(0), commit_failures(0),
+          analyzed(0), skipped(0), failed(0) {}
+    int run(int numworkers);
+
+private:
+    void work(int jobs, int results);
+    bool dispatch(BatchWorker &worker);
+    void finish(BatchWorker &worker, const BatchResult &result);
+    bool commit();
+
+    Analyzer &analyzer;
+    const vector<string> &files;
+    size_t next;
+    int commit_failures;
+
+    vector<BatchWorker> workers;
+    std::set<string> checkpointed;
+
+    struct Pending
+    {
+        int uid;
+        MixtureModel mm;
+        float beats[BEATSSIZE];
+    };
+    vector<Pending> pending;
+    vector<string> finished;
+
+    int analyzed, skipped, failed;
+    struct timeval start;
+};
+
+void BatchAnalyzer::work(int jobs, int results)
+{
+    string path;
+    while (read_line(jobs, path))
+    {
+        BatchResult result;
+        result.result = analyzer.compute(path, result.mm, result.beats);
+        if (!write_all(results, &result, sizeof(result)))
+            break;
+    }
+}
+
+// Find the next file that needs analyzing and send it to the worker.
+bool BatchAnalyzer::dispatch(BatchWorker &worker)
+{
+    worker.uid = -1;
+
+    while (!interrupted && commit_failures < BATCH_RETRIES
+            && next < files.size())
+    {
+        const string &path = files[next++];
+        if (checkpointed.count(path))
+        {
+            ++skipped;
+            continue;
+        }
+
+        Song song(path);
+        if (!song.isok())
+        {
+            LOG(ERROR) << "Could not identify file " << path << endl;
+            ++failed;
+            finished.push_back(path);
+            continue;
+        }
+        if (song.isanalyzed())
+        {
+            ++skipped;
+            finished.push_back(path);
+            continue;
+        }
+
+        string line = path + "\n";
+        if (!write_all(worker.jobs, line.c_str(), line.length()))
+        {
+            --next;
+            return false;
+        }
+
+        worker.uid = song.get_uid();
+        worker.path = path;
+        return true;
+    }
+
+    return false;
+}
+
+void BatchAnalyzer::finish(BatchWorker &worker, const BatchResult &result)
+{
+    // ^C also got to sox, so this one has to be done again
+    if (interrupted && result.result)
+    {
+        worker.uid = -1;
+        return;
+    }
+
+    if (!result.result)
+    {
+        Pending done;
+        done.uid = worker.uid;
+        done.mm = result.mm;
+        memcpy(done.beats, result.beats, sizeof(done.beats));
+        pending.push_back(done);
+        ++analyzed;
+    }
+    else
+    {
+        if (result.result < 0)
+            LOG(ERROR) << "Could not process " << worker.path << endl;
+        ++failed;
+    }
+
+    finished.push_back(worker.path);
+    worker.uid = -1;
+
+    if (pending.size() >= BATCH_COMMIT && !commit()
+            && commit_failures >= BATCH_RETRIES)
+        LOG(ERROR) << "Giving up on the database, stopping." << endl;
+}
+
+bool BatchAnalyzer::commit()
+{
+    if (!pending.empty())
+    {
+        // not through Song::set_acoustic: that would swallow the errors
+        try {
+            AutoTransaction a;
+            for (size_t i = 0; i < pending.size(); ++i)
+            {
+                Q q("INSERT OR REPLACE INTO A.Acoustic "
+                        "('uid', 'mfcc', 'bpm') VALUES (?, ?, ?);");
+                q << pending[i].uid;
+                q.bind(&pending[i].mm.gauss, MFCCKeeper::ResultSize);
+                q.bind(pending[i].beats, sizeof(float) * BEATSSIZE);
+                q.execute();
+            }
+            a.commit();
+        }
+        catch (SQLException &e)
+        {
+            LOG(ERROR) << "Could not store " << pending.size()
+                << " results: " << e.what() << endl;
+            ++commit_failures;
+            return false;
+        }
+        commit_failures = 0;
+        pending.clear();
+    }
+
+    if (finished.empty())
+        return true;
+
+    ofstream checkpoint(get_imms_root(BATCH_CHECKPOINT).c_str(),
+            std::ios::app);
+    for (size_t i = 0; i < finished.size(); ++i)
+        checkpoint << finished[i] << endl;
+    finished.clear();
+
+    struct timeval now;
+    gettimeofday(&now, 0);
+    uint64_t msecs = usec_diff(start, now) / 1000;
+
+    LOG(INFO) << next << "/" << files.size() << " files: " << analyzed
+        << " analyzed, " << skipped << " skipped, " << failed << " failed, "
+        << (msecs ? analyzed * 3600000ULL / msecs : 0) << " songs/hour"
+        << endl;
+    return true;
+}
+
+int BatchAnalyzer::run(int numworkers)
+{
+    gettimeofday(&start, 0);
+
+    {
+        ifstream checkpoint(get_imms_root(BATCH_CHECKPOINT).c_str());
+        string line;
+        while (getline(checkpoint, line))
+            checkpointed.insert(line);
+        if (!checkpointed.empty())
+            LOG(INFO) << "Resuming: " << checkpointed.size()
+                << " files already done." << endl;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, interrupt);
+    signal(SIGTERM, interrupt);
+
+    workers.reserve(numworkers);
+    for (int i = 0; i < numworkers; ++i)
+    {
+        BatchWorker worker;
+        worker.pid = start_worker(worker.jobs, worker.results);
+        if (worker.pid < 0)
+        {
+            LOG(ERROR) << "Could not start worker: " << strerror(errno)
+                << endl;
+            break;
+        }
+        workers.push_back(worker);
+    }
+
+    for (size_t i = 0; i < workers.size(); ++i)
+        if (!dispatch(workers[i]))
+            break;
+
+    while (true)
+    {
+        vector<struct pollfd> busy;
+        vector<BatchWorker *> polled;
+        for (size_t i = 0; i < workers.size(); ++i)
+        {
+            if (workers[i].uid == -1)
+                continue;
+            struct pollfd p = { workers[i].results, POLLIN, 0 };
+            busy.push_back(p);
+            polled.push_back(&workers[i]);
+        }
+        if (busy.empty())
+            break;
+
+        if (poll(&busy[0], busy.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOG(ERROR) << "poll failed: " << strerror(errno) << endl;
+            break;
+        }
+
+        for (size_t i = 0; i < busy.size(); ++i)
+        {
+            if (!busy[i].revents)
+                continue;
+
+            BatchWorker &worker = *polled[i];
+            BatchResult result;
+            if (!read_all(worker.results, &result, sizeof(result)))
+            {
+                // not retried: it would most likely take the next one down
+                LOG(ERROR) << "Worker died processing " << worker.path << endl;
+                ++failed;
+                finished.push_back(worker.path);
+                worker.uid = -1;
+                close(worker.results);
+                worker.results = -1;
+                continue;
+            }
+
+            finish(worker, result);
+            dispatch(worker);
+        }
+    }
+
+    bool stored = commit();
+    if (!stored)
+        LOG(ERROR) << "Results for " << pending.size()
+            << " songs were lost; they will be redone next time." << endl;
+
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        close(workers[i].jobs);
+        if (workers[i].results >= 0)
+            close(workers[i].results);
+        waitpid(workers[i].pid, 0, 0);
+    }
+
+    if (!stored || interrupted || next < files.size())
+    {
+        LOG(INFO) << "Stopped early; run again to resume." << endl;
+        return -9;
+    }
+
+    unlink(get_imms_root(BATCH_CHECKPOINT).c_str());
     return 0;
 }
 
@@ -192,16 +580,12 @@ int main(int argc, char *argv[])
     if (argc < 2)
     {
         cout << "usage: analyzer <filename> [<filename>] ..." << endl;
+        cout << "       analyzer --worker" << endl;
+        cout << "       analyzer --batch [-j <jobs>] <directory|list> ..."
+            << endl;
         return -1;
     }
 
-    StackLockFile lock(get_imms_root() + ".analyzer_lock");
-    if (!lock.isok())
-    {
-        LOG(ERROR) << "Another instance already active - exiting." << endl;
-        return -7;
-    }
-
     // clean up after XMMS
     for (int i = 3; i < 255; ++i)
         close(i);
@@ -211,9 +595,37 @@ int main(int argc, char *argv[])
     ImmsDb immsdb;
     Analyzer analyzer;
 
+    if (!strcmp(argv[1], "--worker"))
+        return serve(analyzer);
+
+    if (!strcmp(argv[1], "--batch"))
+    {
+        int jobs = sysconf(_SC_NPROCESSORS_ONLN), first = 2;
+        if (argc > 3 && !strcmp(argv[2], "-j"))
+        {
+            jobs = atoi(argv[3]);
+            first = 4;
+        }
+
+        vector<string> files;
+        for (int i = first; i < argc; ++i)
+            LibraryScanner::collect(argv[i], files);
+
+        StackLockFile lock(get_imms_root(BATCH_LOCK));
+        if (!lock.isok())
+        {
+            LOG(ERROR) << "Another batch run already active - exiting."
+                << endl;
+            return -7;
+        }
+
+        BatchAnalyzer batch(analyzer, files);
+        return batch.run(std::max(jobs, 1));
+    }
+
     for (int i = 1; i < argc; ++i)
     {
-        if (analyzer.analyze(path_normalize(argv[i])))
+        if (analyze_locked(analyzer, path_normalize(argv[i])))
             LOG(ERROR) << "Could not process " << argv[i] << endl;
     }
 }
@@ -32,6 +32,9 @@ using std::map;
 
 using std::cerr;
 
+// Rows of the auto-correlation done per pass in process_window().
+#define BEATROWS        4
+
 // Grab some info about peaks of beats (where the most beats are located)?
 // TODO: this function isn't currently used; 
 // it's an experiment to see if it helps improve IMMS results.
@@ -123,8 +126,7 @@ void BeatKeeper::reset()
     samples = 0;
     memset(data, 0, sizeof(data));
     memset(beats, 0, sizeof(beats));
-    current_position = current_window = data;
-    last_window = &data[MAXBEATLENGTH];
+    current_position = &data[MAXBEATLENGTH];
 }
 
 // Dump debug data on the beats.
@@ -141,31 +143,47 @@ void BeatKeeper::dump(const string &filename)
 void BeatKeeper::process(float power)
 {
     *current_position++ = power;
-    if (current_position - current_window == MAXBEATLENGTH)
+    if (current_position == data + 2*MAXBEATLENGTH)
         process_window();
 }
 
 // Compute an auto-correlation of the signal with itself.
 // By looking at the peaks in the auto-correlation we can tell 
 // what the beats are.
+//
+// Both windows sit next to each other in data, so the signal at every
+// offset is one straight run. The offsets are the inner loop, which the
+// compiler can vectorize, and a few rows are done per pass to save on
+// trips through beats - still adding things up in the original order, so
+// the result is exactly what the plain double loop gives.
 void BeatKeeper::process_window()
 {
-    // update beat values
-    for (int i = 0; i < MAXBEATLENGTH; ++i)
+    int i = 0;
+    for (; i + BEATROWS <= MAXBEATLENGTH; i += BEATROWS)
     {
-        for (int offset = MINBEATLENGTH; offset < MAXBEATLENGTH; ++offset)
+        const float x0 = data[i], x1 = data[i + 1],
+              x2 = data[i + 2], x3 = data[i + 3];
+        const float *warped = &data[i + MINBEATLENGTH];
+        for (int j = 0; j < BEATSSIZE; ++j)
         {
-            int p = i + offset;
-            float warped = *(p < MAXBEATLENGTH ?
-                    last_window + p : current_window + p - MAXBEATLENGTH);
-            beats[offset - MINBEATLENGTH] += last_window[i] * warped;
+            float sum = beats[j];
+            sum += x0 * warped[j];
+            sum += x1 * warped[j + 1];
+            sum += x2 * warped[j + 2];
+            sum += x3 * warped[j + 3];
+            beats[j] = sum;
         }
     }
+    for (; i < MAXBEATLENGTH; ++i)
+    {
+        const float x = data[i], *warped = &data[i + MINBEATLENGTH];
+        for (int j = 0; j < BEATSSIZE; ++j)
+            beats[j] += x * warped[j];
+    }
 
-    // swap the windows
-    float *tmp = current_window;
-    current_window = current_position = last_window;
-    last_window = tmp;
+    // the current window becomes the last one
+    memcpy(data, &data[MAXBEATLENGTH], MAXBEATLENGTH * sizeof(float));
+    current_position = &data[MAXBEATLENGTH];
 }
 
 void BeatManager::process(const std::vector<double> &melfreqs)
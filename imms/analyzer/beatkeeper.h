@@ -52,7 +52,8 @@ protected:
     void process_window();
 
     long unsigned int samples;
-    float average_with, *last_window, *current_window, *current_position;
+    float average_with, *current_position;
+    // the last window followed by the one being filled
     float data[2*MAXBEATLENGTH];
     float beats[BEATSSIZE];
 };
@@ -0,0 +1,230 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <math.h>
+#include <string.h>
+#include <errno.h>
+
+#include <iostream>
+#include <algorithm>
+
+#include "decoder.h"
+#include "soxprovider.h"
+
+#ifdef WITH_SNDFILE
+#include <sndfile.h>
+#endif
+
+using std::endl;
+
+// Frames asked of libsndfile at a time.
+#define DECODE_FRAMES       8192
+// Resampling kernel: zero crossings of the sinc on either side, and
+// how many fractions of an input sample it is tabulated for.
+#define RESAMPLE_ZEROS      8
+#define RESAMPLE_PHASES     64
+// Keep the cutoff a little below the new Nyquist frequency.
+#define RESAMPLE_ROLLOFF    0.95
+
+SoxDecoder::SoxDecoder(const string &path, int samplerate, bool sign)
+    : pipe(run_sox(path, samplerate, sign)), sign(sign)
+{
+}
+
+SoxDecoder::~SoxDecoder()
+{
+    if (!pipe)
+        return;
+
+    int r = pclose(pipe);
+    if (r == -1)
+        LOG(ERROR) << "pclose failed: " << strerror(errno) << endl;
+    if (r > 0)
+        LOG(INFO) << "sox process returned " << r << endl;
+}
+
+size_t SoxDecoder::read(float *samples, size_t n)
+{
+    raw.resize(n);
+    size_t r = fread(&raw[0], sizeof(uint16_t), n, pipe);
+    for (size_t i = 0; i < r; ++i)
+        samples[i] = sign ? (float)(int16_t)raw[i] : (float)raw[i];
+    return r;
+}
+
+#ifdef WITH_SNDFILE
+SndfileDecoder::SndfileDecoder(const string &path, int samplerate, bool sign)
+    : file(0), channels(0), eof(false), offset(sign ? 0 : 32768),
+      taps(0), step(1), first(0), position(0), consumed(0)
+{
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+    file = sf_open(path.c_str(), SFM_READ, &info);
+    if (!file)
+        return;
+
+    channels = info.channels;
+    frames.resize(DECODE_FRAMES * channels);
+
+    if (info.samplerate == samplerate)
+        return;
+
+    step = info.samplerate / (double)samplerate;
+    double cutoff = std::min(1.0, 1 / step) * RESAMPLE_ROLLOFF;
+    int half = (int)ceil(RESAMPLE_ZEROS / cutoff);
+    taps = 2 * half;
+
+    kernel.resize((RESAMPLE_PHASES + 1) * taps);
+    for (int p = 0; p <= RESAMPLE_PHASES; ++p)
+    {
+        float *row = &kernel[p * taps];
+        double sum = 0;
+        for (int j = 0; j < taps; ++j)
+        {
+            // distance of the tap from the output sample
+            double d = j - half + 1 - p / (double)RESAMPLE_PHASES;
+            double x = M_PI * cutoff * d;
+            double sinc = x ? sin(x) / x : 1;
+            double window = fabs(d) < half ? 0.5 + 0.5 * cos(M_PI * d / half) : 0;
+            row[j] = sinc * window;
+            sum += row[j];
+        }
+        for (int j = 0; j < taps; ++j)
+            row[j] /= sum;
+    }
+
+    // the first output sample looks back past the start of the song
+    input.assign(half - 1, 0);
+    first = -(half - 1);
+}
+
+SndfileDecoder::~SndfileDecoder()
+{
+    if (file)
+        sf_close(file);
+}
+
+// Decode the next block and downmix it. false once there is nothing left.
+bool SndfileDecoder::decode()
+{
+    if (eof)
+        return false;
+
+    sf_count_t n = sf_readf_float(file, &frames[0], DECODE_FRAMES);
+    for (sf_count_t i = 0; i < n; ++i)
+    {
+        const float *frame = &frames[i * channels];
+        float sum = 0;
+        for (int c = 0; c < channels; ++c)
+            sum += frame[c];
+        input.push_back(sum / channels);
+    }
+
+    if (n < DECODE_FRAMES)
+    {
+        eof = true;
+        // enough silence to get the last samples out of the filter
+        input.insert(input.end(), taps / 2, 0);
+    }
+    return true;
+}
+
+// Turn as much of the input into output as possible.
+void SndfileDecoder::resample()
+{
+    output.clear();
+    consumed = 0;
+
+    if (!taps)
+    {
+        output.swap(input);
+        input.clear();
+    }
+    else
+    {
+        int half = taps / 2;
+        int64_t available = first + input.size();
+        while (true)
+        {
+            double start = floor(position);
+            int64_t base = (int64_t)start - half + 1;
+            if (base + taps > available)
+                break;
+
+            int phase = (int)((position - start) * RESAMPLE_PHASES + 0.5);
+            const float *h = &kernel[phase * taps];
+            const float *x = &input[base - first];
+            float sum = 0;
+            for (int j = 0; j < taps; ++j)
+                sum += x[j] * h[j];
+            output.push_back(sum);
+            position += step;
+        }
+
+        // drop what no output sample will need any more
+        int64_t done = std::min((int64_t)input.size(),
+                (int64_t)floor(position) - half + 1 - first);
+        if (done > 0)
+        {
+            input.erase(input.begin(), input.begin() + done);
+            first += done;
+        }
+    }
+
+    for (size_t i = 0; i < output.size(); ++i)
+        output[i] = std::max(-32768.0f,
+                std::min(32767.0f, output[i] * 32768)) + offset;
+}
+
+size_t SndfileDecoder::read(float *samples, size_t n)
+{
+    size_t r = 0;
+    while (r < n)
+    {
+        if (consumed == output.size())
+        {
+            if (!decode())
+                break;
+            resample();
+            continue;
+        }
+
+        size_t chunk = std::min(n - r, output.size() - consumed);
+        memcpy(samples + r, &output[consumed], chunk * sizeof(float));
+        consumed += chunk;
+        r += chunk;
+    }
+    return r;
+}
+#endif
+
+AudioDecoder *open_decoder(const string &path, int samplerate, bool sign)
+{
+#ifdef WITH_SNDFILE
+    SndfileDecoder *sndfile = new SndfileDecoder(path, samplerate, sign);
+    if (sndfile->isok())
+        return sndfile;
+    delete sndfile;
+#endif
+
+    SoxDecoder *sox = new SoxDecoder(path, samplerate, sign);
+    if (sox->isok())
+        return sox;
+    delete sox;
+    return 0;
+}
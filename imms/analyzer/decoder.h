@@ -0,0 +1,104 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#ifndef __DECODER_H
+#define __DECODER_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "immsconf.h"
+
+using std::string;
+
+// Decoded audio: mono, at the sample rate asked for, as floats on the
+// scale of 16 bit samples - unsigned (0 to 65535) as the analyzer has
+// always taken them, or signed.
+class AudioDecoder
+{
+public:
+    virtual ~AudioDecoder() {}
+    virtual bool isok() = 0;
+    // Reads up to n samples; fewer only once the song is over.
+    virtual size_t read(float *samples, size_t n) = 0;
+};
+
+// Runs sox and reads its output through a pipe. Slower, but takes
+// anything sox does.
+class SoxDecoder : public AudioDecoder
+{
+public:
+    SoxDecoder(const string &path, int samplerate, bool sign = false);
+    ~SoxDecoder();
+    bool isok() { return pipe; }
+    size_t read(float *samples, size_t n);
+private:
+    FILE *pipe;
+    bool sign;
+    std::vector<uint16_t> raw;
+};
+
+#ifdef WITH_SNDFILE
+typedef struct SNDFILE_tag SNDFILE;
+
+// Decodes in process with libsndfile, a block at a time, and does the
+// downmixing and resampling itself (windowed sinc, low passed for
+// the new rate).
+class SndfileDecoder : public AudioDecoder
+{
+public:
+    SndfileDecoder(const string &path, int samplerate, bool sign = false);
+    ~SndfileDecoder();
+    bool isok() { return file; }
+    size_t read(float *samples, size_t n);
+private:
+    bool decode();
+    void resample();
+
+    SNDFILE *file;
+    int channels;
+    bool eof;
+    float offset;
+
+    // one table row of taps for each fraction of a sample
+    int taps;
+    double step;
+    std::vector<float> kernel;
+
+    // interleaved frames from libsndfile
+    std::vector<float> frames;
+    // mono input still needed, starting at input sample first
+    std::vector<float> input;
+    int64_t first;
+    // where the next output sample falls, in input samples
+    double position;
+
+    std::vector<float> output;
+    size_t consumed;
+};
+#endif
+
+// The in process decoder if there is one and it takes the file, sox
+// otherwise. 0 if neither could be started.
+AudioDecoder *open_decoder(const string &path, int samplerate,
+        bool sign = false);
+
+#endif
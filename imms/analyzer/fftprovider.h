@@ -62,8 +62,9 @@ public:
     double *input() { return indata; }
     fftw_complex *output() { return outdata; }
 protected:
-    double indata[input_size];
-    fftw_complex outdata[input_size / 2 + 1];
+    // aligned, so that FFTW can plan for its SIMD code
+    double indata[input_size] __attribute__((aligned(16)));
+    fftw_complex outdata[input_size / 2 + 1] __attribute__((aligned(16)));
     fftw_plan plan;
 };
 
@@ -0,0 +1,67 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#ifndef __FRONTEND_H
+#define __FRONTEND_H
+
+#include <vector>
+
+#include "analyzer.h"
+#include "fftprovider.h"
+#include "hanning.h"
+#include "melfilter.h"
+
+using std::vector;
+
+// The first steps of analyzing each window, done back to back on
+// buffers set up once: the samples are windowed straight into the FFT
+// input, and the power spectrum goes through the mel filter bank.
+//
+// The loops are written for the compiler to vectorize, and do the same
+// arithmetic in the same order as the separate steps did.
+class MelFrontEnd
+{
+public:
+    MelFrontEnd() : hanwin(WINDOWSIZE), melfreqs(mfbank.size()) {}
+
+    // Takes WINDOWSIZE samples and returns the mel band energies. The
+    // result is only good until the next call; callers may modify it.
+    vector<double> &process(const float *samples)
+    {
+        hanwin.apply(samples, pcmfft.input(), WINDOWSIZE);
+
+        pcmfft.execute();
+
+        const fftw_complex *spectrum = pcmfft.output();
+        for (int i = 0; i < NUMFREQS; ++i)
+            power[i] = spectrum[i][0] * spectrum[i][0]
+                + spectrum[i][1] * spectrum[i][1];
+
+        mfbank.apply(power, &melfreqs[0]);
+        return melfreqs;
+    }
+
+protected:
+    FFTProvider<WINDOWSIZE> pcmfft;
+    HanningWindow hanwin;
+    MelFilterBank mfbank;
+    double power[NUMFREQS] __attribute__((aligned(16)));
+    vector<double> melfreqs;
+};
+
+#endif
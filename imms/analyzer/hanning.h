@@ -20,6 +20,7 @@
 #define __HANNING_H
 
 #include <assert.h>
+#include <math.h>
 #include <vector>
 
 // Apply the Hann function to a set of data.
@@ -41,6 +42,13 @@ public:
         for (unsigned i = 0; i < size; ++i)
             data[i] *= weights[i];
     }
+    // Convert and window in one pass.
+    void apply(const float *data, double *out, unsigned size) const
+    {
+        assert(size == weights.size());
+        for (unsigned i = 0; i < size; ++i)
+            out[i] = data[i] * weights[i];
+    }
 private:
     std::vector<double> weights;
 };
@@ -65,17 +65,6 @@ MelFilter::MelFilter(int leftf, int centerf, int rightf)
     weights[leftisize] = height;
 }
 
-double MelFilter::apply(const vector<double> &data)
-{
-    double power = 0;
-    for (unsigned i = 0; i < weights.size(); ++i)
-    {
-        assert(start + i < data.size());
-        power += data[start + i] * weights[i];
-    }
-    return power;
-}
-
 string MelFilter::print()
 {
     ostringstream s;
@@ -101,6 +90,12 @@ MelFilterBank::MelFilterBank()
 
         MelFilter f(leftf, midf, rightf);
         filters.push_back(f);
+
+        assert(f.start + f.weights.size() <= NUMFREQS);
+        starts.push_back(f.start);
+        sizes.push_back(f.weights.size());
+        offsets.push_back(weights.size());
+        weights.insert(weights.end(), f.weights.begin(), f.weights.end());
     }
 
 #if defined(DEBUG) && 0
@@ -108,12 +103,24 @@ MelFilterBank::MelFilterBank()
 #endif
 }
 
-void MelFilterBank::apply(const vector<double> &data, vector<double> &mfc)
+void MelFilterBank::apply(const double *power, double *mfc) const
+{
+    for (unsigned f = 0; f < starts.size(); ++f)
+    {
+        const double *data = power + starts[f];
+        const float *weight = &weights[offsets[f]];
+        double sum = 0;
+        for (int i = 0; i < sizes[f]; ++i)
+            sum += data[i] * weight[i];
+        mfc[f] = sum;
+    }
+}
+
+void MelFilterBank::apply(const vector<double> &data, vector<double> &mfc) const
 {
-    mfc.clear();
-    for (vector<MelFilter>::iterator i = filters.begin();
-            i != filters.end(); ++i)
-        mfc.push_back(i->apply(data));
+    assert(data.size() >= NUMFREQS);
+    mfc.resize(starts.size());
+    apply(&data[0], &mfc[0]);
 }
 
 string MelFilterBank::print()
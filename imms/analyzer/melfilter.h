@@ -34,9 +34,9 @@ using std::vector;
 // http://cmusphinx.sourceforge.net/sphinx4/javadoc/edu/cmu/sphinx/frontend/frequencywarp/MelFilter.html
 class MelFilter
 {
+    friend class MelFilterBank;
 public:
     MelFilter(int leftf, int centerf, int rightf);
-    double apply(const vector<double> &data);
     string print();
 protected:
     int start;
@@ -48,14 +48,23 @@ protected:
 //
 // For an illustration and example see
 // http://cmusphinx.sourceforge.net/sphinx4/javadoc/edu/cmu/sphinx/frontend/frequencywarp/MelFrequencyFilterBank.html
+//
+// The filters are kept flattened into one sparse matrix - where each one
+// starts in the spectrum, how many bins it covers and where its weights
+// are - so that applying them is a handful of short dot products.
 class MelFilterBank
 {
 public:
     MelFilterBank();
-    void apply(const vector<double> &data, vector<double> &mfc);
+    // power has NUMFREQS bins, mfc gets one value per filter
+    void apply(const double *power, double *mfc) const;
+    void apply(const vector<double> &data, vector<double> &mfc) const;
+    int size() const { return filters.size(); }
     string print();
 protected:
     vector<MelFilter> filters;
+    vector<int> starts, sizes, offsets;
+    vector<float> weights;
 };
 
 #endif
@@ -25,7 +25,10 @@
 #include <torch/MemoryDataSet.h>
 #include <torch/DiagonalGMM.h>
 
+#include <vector>
+
 #include <sqlite++.h>
+#include <immsutil.h>
 
 #include "mfcckeeper.h"
 
@@ -62,17 +65,43 @@ SQLQuery &operator<<(SQLQuery &q, const MixtureModel &a)
 
 struct MFCCKeeperPrivate
 {
-    MFCCKeeperPrivate()
+    MFCCKeeperPrivate(int max_frames)
             : cepseq(0, Gaussian::NumDimensions),
-              cepseq_p(&cepseq) {
-        cepdat.setInputs(&cepseq_p, 1);
+              cepseq_p(&cepseq), max_frames(max_frames), seen(0) {
+        if (max_frames)
+            frames.reserve(max_frames * Gaussian::NumDimensions);
     }
+    void keep(const float *frame);
+
     Torch::Sequence cepseq;
     Torch::Sequence* cepseq_p;
     Torch::MemoryDataSet cepdat;
+
+    int max_frames, seen;
+    std::vector<float> frames;
 };
 
-MFCCKeeper::MFCCKeeper() : impl(new MFCCKeeperPrivate), sample_number(0)
+// Once the reservoir is full, the n-th frame replaces a random one in it
+// with probability max_frames / n: every frame seen so far is equally
+// likely to be in there.
+void MFCCKeeperPrivate::keep(const float *frame)
+{
+    static const int size = Gaussian::NumDimensions;
+
+    ++seen;
+    if (!max_frames || seen <= max_frames)
+    {
+        frames.insert(frames.end(), frame, frame + size);
+        return;
+    }
+
+    int slot = imms_random(seen);
+    if (slot < max_frames)
+        memcpy(&frames[slot * size], frame, size * sizeof(float));
+}
+
+MFCCKeeper::MFCCKeeper(int max_frames)
+    : impl(new MFCCKeeperPrivate(max_frames)), sample_number(0)
 {
     static RandomSeeder seeder;
     memset(last_frame, 0, sizeof(last_frame));
@@ -115,12 +144,18 @@ void MFCCKeeper::process(float *cepstrum)
     memcpy(buffer + NUMCEPSTR, delta, kFeatureSetSize);
     memcpy(buffer + NUMCEPSTR * 2, meta_delta, kFeatureSetSize);
 
-    impl->cepseq.addFrame(buffer, true);
+    impl->keep(buffer);
 }
 
-// Build a mixture model from from all frames (feature vectors) in the sequence
+// Build a mixture model from from all frames (feature vectors) kept
 void MFCCKeeper::finalize()
 {
+    // the sequence just points into the reservoir
+    for (size_t i = 0; i < impl->frames.size();
+            i += Gaussian::NumDimensions)
+        impl->cepseq.addFrame(&impl->frames[i], false);
+    impl->cepdat.setInputs(&impl->cepseq_p, 1);
+
     KMeans kmeans(impl->cepdat.n_inputs, NUMGAUSS);
     kmeans.setROption("prior weights", 0.001);
 
@@ -23,6 +23,11 @@
 #define NUMGAUSS    5
 #define NUMFEATURES (NUMCEPSTR*3)
 
+// Most frames the model is fitted to when sampling: longer songs get
+// sampled down to this many, evenly over the whole song. Not the default
+// until bench_gmm has shown against Torch that the models hold up.
+#define MFCC_RESERVOIR  4096
+
 #include <memory>
 
 namespace Torch {
@@ -55,10 +60,14 @@ private:
 struct MFCCKeeperPrivate;
 
 // Used to store and process MFCCs for Analyzer.
+//
+// Keeps every frame, unless given max_frames: then only a uniform random
+// sample of at most that many (reservoir sampling) is kept, so memory use
+// and the time finalize() takes don't grow with the length of the song.
 class MFCCKeeper
 {
 public:
-    MFCCKeeper();
+    MFCCKeeper(int max_frames = 0);
     ~MFCCKeeper();
     void process(float *capstrum);
     void finalize();
@@ -28,17 +28,22 @@
 
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <vector>
 
 using std::stringstream;
 using std::ostringstream;
 using std::cerr;
 using std::endl;
 
+// Playlist items per PlaylistBatch message
+#define PLAYLIST_BATCH      4096
+
 template <typename Ops>
 class IMMSClient : public IMMSClientStub, protected GIOSocket 
 {
 public:
-    IMMSClient() : connected(false) { }
+    IMMSClient() : connected(false), deltas(false) { }
     bool connect()
     {
         int fd = socket_connect(get_imms_root("socket"));
@@ -46,6 +51,7 @@ public:
         {
             init(fd);
             connected = true;
+            forget_playlist();
             write_command("IMMS");
             return true;
         }
@@ -85,7 +91,7 @@ public:
         }
         if (command == "PlaylistChanged")
         {
-            IMMSClientStub::playlist_changed(Ops::get_length());
+            resend_playlist(Ops::get_length());
             return;
         }
         if (command == "GetPlaylistItem")
@@ -97,15 +103,25 @@ public:
         }
         if (command == "GetEntirePlaylist")
         {
-            for (int i = 0; i < Ops::get_length(); ++i)
-                send_item("Playlist", i);
+            bool batch = false, delta = false;
+            string mode;
+            while (sstr >> mode)
+            {
+                batch |= mode == "batch";
+                delta |= mode == "delta";
+            }
+            if (batch)
+                send_batches(delta);
+            else
+                for (int i = 0; i < Ops::get_length(); ++i)
+                    send_item("Playlist", i);
             write_command("PlaylistEnd");
             return;
         }
 
         LOG(ERROR) << "Unknown command: " << command << endl;
     }
-    virtual void connection_lost() { connected = false; }
+    virtual void connection_lost() { connected = false; forget_playlist(); }
 
     bool check_connection()
     {
@@ -116,10 +132,23 @@ public:
 
         return connect();
     }
+
+    // For when the playlist length changes: sends just what changed if
+    // immsd can take it that way, and has it start over otherwise.
+    void playlist_changed(int length)
+    {
+        if (deltas)
+            send_delta(length);
+        else
+            resend_playlist(length);
+    }
     
     bool isok() { return connected; }
 private:
     bool connected;
+    // whether mirror is what immsd has, and can be sent changes to
+    bool deltas;
+    std::vector<string> mirror;
 
     void send_item(const char *command, int i)
     {
@@ -127,6 +156,135 @@ private:
         osstr << command << " " << i << " " << Ops::get_item(i);
         write_command(osstr.str());
     }
+
+    void forget_playlist()
+    {
+        deltas = false;
+        mirror.clear();
+    }
+
+    void resend_playlist(int length)
+    {
+        forget_playlist();
+        IMMSClientStub::playlist_changed(length);
+    }
+
+    // NUL terminated paths, after a header line with the position they
+    // go at and their length in bytes.
+    void send_paths(const char *command, int pos, const string &paths)
+    {
+        ostringstream osstr;
+        osstr << command << " " << pos << " " << paths.length() << "\n";
+        GIOSocket::write(osstr.str() + paths);
+    }
+
+    // The whole playlist, PLAYLIST_BATCH paths at a time. Kept as the
+    // mirror if immsd is going to want changes only from now on.
+    void send_batches(bool delta)
+    {
+        if (!isok())
+            return;
+        forget_playlist();
+        int length = Ops::get_length();
+        for (int first = 0; first < length; first += PLAYLIST_BATCH)
+        {
+            string batch;
+            int last = std::min(length, first + PLAYLIST_BATCH);
+            for (int i = first; i < last; ++i)
+            {
+                string path = Ops::get_item(i);
+                batch += path;
+                batch += '\0';
+                if (delta)
+                    mirror.push_back(path);
+            }
+            send_paths("PlaylistBatch", first, batch);
+        }
+        deltas = delta;
+    }
+
+    // Compares the playlist with the mirror from both ends, and sends
+    // whatever is different in between as a single edit, followed by a
+    // checksum of the result for immsd to compare its own against.
+    void send_delta(int length)
+    {
+        if (!isok())
+            return;
+
+        int n = mirror.size(), head = 0, tail = 0;
+        while (head < n && head < length
+                && Ops::get_item(head) == mirror[head])
+            ++head;
+        while (tail < n - head && tail < length - head
+                && Ops::get_item(length - 1 - tail) == mirror[n - 1 - tail])
+            ++tail;
+
+        int removed = n - head - tail;
+        std::vector<string> fresh;
+        string paths;
+        for (int i = head; i < length - tail; ++i)
+        {
+            fresh.push_back(Ops::get_item(i));
+            paths += fresh.back();
+            paths += '\0';
+        }
+        int added = fresh.size();
+
+        int k = added == removed ? rotation(head, fresh) : 0;
+        ostringstream osstr;
+        if (k)
+        {
+            // whichever side of the rotation is shorter is what moved
+            if (k <= added - k)
+                osstr << "PlaylistMove " << head << " " << k << " "
+                    << head + added - k;
+            else
+                osstr << "PlaylistMove " << head + k << " " << added - k
+                    << " " << head;
+            write_command(osstr.str());
+        }
+        else if (added && added == removed)
+            send_paths("PlaylistReplace", head, paths);
+        else
+        {
+            if (removed)
+            {
+                osstr << "PlaylistRemove " << head << " " << removed;
+                write_command(osstr.str());
+            }
+            if (added)
+                send_paths("PlaylistInsert", head, paths);
+        }
+
+        mirror.erase(mirror.begin() + head, mirror.end() - tail);
+        mirror.insert(mirror.begin() + head, fresh.begin(), fresh.end());
+
+        PlaylistChecksum checksum;
+        for (size_t i = 0; i < mirror.size(); ++i)
+            checksum.add(mirror[i]);
+        ostringstream check;
+        check << "PlaylistCheck " << checksum.get_length() << " "
+            << checksum.get_sum();
+        write_command(check.str());
+    }
+
+    // k if fresh is the mirror from head on, with its first k items
+    // moved behind the rest; 0 otherwise.
+    int rotation(int head, const std::vector<string> &fresh)
+    {
+        int m = fresh.size();
+        if (m < 2)
+            return 0;
+        int k = 1;
+        while (k < m && mirror[head + k] != fresh[0])
+            ++k;
+        if (k == m)
+            return 0;
+        for (int i = 0; i < m; ++i)
+            if (fresh[i] != mirror[head + (i + k) % m])
+                return 0;
+        return k;
+    }
 };
 
 #endif
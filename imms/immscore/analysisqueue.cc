@@ -0,0 +1,98 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <sstream>
+
+#include "analysisqueue.h"
+
+using std::ostringstream;
+
+// Beyond this the least urgent songs are forgotten - they will be
+// queued again if they come up.
+#define MAX_QUEUED      500
+
+AnalysisQueue *AnalysisQueue::instance;
+
+AnalysisQueue *AnalysisQueue::self()
+{
+    if (!instance)
+        instance = new AnalysisQueue();
+    return instance;
+}
+
+void AnalysisQueue::push(const string &path, int uid, int priority)
+{
+    if (path == "")
+        return;
+
+    std::map<string, Job>::iterator i = queued.find(path);
+    if (i != queued.end())
+    {
+        if (i->second.priority >= priority)
+            return;
+        jobs.erase(i->second);
+        queued.erase(i);
+    }
+
+    Job job(priority, serial++, path, uid);
+    jobs.insert(job);
+    queued[path] = job;
+
+    if (jobs.size() > MAX_QUEUED)
+    {
+        std::set<Job>::iterator last = --jobs.end();
+        queued.erase(last->path);
+        jobs.erase(last);
+    }
+}
+
+bool AnalysisQueue::pop(string &path, int &uid)
+{
+    if (jobs.empty())
+        return false;
+
+    path = jobs.begin()->path;
+    uid = jobs.begin()->uid;
+    queued.erase(path);
+    jobs.erase(jobs.begin());
+    return true;
+}
+
+void AnalysisQueue::finished(bool ok, int msecs)
+{
+    if (ok)
+        ++analyzed;
+    else
+        ++failed;
+    busy_msecs += msecs;
+}
+
+int AnalysisQueue::get_throughput() const
+{
+    if (!busy_msecs)
+        return 0;
+    return (analyzed + failed) * 3600000ULL / busy_msecs;
+}
+
+string AnalysisQueue::get_status() const
+{
+    ostringstream status;
+    status << depth() << " queued, " << analyzed << " analyzed, "
+        << failed << " failed, " << get_throughput() << " songs/hour";
+    return status.str();
+}
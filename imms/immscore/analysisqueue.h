@@ -0,0 +1,86 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#ifndef __ANALYSISQUEUE_H
+#define __ANALYSISQUEUE_H
+
+#include <stdint.h>
+
+#include <string>
+#include <set>
+#include <map>
+
+using std::string;
+
+// How soon a song should be analyzed.
+#define ANALYZE_LATER       0   // might come up later
+#define ANALYZE_NOW         1   // playing right now
+
+// Songs waiting for the analyzer worker, most urgent first and oldest
+// first among equals. Queueing a song that is already waiting just moves
+// it up if needed, so callers do not have to keep track.
+//
+// Only immsd hands the songs out; it also keeps the numbers reported
+// by get_status() here.
+class AnalysisQueue
+{
+public:
+    AnalysisQueue() : serial(0), analyzed(0), failed(0), busy_msecs(0) {}
+
+    static AnalysisQueue *self();
+
+    void push(const string &path, int uid, int priority = ANALYZE_LATER);
+    bool pop(string &path, int &uid);
+    int depth() const { return jobs.size(); }
+
+    // Called as the worker reports back on each song it was given.
+    void finished(bool ok, int msecs);
+
+    // Songs per hour of analyzer time, 0 if nothing was analyzed yet.
+    int get_throughput() const;
+    string get_status() const;
+
+private:
+    struct Job
+    {
+        Job(int priority = 0, unsigned serial = 0, const string &path = "",
+                int uid = -1)
+            : priority(priority), serial(serial), path(path), uid(uid) {}
+        bool operator<(const Job &other) const
+        {
+            if (priority != other.priority)
+                return priority > other.priority;
+            return serial < other.serial;
+        }
+        int priority;
+        unsigned serial;
+        string path;
+        int uid;
+    };
+
+    std::set<Job> jobs;
+    std::map<string, Job> queued;
+
+    unsigned serial;
+    int analyzed, failed;
+    uint64_t busy_msecs;
+
+    static AnalysisQueue *instance;
+};
+
+#endif
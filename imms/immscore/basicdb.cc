@@ -45,6 +45,23 @@ void BasicDb::sql_set_pragma()
         Q("PRAGMA temp_store = MEMORY;").execute();
     }
     WARNIFFAILED();
+
+    if (!SqlDb::use_wal())
+        return;
+
+    // With a write ahead log readers work off a snapshot, so the picker
+    // does not wait for the analyzer or immstool to finish writing.
+    // The journal mode sticks to the database files, so every process
+    // opening them gets it; synchronous has to be set per connection.
+    try {
+        Q("PRAGMA journal_mode = WAL;").execute();
+        Q("PRAGMA C.journal_mode = WAL;").execute();
+        Q("PRAGMA A.journal_mode = WAL;").execute();
+        Q("PRAGMA synchronous = NORMAL;").execute();
+        Q("PRAGMA C.synchronous = NORMAL;").execute();
+        Q("PRAGMA A.synchronous = NORMAL;").execute();
+    }
+    WARNIFFAILED();
 }
 
 void BasicDb::sql_create_tables()
@@ -56,8 +73,12 @@ void BasicDb::sql_create_tables()
                 "'path' VARCHAR(4096) UNIQUE NOT NULL, "
                 "'uid' INTEGER NOT NULL, "
                 "'modtime' TIMESTAMP NOT NULL, "
-                "'checksum' TEXT NOT NULL);").execute();
-                
+                "'checksum' TEXT NOT NULL, "
+                "'checksum_version' INTEGER DEFAULT 1);").execute();
+
+        Q("CREATE INDEX Identify_checksum_i "
+                "ON Identify (checksum);").execute();
+
         Q("CREATE TABLE Library ("
                 "'uid' INTEGER UNIQUE NOT NULL, "
                 "'sid' INTEGER DEFAULT -1, "
@@ -70,6 +91,12 @@ void BasicDb::sql_create_tables()
                 "'rating' INTEGER NOT NULL, "
                 "'dev' INTEGER DEFAULT 0);").execute();
 
+        Q("CREATE TABLE RatingState ("
+                "'uid' INTEGER UNIQUE NOT NULL, "
+                "'total' INTEGER NOT NULL, "
+                "'until' TIMESTAMP NOT NULL, "
+                "'recent' BLOB NOT NULL);").execute();
+
         Q("CREATE TABLE A.Acoustic ("
                 "'uid' INTEGER UNIQUE NOT NULL, "
                 "'mfcc' BLOB DEFAULT NULL, "
@@ -110,6 +137,8 @@ void BasicDb::sql_create_tables()
                 "'time' TIMESTAMP NOT NULL);").execute();
 
         Q("CREATE INDEX Jouranl_uid_i ON Journal (uid);").execute();
+        Q("CREATE INDEX Journal_time_i ON Journal (time);").execute();
+        Q("CREATE INDEX Journal_uid_time_i ON Journal (uid, time);").execute();
 
         Q("CREATE TABLE Bias ("
                 "'uid' INTEGER NOT NULL, " 
@@ -181,6 +210,28 @@ void BasicDb::sql_schema_upgrade(int from)
         {
             Q("DROP TABLE A.Acoustic;").execute();
         }
+        if (from < 15)
+        {
+            Q("CREATE INDEX Journal_time_i ON Journal (time);").execute();
+        }
+        if (from < 16)
+        {
+            Q("CREATE TABLE RatingState ("
+                    "'uid' INTEGER UNIQUE NOT NULL, "
+                    "'total' INTEGER NOT NULL, "
+                    "'until' TIMESTAMP NOT NULL, "
+                    "'recent' BLOB NOT NULL);").execute();
+            Q("CREATE INDEX Journal_uid_time_i "
+                    "ON Journal (uid, time);").execute();
+        }
+        if (from < 17)
+        {
+            // everything identified so far used MD5
+            Q("ALTER TABLE Identify ADD COLUMN "
+                    "'checksum_version' INTEGER DEFAULT 1;").execute();
+            Q("CREATE INDEX IF NOT EXISTS Identify_checksum_i "
+                    "ON Identify (checksum);").execute();
+        }
 
         a.commit();
     }
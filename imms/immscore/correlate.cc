@@ -20,22 +20,24 @@
 #include <math.h>
 #include <time.h>
 #include <iostream>
+#include <algorithm>
 
 #include "flags.h"
 #include "correlate.h"
 #include "strmanip.h"
 #include "immsutil.h"
+#include "writebehind.h"
 
 using std::endl;
 using std::cerr;
 
 #define CORRELATION_TIME    (15*30)   // n * 30 ==> n minutes
-#define MAX_CORR_STR        "12"
 #define MAX_CORRELATION     12
 #define SECOND_DEGREE       0.5
 #define PROCESSING_TIME     5000000
 
-CorrelationDb::CorrelationDb() : correlate_from(time(0))
+CorrelationDb::CorrelationDb()
+    : correlate_from(time(0)), graph_loaded(false)
 {
     gettimeofday(&start, 0);
 }
@@ -49,11 +51,6 @@ void CorrelationDb::sql_create_tables()
                 "'y' INTEGER NOT NULL, "
                 "'weight' INTEGER DEFAULT '0');").execute();
 
-        Q("CREATE TEMP TABLE TmpCorr ("
-                "'x' INTEGER NOT NULL, "
-                "'y' INTEGER NOT NULL, "
-                "'weight' INTEGER DEFAULT '0');").execute();
-
         Q("CREATE UNIQUE INDEX C.Correlations_x_y_i "
                 "ON Correlations (x, y);").execute();
 
@@ -65,7 +62,9 @@ void CorrelationDb::sql_create_tables()
 
 void CorrelationDb::add_recent(int uid, time_t skipped_at, int flags)
 {
-    if (uid > -1)
+    if (uid > -1 && WriteBehind::self()->is_enabled())
+        WriteBehind::self()->add_recent(uid, skipped_at, flags, time(0));
+    else if (uid > -1)
     {
         try {
             Q q("INSERT INTO Journal VALUES (?, ?, ?, ?);");
@@ -76,20 +75,64 @@ void CorrelationDb::add_recent(int uid, time_t skipped_at, int flags)
     }
 }
 
+struct HeavierEdge
+{
+    bool operator()(const CorrelationEdge &a, const CorrelationEdge &b) const
+        { return a.weight > b.weight; }
+};
+
 void CorrelationDb::get_related(vector<int> &out, int pivot_sid, int limit)
 {
+    const CorrelationGraph::Edges &edges = correlations().edges(pivot_sid);
+
+    CorrelationGraph::Edges related;
+    for (CorrelationGraph::Edges::const_iterator i = edges.begin();
+            i != edges.end(); ++i)
+        if (i->weight > 0)
+            related.push_back(*i);
+
+    std::stable_sort(related.begin(), related.end(), HeavierEdge());
+
+    // The number of placeholders only depends on the limit,
+    // so that the statement cache does not grow with every pivot.
     string query =
-        "SELECT pos FROM Filter NATURAL INNER JOIN Library "
-            "WHERE sid IN ("
-            "SELECT L.sid FROM C.Correlations AS C INNER JOIN Last AS L "
-                "ON CASE WHEN C.x = ? THEN C.y ELSE C.x END = L.sid "
-            "WHERE C.weight > 0 AND (C.x = ? OR C.y = ?) AND L.last > ? "
-            "ORDER BY C.weight DESC LIMIT " + itos(limit) + ");";
+        "SELECT pos FROM Filter NATURAL INNER JOIN Library WHERE sid IN (?";
+    for (int i = 1; i < limit; ++i)
+        query += ", ?";
+    query += ");";
 
     try {
+        static SQLQueryHandle select_last(
+                "SELECT last FROM Last WHERE sid = ?;");
+        Q last(select_last);
         Q q(query);
 
-        q << pivot_sid << pivot_sid << pivot_sid << (time(0) - HOUR);
+        time_t cutoff = time(0) - HOUR;
+        int found = 0;
+        for (CorrelationGraph::Edges::iterator i = related.begin();
+                i != related.end() && found < limit; ++i)
+        {
+            time_t played = 0;
+            if (!WriteBehind::self()->get_last(i->sid, &played))
+            {
+                last << i->sid;
+                if (last.next())
+                    last >> played;
+                last.reset();
+            }
+
+            if (played <= cutoff)
+                continue;
+
+            q << i->sid;
+            ++found;
+        }
+
+        if (!found)
+            return;
+
+        for (; found < limit; ++found)
+            q << -1;
 
         while (q.next())
         {
@@ -114,6 +157,12 @@ void CorrelationDb::maybe_expire_recent()
     expire_recent(time(0) - CORRELATION_TIME);
 }
 
+struct JournalEntry
+{
+    int sid, weight;
+    time_t time;
+};
+
 void CorrelationDb::expire_recent(time_t cutoff)
 {
 #if 0 && defined(DEBUG)
@@ -124,7 +173,10 @@ void CorrelationDb::expire_recent(time_t cutoff)
     try {
         AutoTransaction a;
 
-        while (1)
+        // Read everything past the last processed entry in a single pass.
+        // Each entry older than the cutoff is then paired with all the
+        // entries that follow it.
+        vector<JournalEntry> window;
         {
             Q q("SELECT Library.sid, Journal.played, "
                     "Journal.flags, Journal.time "
@@ -133,34 +185,79 @@ void CorrelationDb::expire_recent(time_t cutoff)
                     "WHERE Journal.time > ? ORDER BY Journal.time ASC;");
             q << correlate_from;
 
-            if (!q.next())
-                break;
-
-            int flags;
-            time_t next, played;
+            while (q.next())
+            {
+                JournalEntry entry;
+                int flags;
+                time_t played;
+                q >> entry.sid >> played >> flags >> entry.time;
+                entry.weight = Flags::deltify(played, flags);
+                window.push_back(entry);
+            }
+        }
 
-            q >> from >> played >> flags >> next;
-            from_weight = Flags::deltify(played, flags);
+        // Plays still waiting to be written out come after everything
+        // that is already in the Journal.
+        const vector<RecentPlay> &pending = WriteBehind::self()->get_recent();
+        if (!pending.empty())
+        {
+            Q q("SELECT sid FROM Library WHERE uid = ?;");
+            for (size_t i = 0; i < pending.size(); ++i)
+            {
+                if (pending[i].time <= correlate_from)
+                    continue;
+
+                JournalEntry entry;
+                q << pending[i].uid;
+                bool known = q.next();
+                if (known)
+                    q >> entry.sid;
+                q.reset();
+
+                if (!known)
+                    continue;
+
+                entry.time = pending[i].time;
+                entry.weight = Flags::deltify(pending[i].played,
+                        pending[i].flags);
+                window.push_back(entry);
+            }
+        }
 
-            if (next > cutoff) 
+        for (size_t i = 0; i < window.size(); ++i)
+        {
+            if (window[i].time > cutoff)
                 break;
 
-            correlate_from = next + 1;
+            // only the first of the entries sharing a timestamp gets to
+            // be on the sending end
+            if (window[i].time < correlate_from)
+                continue;
+
+            correlate_from = window[i].time + 1;
+
+            from = window[i].sid;
+            from_weight = window[i].weight;
 
             if (from_weight == -1)
                 continue;
 
-            while (q.next())
+            for (size_t j = i + 1; j < window.size(); ++j)
             {
-                q >> to >> played >> flags;
-                to_weight = Flags::deltify(played, flags);
+                to = window[j].sid;
+                to_weight = window[j].weight;
                 expire_recent_helper();
             }
         }
 
         a.commit();
+        return;
     }
     WARNIFFAILED();
+
+    // The transaction was rolled back, so the in memory correlations
+    // might be ahead of the database. Reload them on next use.
+    graph_loaded = false;
 }
 
 void CorrelationDb::expire_recent_helper()
@@ -191,31 +288,29 @@ void CorrelationDb::expire_recent_helper()
     if (usec_diff(start, now) > PROCESSING_TIME || fabs(weight) < 2)
         return;
     
-    try {
-        Q("DELETE FROM TmpCorr;").execute();
-    } IGNOREFAILURE();
+    // Take a copy of the links of both ends first,
+    // since updating them will modify the edge lists.
+    typedef std::pair<int, CorrelationEdge> Link;
+    vector<Link> links;
 
+    int ends[2] = { from, to };
+    for (int e = 0; e < 2; ++e)
     {
-        string query("INSERT INTO TmpCorr SELECT x, y, weight "
-            "FROM C.Correlations "
-            "WHERE (x IN (?, ?) OR y IN (?, ?)) AND ");
-        query += (weight > 0 ? string("abs") : string("")) + " (weight) > 1;";
-
-        Q q(query);
-        q << to << from << to << from;
-        q.execute();
-    }
-
-    {
-        Q q("SELECT * FROM TmpCorr;");
-        while (q.next())
+        const CorrelationGraph::Edges &edges = correlations().edges(ends[e]);
+        for (CorrelationGraph::Edges::const_iterator i = edges.begin();
+                i != edges.end(); ++i)
         {
-            int node1, node2;
-            float outer;
-            q >> node1 >> node2 >> outer;
-            update_secondary_correlations(node1, node2, outer);
+            // the link between the two ends is listed under both of them
+            if (e && i->sid == from)
+                continue;
+            if ((weight > 0 ? fabs(i->weight) : i->weight) > 1)
+                links.push_back(Link(ends[e], *i));
         }
     }
+
+    for (vector<Link>::iterator i = links.begin(); i != links.end(); ++i)
+        update_secondary_correlations(i->first, i->second.sid,
+                i->second.weight);
 }
 
 void CorrelationDb::update_secondary_correlations(int node1, int node2,
@@ -236,7 +331,7 @@ void CorrelationDb::update_secondary_correlations(int node1, int node2,
 
 void CorrelationDb::update_correlation(int from, int to, float weight)
 {
-    if (fabs(weight) < 0.25)
+    if (fabs(weight) < 0.25 || from == to)
         return;
 
 #if defined(DEBUG) && 0
@@ -246,21 +341,16 @@ void CorrelationDb::update_correlation(int from, int to, float weight)
 
     int min = std::min(from, to), max = std::max(from, to);
 
-    try {
-        Q q("INSERT INTO C.Correlations "
-                "('x', 'y', 'weight') VALUES (?, ?, ?);");
-        q << min << max << weight;
-        q.execute();
-        return;
-    } IGNOREFAILURE();
+    float current;
+    if (correlations().find(min, max, &current))
+        weight = cap(current + weight, MAX_CORRELATION);
 
-    {
-        Q q("UPDATE C.Correlations SET weight = "
-                "max(min(weight + ?, " MAX_CORR_STR "), -" MAX_CORR_STR ") "
-                "WHERE x = ? AND y = ?;");
-        q << weight << min << max;
-        q.execute();
-    }
+    Q q("INSERT OR REPLACE INTO C.Correlations "
+            "('x', 'y', 'weight') VALUES (?, ?, ?);");
+    q << min << max << weight;
+    q.execute();
+
+    graph.set(min, max, weight);
 }
 
 float CorrelationDb::correlate(int sid1, int sid2)
@@ -268,17 +358,36 @@ float CorrelationDb::correlate(int sid1, int sid2)
     if (sid1 < 0 || sid2 < 0)
         return 0;
 
-    int min = std::min(sid1, sid2), max = std::max(sid1, sid2);
-    float correlation = 0;
-    
-    try {
-        Q q("SELECT weight FROM C.Correlations WHERE x = ? AND y = ?;");
-        q << min << max;
+    return correlations().get(sid1, sid2);
+}
+
+const CorrelationGraph &CorrelationDb::correlations()
+{
+    if (!graph_loaded)
+        load_correlations();
+    return graph;
+}
+
+void CorrelationDb::load_correlations()
+{
+    graph.clear();
+    graph_loaded = true;
 
-        if (q.next())
-            q >> correlation;
+    try {
+        Q q("SELECT x, y, weight FROM C.Correlations;");
+        while (q.next())
+        {
+            int x, y;
+            float weight;
+            q >> x >> y >> weight;
+            graph.append(x, y, weight);
+        }
     }
     WARNIFFAILED();
 
-    return correlation;
+    graph.sort();
+
+#ifdef DEBUG
+    cerr << "loaded " << graph.size() << " correlations" << endl;
+#endif
 }
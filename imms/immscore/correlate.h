@@ -26,6 +26,7 @@
 
 #include "immsconf.h"
 #include "basicdb.h"
+#include "corrgraph.h"
 
 using std::string;
 
@@ -47,6 +48,13 @@ protected:
 
     void get_related(std::vector<int> &out, int pivot_sid, int limit);
 
+    // Correlations are served from memory; the table is only written to.
+    const CorrelationGraph &correlations();
+    void load_correlations();
+    // For when something else changed the table: read it again on
+    // next use.
+    void reload_correlations() { graph_loaded = false; }
+
     virtual void sql_create_tables();
     virtual void sql_schema_upgrade(int from = 0) {}
 
@@ -56,6 +64,9 @@ private:
     int from, from_weight, to, to_weight;
     float weight;
     struct timeval start;
+
+    CorrelationGraph graph;
+    bool graph_loaded;
 };
 
 #endif
@@ -0,0 +1,106 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <algorithm>
+
+#include "corrgraph.h"
+
+static const CorrelationGraph::Edges no_edges;
+
+void CorrelationGraph::clear()
+{
+    nodes.clear();
+    numedges = 0;
+}
+
+CorrelationGraph::Edges &CorrelationGraph::node(int sid)
+{
+    if (sid >= (int)nodes.size())
+        nodes.resize(sid + 1);
+    return nodes[sid];
+}
+
+const CorrelationGraph::Edges &CorrelationGraph::edges(int sid) const
+{
+    if (sid < 0 || sid >= (int)nodes.size())
+        return no_edges;
+    return nodes[sid];
+}
+
+void CorrelationGraph::append(int x, int y, float weight)
+{
+    if (x < 0 || y < 0 || x == y)
+        return;
+
+    node(x).push_back(CorrelationEdge(y, weight));
+    node(y).push_back(CorrelationEdge(x, weight));
+    ++numedges;
+}
+
+void CorrelationGraph::sort()
+{
+    for (size_t i = 0; i < nodes.size(); ++i)
+        std::sort(nodes[i].begin(), nodes[i].end());
+}
+
+bool CorrelationGraph::find(int x, int y, float *weight) const
+{
+    // search the shorter of the two edge lists
+    const Edges &ex = edges(x), &ey = edges(y);
+    const Edges &list = ex.size() < ey.size() ? ex : ey;
+    int other = ex.size() < ey.size() ? y : x;
+
+    Edges::const_iterator i = std::lower_bound(list.begin(), list.end(),
+            CorrelationEdge(other));
+    if (i == list.end() || i->sid != other)
+        return false;
+
+    if (weight)
+        *weight = i->weight;
+    return true;
+}
+
+float CorrelationGraph::get(int x, int y) const
+{
+    float weight = 0;
+    find(x, y, &weight);
+    return weight;
+}
+
+void CorrelationGraph::set_directed(int from, int to, float weight)
+{
+    Edges &list = node(from);
+    Edges::iterator i = std::lower_bound(list.begin(), list.end(),
+            CorrelationEdge(to));
+    if (i != list.end() && i->sid == to)
+        i->weight = weight;
+    else
+        list.insert(i, CorrelationEdge(to, weight));
+}
+
+void CorrelationGraph::set(int x, int y, float weight)
+{
+    if (x < 0 || y < 0 || x == y)
+        return;
+
+    if (!find(x, y, 0))
+        ++numedges;
+
+    set_directed(x, y, weight);
+    set_directed(y, x, weight);
+}
@@ -0,0 +1,69 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#ifndef __CORRGRAPH_H
+#define __CORRGRAPH_H
+
+#include <vector>
+#include <stddef.h>
+
+struct CorrelationEdge
+{
+    CorrelationEdge(int sid = -1, float weight = 0)
+        : sid(sid), weight(weight) {}
+    bool operator <(const CorrelationEdge &other) const
+        { return sid < other.sid; }
+    int sid;
+    float weight;
+};
+
+// In memory copy of the C.Correlations table.
+//
+// Every sid gets an array of edges sorted by the sid on the other end, and
+// every link is stored twice - once for each of its ends - so that looking
+// up a pair is a binary search and listing the neighbours of a song does
+// not need to touch the database.
+class CorrelationGraph
+{
+public:
+    typedef std::vector<CorrelationEdge> Edges;
+
+    CorrelationGraph() : numedges(0) {}
+
+    void clear();
+
+    // Bulk loading: append() links in any order, then sort() once.
+    void append(int x, int y, float weight);
+    void sort();
+
+    float get(int x, int y) const;
+    bool find(int x, int y, float *weight) const;
+    void set(int x, int y, float weight);
+
+    const Edges &edges(int sid) const;
+    size_t size() const { return numedges; }
+
+private:
+    void set_directed(int from, int to, float weight);
+    Edges &node(int sid);
+
+    std::vector<Edges> nodes;
+    size_t numedges;
+};
+
+#endif
@@ -24,8 +24,8 @@
 
 #include "fetcher.h"
 #include "strmanip.h"
-#include "md5digest.h"
 #include "immsutil.h"
+#include "snapshot.h"
 
 using std::endl;
 using std::cerr;
@@ -72,15 +72,23 @@ bool InfoFetcher::fetch_song_info(SongData &data)
         return false;
     }
 
-    StringPair info = data.get_info();
+    if (LibrarySnapshot::self()->get_aid(data.get_sid()) != -1)
+    {
+        // it has an artist, so it has been identified before
+        data.identified = true;
+    }
+    else
+    {
+        StringPair info = data.get_info();
 
-    const string &artist = info.first;
-    const string &title = info.second;
+        const string &artist = info.first;
+        const string &title = info.second;
 
-    if (artist != "" && title != "")
-        data.identified = true;
-    else if ((data.identified = parse_song_info(data, info)))
-        data.set_info(info);
+        if (artist != "" && title != "")
+            data.identified = true;
+        else if ((data.identified = parse_song_info(data, info)))
+            data.set_info(info);
+    }
 
     data.rating = data.get_rating();
 
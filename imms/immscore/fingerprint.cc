@@ -0,0 +1,189 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include "fingerprint.h"
+#include "md5.h"
+
+#define TAIL_SIZE       (1024 * 1024)
+#define TAG_SIZE        128
+
+Fingerprint::Fingerprint(const string &path) : ok(false), start(0), length(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf))
+    {
+        close(fd);
+        return;
+    }
+
+    // the hashed part and the tag after it, in one go
+    off_t size = statbuf.st_size;
+    off_t first = std::max(size - (off_t)(TAIL_SIZE + TAG_SIZE), (off_t)0);
+    data.resize(size - first);
+
+    size_t got = 0;
+    while (got < data.size())
+    {
+        ssize_t n = pread(fd, &data[got], data.size() - got, first + got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    close(fd);
+
+    if (got < data.size())
+        return;
+
+    // The same part the old stdio code ended up hashing, quirks and all:
+    // files too short to seek back far enough are hashed from the start.
+    off_t offset = -TAIL_SIZE;
+    off_t tag = size >= TAG_SIZE ? size - TAG_SIZE : 0;
+    if (size - tag >= 3 && !strncmp(&data[tag - first], "TAG", 3))
+        offset -= TAG_SIZE;
+
+    off_t from = size + offset >= 0 ? size + offset : 0;
+    start = from - first;
+    length = std::min((off_t)TAIL_SIZE, size - from);
+    ok = true;
+}
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+// xxHash reads its input as little endian words
+static inline uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+#define XXH_PRIME1  11400714785074694791ULL
+#define XXH_PRIME2  14029467366897019727ULL
+#define XXH_PRIME3  1609587929392839161ULL
+#define XXH_PRIME4  9650029242287828579ULL
+#define XXH_PRIME5  2870177450012600261ULL
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+    return rotl(acc + input * XXH_PRIME2, 31) * XXH_PRIME1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t v)
+{
+    return (acc ^ xxh_round(0, v)) * XXH_PRIME1 + XXH_PRIME4;
+}
+
+// XXH64 with a seed of 0, as described in the xxHash specification.
+static uint64_t xxh64(const unsigned char *p, size_t len)
+{
+    const unsigned char *end = p + len;
+    uint64_t h;
+
+    if (len >= 32)
+    {
+        uint64_t v1 = XXH_PRIME1 + XXH_PRIME2, v2 = XXH_PRIME2,
+                 v3 = 0, v4 = -XXH_PRIME1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = xxh_round(v1, read64(p));
+            v2 = xxh_round(v2, read64(p + 8));
+            v3 = xxh_round(v3, read64(p + 16));
+            v4 = xxh_round(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    }
+    else
+        h = XXH_PRIME5;
+
+    h += len;
+
+    for (; p + 8 <= end; p += 8)
+        h = rotl(h ^ xxh_round(0, read64(p)), 27) * XXH_PRIME1 + XXH_PRIME4;
+    if (p + 4 <= end)
+    {
+        h = rotl(h ^ (read32(p) * XXH_PRIME1), 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        h = rotl(h ^ (*p * XXH_PRIME5), 11) * XXH_PRIME1;
+
+    h ^= h >> 33;
+    h *= XXH_PRIME2;
+    h ^= h >> 29;
+    h *= XXH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+string Fingerprint::get(int version) const
+{
+    if (!ok)
+        return "bad_checksum";
+
+    const char *tail = length ? &data[start] : "";
+    char hex[33];
+
+    if (version == FINGERPRINT_MD5)
+    {
+        unsigned char digest[16];
+        md5_buffer(tail, length, digest);
+        for (int i = 0; i < 16; ++i)
+            sprintf(hex + i * 2, "%02x", digest[i]);
+        return hex;
+    }
+
+    sprintf(hex, "%016llx", (unsigned long long)
+            xxh64((const unsigned char *)tail, length));
+    return hex;
+}
@@ -0,0 +1,56 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#ifndef __FINGERPRINT_H
+#define __FINGERPRINT_H
+
+#include <string>
+#include <vector>
+
+using std::string;
+
+// Versions of the hash, as kept in Identify.checksum_version. Rows from
+// before there was a choice are all MD5.
+#define FINGERPRINT_MD5         1
+#define FINGERPRINT_XXH64       2
+#define FINGERPRINT_LATEST      FINGERPRINT_XXH64
+
+// Identifies a file by its contents: a hash of the last megabyte,
+// leaving out an ID3v1 tag so that retagging does not change it.
+//
+// The end of the file is read once, with a single pread, and every
+// version is computed from that on demand - so a file can be checked
+// against old MD5 rows without reading it twice. There is no shared
+// state, so the scanner workers and immsd can all use it at once.
+class Fingerprint
+{
+public:
+    Fingerprint(const string &path);
+
+    bool isok() const { return ok; }
+
+    // "bad_checksum" if the file could not be read.
+    string get(int version = FINGERPRINT_LATEST) const;
+
+private:
+    bool ok;
+    std::vector<char> data;
+    size_t start, length;
+};
+
+#endif
@@ -23,6 +23,7 @@
 
 #include <string>
 #include <list>
+#include <algorithm>
 #include <iostream>
 #include <unistd.h>
 #include <fcntl.h>
@@ -38,13 +39,15 @@ class LineProcessor
 {
 public:
     virtual void process_line(const string &line) = 0;
+    // Raw bytes asked for with GIOSocket::expect_block.
+    virtual void process_block(const string &data) {}
     virtual ~LineProcessor() {}
 };
 
 class GIOSocket : public LineProcessor
 {
 public:
-    GIOSocket() : con(0), read_tag(0), write_tag(0), outp(0) {}
+    GIOSocket() : con(0), read_tag(0), write_tag(0), outp(0), block_left(0) {}
     virtual ~GIOSocket() { close(); }
 
     bool isok() { return con; }
@@ -67,6 +70,16 @@ public:
         outbuf.push_back(line);
     }
 
+    // Hand the next bytes bytes to process_block as they are, instead
+    // of splitting them into lines. For payloads sent after a header
+    // line that gives their length.
+    void expect_block(size_t bytes)
+    {
+        block_left = bytes;
+        block = "";
+        block.reserve(bytes);
+    }
+
     void close()
     {
         if (con)
@@ -80,6 +93,8 @@ public:
             g_source_remove(read_tag);
         write_tag = read_tag = 0;
         inbuf = "";
+        block = "";
+        block_left = 0;
         outbuf.clear();
         outp = 0;
         con = 0;
@@ -109,12 +124,14 @@ public:
         assert(condition & G_IO_OUT);
 
         if (!outp && !outbuf.empty())
-            outp = outbuf.front().c_str();
+            outp = outbuf.front().data();
 
         if (!outp)
             return (write_tag = 0);
 
-        unsigned len = strlen(outp);
+        // not strlen: a block may well have NULs in it
+        const string &front = outbuf.front();
+        unsigned len = front.length() - (outp - front.data());
         gsize n = 0;
         GIOError e = g_io_channel_write(con, (char*)outp, len, &n);
         if (e == G_IO_ERROR_NONE)
@@ -152,17 +169,35 @@ public:
             GIOError e = g_io_channel_read(con, buf, sizeof(buf) - 1, &n);
             if (e == G_IO_ERROR_NONE)
             {
-                buf[n] = '\0';
-                char *lineend, *cur = buf;
-                while ((lineend = strchr(cur, '\n')))
+                char *cur = buf, *end = buf + n;
+                while (cur < end)
                 {
-                    *lineend = '\0';
-                    inbuf += cur;
+                    if (block_left)
+                    {
+                        size_t take =
+                            std::min(block_left, (size_t)(end - cur));
+                        block.append(cur, take);
+                        cur += take;
+                        if (!(block_left -= take))
+                        {
+                            string data;
+                            data.swap(block);
+                            process_block(data);
+                        }
+                        continue;
+                    }
+                    char *lineend = (char *)memchr(cur, '\n', end - cur);
+                    if (!lineend)
+                    {
+                        inbuf.append(cur, end - cur);
+                        break;
+                    }
+                    inbuf.append(cur, lineend - cur);
                     cur = lineend + 1;
-                    process_line(inbuf);
-                    inbuf = "";
+                    string line;
+                    line.swap(inbuf);
+                    process_line(line);
                 }
-                inbuf += cur;
             }
         }
 
@@ -170,13 +205,15 @@ public:
     }
 
 private:
-    char buf[128];
+    char buf[8192];
 
     GIOChannel *con;
     int read_tag, write_tag;
     string inbuf;
     const char *outp;
     std::list<string> outbuf;
+    string block;
+    size_t block_left;
 };
 
 #endif
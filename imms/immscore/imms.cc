@@ -28,6 +28,9 @@
 #include "flags.h"
 #include "strmanip.h"
 #include "immsutil.h"
+#include "writebehind.h"
+#include "snapshot.h"
+#include "analysisqueue.h"
 
 #include <model/distance.h>
 
@@ -67,11 +70,18 @@ Imms::Imms(IMMSServer *server) : server(server)
 
     time_t t = time(0);
     fout << endl << endl << ctime(&t) << setprecision(3);
+
+    WriteBehind::self()->enable();
+    LibrarySnapshot::self()->load();
+    index.load(get_imms_root(ACOUSTIC_INDEX));
+    reload_correlations();
 }
 
 Imms::~Imms()
 {
     clear_recent();
+    WriteBehind::self()->enable(false);
+    LibrarySnapshot::self()->clear();
 }
 
 void Imms::setup(bool use_xidle)
@@ -88,6 +98,9 @@ void Imms::get_metacandidates(int size)
     if (last.sid != -1)
         CorrelationDb::get_related(metacandidates, last.sid, 20);
 
+    get_similar(handpicked, 15);
+    get_similar(last, 10);
+
     sort(metacandidates.begin(), metacandidates.end());
     metacandidates.erase(
         unique(metacandidates.begin(), metacandidates.end()),
@@ -100,10 +113,25 @@ void Imms::get_metacandidates(int size)
     reverse(metacandidates.begin(), metacandidates.end());
 }
 
+void Imms::get_similar(const LastInfo &last, int limit)
+{
+    if (last.sid == -1 || !last.avalid || !index.is_loaded())
+        return;
+
+    // the song itself is bound to be among them
+    vector<int> uids;
+    index.nearest(last.sample.mm, last.sample.beats, limit + 1, uids);
+    uids.erase(std::remove(uids.begin(), uids.end(), last.uid), uids.end());
+
+    PlaylistDb::get_playlist_positions(metacandidates, uids, limit + 1);
+}
+
 void Imms::do_events()
 {
     if (!SongPicker::do_events())
         CorrelationDb::maybe_expire_recent();
+    WriteBehind::self()->maybe_flush();
+    SqlDb::maybe_checkpoint();
     XIdle::query();
 }
 
@@ -122,6 +150,29 @@ void Imms::playlist_changed(int length)
     SongPicker::playlist_changed(length);
 } 
 
+bool Imms::playlist_edit(const PlaylistEdit &edit, const string &paths)
+{
+    if (!edit.fits(pl_length))
+        return false;
+
+    PlaylistDb::playlist_edit(edit, paths);
+    SongPicker::playlist_edit(edit);
+    local_max = std::min(MAX_TIME, pl_length * 8 * 60);
+    return true;
+}
+
+bool Imms::playlist_check(int length, uint64_t sum)
+{
+    PlaylistChecksum checksum = PlaylistDb::playlist_checksum();
+    if (length != pl_length || checksum.get_length() != length
+            || checksum.get_sum() != sum)
+        return false;
+
+    // what playlist_ready does, short of starting over
+    PlaylistDb::playlist_ready();
+    return true;
+}
+
 void Imms::playlist_ready()
 {
     PlaylistDb::playlist_ready();
@@ -133,6 +184,12 @@ void Imms::sync(bool incharge)
     if (!incharge)
         PlaylistDb::clear_matches();
     PlaylistDb::sync();
+
+    // pick up whatever the other tools changed while we were running
+    WriteBehind::self()->flush();
+    LibrarySnapshot::self()->load();
+    index.load(get_imms_root(ACOUSTIC_INDEX));
+
     SongPicker::reset();
     local_max = std::min(MAX_TIME,
             ImmsDb::get_effective_playlist_length() * 8 * 60);
@@ -170,10 +227,7 @@ void Imms::start_song(int position, string path)
 
 #ifdef ANALYZER_ENABLED
     if (!current.isanalyzed())
-    {
-        string epath = rex.replace(path, "'", "'\"'\"'", Regexx::global);
-        system(string("analyzer '" + epath + "' &").c_str());
-    }
+        AnalysisQueue::self()->push(path, current.get_uid(), ANALYZE_NOW);
 #endif
 }
 
@@ -215,7 +269,10 @@ void Imms::set_lastinfo(LastInfo &last)
     last.set_on = time(0);
     last.uid = current.get_uid();
     last.sid = current.get_sid();
-    last.avalid = current.get_acoustic(&last.mm, last.beats);
+    MixtureModel mm;
+    last.avalid = current.get_acoustic(&mm, last.sample.beats);
+    if (last.avalid)
+        last.sample.mm.pack(mm);
 }
 
 void Imms::end_song(bool at_the_end, bool jumped, bool bad)
@@ -287,17 +344,54 @@ void Imms::evaluate_transition(SongData &data, LastInfo &last, float weight)
     float rel = cap(ImmsDb::correlate(
                 data.get_sid(), last.sid) / MAX_CORRELATION);
     data.relation += ROUND(rel * weight * CORRELATION_IMPACT);
+}
+
+void Imms::evaluate_candidates(const std::vector<SongData *> &songs)
+{
+    // load the acoustic data of every candidate once, for both lasts
+    analyzed.clear();
+    samples.resize(songs.size());
+
+    for (size_t i = 0; i < songs.size(); ++i)
+    {
+        songs[i]->acoustic = 0;
 
-    if (!last.avalid)
+        MixtureModel mm;
+        AcousticSample &sample = samples[analyzed.size()];
+        if (!songs[i]->get_acoustic(&mm, sample.beats))
+        {
+#ifdef ANALYZER_ENABLED
+            // it may well be picked again - have it ready by then
+            AnalysisQueue::self()->push(songs[i]->get_path(),
+                    songs[i]->get_uid());
+#endif
+            continue;
+        }
+        sample.mm.pack(mm);
+        analyzed.push_back(songs[i]);
+    }
+
+    if (analyzed.empty())
         return;
 
-    MixtureModel mm;
-    float beats[BEATSSIZE];
-    if (!data.get_acoustic(&mm, beats))
+    evaluate_acoustic(analyzed, handpicked, 0.75);
+    evaluate_acoustic(analyzed, last, (handpicked.sid == -1 ? 0.5 : 0.25));
+}
+
+void Imms::evaluate_acoustic(const std::vector<SongData *> &songs,
+        LastInfo &last, float weight)
+{
+    if (last.sid != -1 && last.set_on + LAST_EXPIRE < time(0))
+        last.sid = -1;
+
+    if (last.sid == -1 || !last.avalid)
         return;
 
-    float score = model.evaluate(last.mm, last.beats, mm, beats);
-    data.acoustic += ROUND(score * weight * ACOUSTIC_IMPACT);
+    scores.resize(songs.size());
+    model.evaluate_batch(last.sample, &samples[0], songs.size(), &scores[0]);
+
+    for (size_t i = 0; i < songs.size(); ++i)
+        songs[i]->acoustic += ROUND(scores[i] * weight * ACOUSTIC_IMPACT);
 }
 
 bool Imms::fetch_song_info(SongData &data)
@@ -31,6 +31,7 @@
 #include <analyzer/mfcckeeper.h>
 #include <analyzer/beatkeeper.h>
 #include <model/model.h>
+#include <model/acousticindex.h>
 
 // IMMS, UMMS, we all MMS for XMMS?
 
@@ -52,6 +53,10 @@ public:
     virtual void playlist_ready();
 
     void playlist_changed(int length);
+    // Incremental updates from the player. Both return false if the
+    // playlist is no longer what the player has, and needs resending.
+    bool playlist_edit(const PlaylistEdit &edit, const std::string &paths);
+    bool playlist_check(int length, uint64_t sum);
 
     // process internal events - call this periodically
     void do_events();
@@ -69,8 +74,7 @@ protected:
         time_t set_on;
         int uid, sid;
         bool avalid;
-        MixtureModel mm;
-        float beats[BEATSSIZE];
+        AcousticSample sample;
     };
 
     virtual void playlist_updated() { server->playlist_updated(); }
@@ -79,12 +83,16 @@ protected:
     virtual void request_playlist_item(int index);
     virtual void get_metacandidates(int size);
     virtual void reset_selection();
+    virtual void evaluate_candidates(const std::vector<SongData *> &songs);
 
     // Helper functions
     bool fetch_song_info(SongData &data);
     void print_song_info();
     void set_lastinfo(LastInfo &last);
     void evaluate_transition(SongData &data, LastInfo &last, float weight);
+    void evaluate_acoustic(const std::vector<SongData *> &songs,
+            LastInfo &last, float weight);
+    void get_similar(const LastInfo &last, int limit);
 
     // State variables
     bool last_skipped, last_jumped;
@@ -93,6 +101,10 @@ protected:
     std::ofstream fout;
 
     SVMSimilarityModel model;
+    AcousticIndex index;
+    std::vector<SongData *> analyzed;
+    std::vector<AcousticSample> samples;
+    std::vector<float> scores;
     LastInfo handpicked, last;
     IMMSServer *server;
 };
@@ -23,7 +23,7 @@
 #include "playlist.h"
 #include "correlate.h"
 
-#define SCHEMA_VERSION 14
+#define SCHEMA_VERSION 17
 
 class ImmsDb : virtual public BasicDb,
                        public PlaylistDb,
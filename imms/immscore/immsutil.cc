@@ -17,6 +17,7 @@
  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 */
 #include <stdlib.h>     // for (s)random
+#include <string.h>
 #include <signal.h>
 #include <time.h>
 #include <math.h>
@@ -164,6 +165,42 @@ string path_normalize(const string &path)
     return resolved;
 }
 
+string PathNormalizer::normalize(const string &path)
+{
+    const char *start = path.c_str();
+    while (isspace(*start))
+        start++;
+
+    // symlinks and the like get the full treatment
+    struct stat st;
+    const char *slash = strrchr(start, '/');
+    if (lstat(start, &st) || !S_ISREG(st.st_mode) || !slash)
+        return path_normalize(start);
+
+    string dir(start, slash - start + 1);
+    std::map<string, string>::iterator i = dirs.find(dir);
+    if (i == dirs.end())
+    {
+        char resolved[4096];
+        if (!realpath(dir.c_str(), resolved))
+            return path_normalize(start);
+        string real = resolved;
+        if (real != "/")
+            real += '/';
+        i = dirs.insert(std::make_pair(dir, real)).first;
+    }
+    return i->second + (slash + 1);
+}
+
+// 32 bit FNV-1a
+unsigned PlaylistChecksum::hash(const string &path)
+{
+    uint32_t h = 2166136261U;
+    for (size_t i = 0; i < path.length(); ++i)
+        h = (h ^ (unsigned char)path[i]) * 16777619U;
+    return h;
+}
+
 int listdir(const string &dirname, vector<string> &files)
 {
     files.clear();
@@ -192,6 +229,98 @@ int socket_connect(const string &sockname)
     return fd;
 }
 
+bool write_all(int fd, const void *data, size_t size)
+{
+    const char *p = (const char *)data;
+    while (size)
+    {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool read_all(int fd, void *data, size_t size)
+{
+    char *p = (char *)data;
+    while (size)
+    {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool read_line(int fd, string &line)
+{
+    line = "";
+    char c;
+    while (true)
+    {
+        ssize_t n = read(fd, &c, 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        if (c == '\n')
+            return true;
+        line += c;
+    }
+}
+
+pid_t WorkerPool::start_worker(int &jobs, int &results)
+{
+    int tochild[2], fromchild[2];
+    if (pipe(tochild))
+        return -1;
+    if (pipe(fromchild))
+    {
+        close(tochild[0]);
+        close(tochild[1]);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        close(tochild[0]);
+        close(tochild[1]);
+        close(fromchild[0]);
+        close(fromchild[1]);
+        return -1;
+    }
+
+    if (!pid)
+    {
+        // the other workers' pipes, the database, immsd's sockets...
+        for (int fd = 3; fd < 255; ++fd)
+            if (fd != tochild[0] && fd != fromchild[1])
+                close(fd);
+
+        signal(SIGINT, SIG_IGN);
+        signal(SIGPIPE, SIG_IGN);
+
+        work(tochild[0], fromchild[1]);
+        _exit(0);
+    }
+
+    close(tochild[0]);
+    close(fromchild[1]);
+    jobs = tochild[1];
+    results = fromchild[0];
+    return pid;
+}
+
 bool file_exists(const string &filename) {
     struct stat buf;
     return !stat(filename.c_str(), &buf);
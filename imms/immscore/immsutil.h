@@ -20,11 +20,13 @@
 #define __UTILS_H
 
 #include <sys/time.h>
+#include <sys/types.h>
 #include <stdint.h>
 
 #include <climits>
 #include <string>
 #include <vector>
+#include <map>
 #include <iostream>
 
 #include "appname.h"
@@ -56,6 +58,31 @@ static inline float cap(float val, float max = 1) {
 
 int socket_connect(const string &sockname);
 
+// Both keep going through interruptions and short counts; false if the
+// other end went away or it failed before all of it got through.
+bool write_all(int fd, const void *data, size_t size);
+bool read_all(int fd, void *data, size_t size);
+// A line without the newline, read a byte at a time so that nothing
+// after it is taken.
+bool read_line(int fd, string &line);
+
+// Farms work out to forked processes, with a pipe to send each of them
+// jobs and one to get the results back. A worker lets go of everything
+// else the parent had open, ignores SIGINT and SIGPIPE - the parent
+// decides when to stop - and leaves without running any destructors once
+// work() returns, since the database belongs to the parent.
+class WorkerPool
+{
+public:
+    virtual ~WorkerPool() {}
+protected:
+    // The pid of the new worker, or -1 with errno set. The parent's ends
+    // of the pipes go in jobs and results.
+    pid_t start_worker(int &jobs, int &results);
+    // Runs in the worker, reading from jobs and writing to results.
+    virtual void work(int jobs, int results) = 0;
+};
+
 class StackTimer
 {
 public:
@@ -105,6 +132,36 @@ string get_imms_root(const string &file = "");
 
 string path_normalize(const string &path);
 
+// path_normalize for a lot of paths at once, such as a whole playlist.
+// Directories are resolved once and remembered, so that a plain file
+// costs one lstat instead of one per path component.
+class PathNormalizer
+{
+public:
+    string normalize(const string &path);
+    void clear() { dirs.clear(); }
+private:
+    std::map<string, string> dirs;
+};
+
+// Order sensitive checksum of a playlist, for immsd and the player to
+// tell whether they still agree on it without comparing every path.
+class PlaylistChecksum
+{
+public:
+    PlaylistChecksum() : sum(0), length(0) {}
+    static unsigned hash(const string &path);
+    void add(unsigned hash)
+        { sum = (sum ^ hash) * 1099511628211ULL; ++length; }
+    void add(const string &path) { add(hash(path)); }
+
+    uint64_t get_sum() const { return sum; }
+    int get_length() const { return length; }
+private:
+    uint64_t sum;
+    int length;
+};
+
 float rms_string_distance(const string &s1, const string &s2,
         int max = INT_MAX);
 int listdir(const string &dirname, vector<string> &files);
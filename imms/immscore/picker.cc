@@ -30,6 +30,11 @@
 #define     MIN_SAMPLE_SIZE         35
 #define     MAX_ATTEMPTS            (SAMPLE_SIZE*2)
 
+// Playlists with fewer unknown songs than this are identified one song
+// at a time; the scanner gets this long to work on every tick.
+#define     SCAN_MIN_SONGS          50
+#define     SCAN_SLICE              100
+
 using std::endl;
 using std::cerr;
 using std::map;
@@ -44,6 +49,7 @@ SongPicker::SongPicker()
       acquired(0), winner(0, "winner")
 {
     reschedule_requested = playlist_known = 0;
+    scan_tried = false;
     reset();
 }
 
@@ -57,9 +63,62 @@ void SongPicker::reset()
         --reschedule_requested;
 }
 
+void PlaylistScanner::add(int position, const string &path)
+{
+    vector<int> &at = positions[path];
+    if (at.empty())
+        LibraryScanner::add(path);
+    at.push_back(position);
+}
+
+void PlaylistScanner::scanned(const string &path, int uid)
+{
+    const vector<int> &at = positions[path];
+    for (size_t i = 0; i < at.size(); ++i)
+        Q("UPDATE Playlist SET uid = ? WHERE pos = ?;")
+            << (uid == -1 ? -2 : uid) << at[i] << execute;
+}
+
+void PlaylistScanner::remap(const PlaylistEdit &edit)
+{
+    for (map<string, vector<int> >::iterator i = positions.begin();
+            i != positions.end(); ++i)
+    {
+        vector<int> &at = i->second;
+        for (size_t j = 0; j < at.size(); ++j)
+            at[j] = edit.remap(at[j]);
+        // scanned anyway, but with nowhere to put the result
+        at.erase(std::remove(at.begin(), at.end(), -1), at.end());
+    }
+}
+
+void SongPicker::playlist_edit(const PlaylistEdit &edit)
+{
+    pl_length += edit.growth();
+
+    // the candidates are only good for the positions they came from
+    reset();
+    winner.position = edit.remap(winner.position);
+    current.position = edit.remap(current.position);
+
+    if (scanner.get())
+        scanner->remap(edit);
+
+    // new songs may need identifying
+    if (edit.type == PlaylistEdit::Insert
+            || edit.type == PlaylistEdit::Replace)
+    {
+        scan_tried = false;
+        if (playlist_known == 2)
+            playlist_known = 1;
+    }
+}
+
 void SongPicker::playlist_changed(int length)
 {
     playlist_known = 0;
+    scan_tried = false;
+    scanner.reset();
     reset();
 }
 
@@ -119,16 +178,44 @@ bool SongPicker::do_events()
     if (playlist_known == 2)
         return false;
 
+    if (scanner.get())
+    {
+        if (!scanner->pump(SCAN_SLICE))
+            scanner.reset();
+        return true;
+    }
+
     int pos = ImmsDb::get_unknown_playlist_item();
     if (pos < 0)
     {
         playlist_known = 2;
         return false;
     }
+    if (!scan_tried && start_scanner())
+        return true;
     identify_playlist_item(pos);
     return true;
 }
 
+bool SongPicker::start_scanner()
+{
+    // only worth trying once per playlist
+    scan_tried = true;
+
+    vector<int> positions;
+    vector<string> paths;
+    ImmsDb::get_unknown_playlist_items(positions, paths);
+    if (positions.size() < SCAN_MIN_SONGS)
+        return false;
+
+    LOG(INFO) << "Scanning " << positions.size() << " new songs" << endl;
+
+    scanner.reset(new PlaylistScanner());
+    for (size_t i = 0; i < positions.size(); ++i)
+        scanner->add(positions[i], paths[i]);
+    return true;
+}
+
 void SongPicker::revalidate_current(int pos, const string &path)
 {
     if (winner.position == pos && winner.get_path() == path)
@@ -138,7 +225,8 @@ void SongPicker::revalidate_current(int pos, const string &path)
     else if (current.get_path() != path || current.position != pos)
     {
         current = SongData(pos, path);
-        fetch_song_info(current);
+        if (fetch_song_info(current))
+            evaluate_candidates(vector<SongData *>(1, &current));
     }
 }
 
@@ -158,6 +246,12 @@ int SongPicker::select_next()
         return 0;
     }
 
+    vector<SongData *> songs;
+    for (Candidates::iterator i = candidates.begin();
+            i != candidates.end(); ++i)
+        songs.push_back(&*i);
+    evaluate_candidates(songs);
+
     typedef map<int, vector<const SongData *> > Ratings;
     Ratings ratings;
 
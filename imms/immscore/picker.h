@@ -22,9 +22,25 @@
 #include <string>
 #include <list>
 #include <vector>
+#include <map>
+#include <memory>
 
 #include "immsconf.h"
 #include "fetcher.h"
+#include "scanner.h"
+
+// Identifies the unknown part of the playlist in the background.
+class PlaylistScanner : public LibraryScanner
+{
+public:
+    void add(int position, const std::string &path);
+    // Keeps the positions in step with the playlist.
+    void remap(const PlaylistEdit &edit);
+protected:
+    virtual void scanned(const std::string &path, int uid);
+private:
+    std::map<std::string, std::vector<int> > positions;
+};
 
 class SongPicker : protected InfoFetcher
 {
@@ -33,6 +49,8 @@ public:
     virtual int select_next();
     virtual void playlist_ready() { playlist_known = 1; }
     virtual void playlist_changed(int length);
+    // Unlike playlist_changed, keeps what is known about the playlist.
+    virtual void playlist_edit(const PlaylistEdit &edit);
 
     void request_reschedule() { reschedule_requested = 2; }
 
@@ -46,6 +64,9 @@ protected:
     virtual void reset_selection() = 0;
     virtual void request_playlist_item(int index) = 0;
     virtual void get_metacandidates(int size) = 0;
+    // Called with all of the candidates at once, right before a winner
+    // is drawn, to fill in anything that is cheaper to do in bulk.
+    virtual void evaluate_candidates(const std::vector<SongData *> &songs) {}
 
     SongData current;
     std::vector<int> metacandidates;
@@ -54,6 +75,11 @@ protected:
 private:
     void get_related(int pivot_sid, int limit);
 
+    bool start_scanner();
+
+    std::auto_ptr<PlaylistScanner> scanner;
+    bool scan_tried;
+
     bool selection_ready;
     int reschedule_requested;
     int acquired, attempts, playlist_known;
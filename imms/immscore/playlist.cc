@@ -16,6 +16,8 @@
  along with this program; if not, write to the Free Software
  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 */
+#include <string.h>
+
 #include <iostream>
 
 #include "playlist.h"
@@ -38,7 +40,15 @@ void PlaylistDb::sql_create_tables()
         Q("CREATE TEMPORARY TABLE Playlist ("
                 "'pos' INTEGER PRIMARY KEY, "
                 "'path' VARCHAR(4096) NOT NULL, "
-                "'uid' INTEGER DEFAULT -1);").execute();
+                "'uid' INTEGER DEFAULT -1, "
+                "'hash' INTEGER DEFAULT 0);").execute();
+
+        // scratch space for PlaylistDb::shift_positions
+        Q("CREATE TEMPORARY TABLE PlaylistShift ("
+                "'pos' INTEGER PRIMARY KEY, "
+                "'path' VARCHAR(4096) NOT NULL, "
+                "'uid' INTEGER, "
+                "'hash' INTEGER);").execute();
 
         Q("CREATE TEMPORARY TABLE Matches "
                 "('uid' INTEGER UNIQUE NOT NULL);").execute();
@@ -67,11 +77,31 @@ int PlaylistDb::get_unknown_playlist_item()
     return -1;
 }
 
+void PlaylistDb::get_unknown_playlist_items(vector<int> &positions,
+        vector<string> &paths)
+{
+    try {
+        Q q("SELECT pos, path FROM Playlist WHERE uid = -1;");
+
+        while (q.next())
+        {
+            int pos;
+            string path;
+            q >> pos >> path;
+            positions.push_back(pos);
+            paths.push_back(path);
+        }
+    }
+    WARNIFFAILED();
+}
+
 Song PlaylistDb::playlist_id_from_item(int pos)
 {
     try {
-        Q q("SELECT L.uid, L.sid, P.path FROM Library L "
+        static SQLQueryHandle select_item(
+                "SELECT L.uid, L.sid, P.path FROM Library L "
                 "INNER JOIN Playlist P USING(uid) WHERE P.pos = ?;");
+        Q q(select_item);
         q << pos;
 
         if (!q.next())
@@ -99,15 +129,173 @@ void PlaylistDb::playlist_update_identity(int pos, int uid)
 void PlaylistDb::playlist_insert_item(int pos, const string &path)
 {
     try {
-        Q q("INSERT OR REPLACE INTO Playlist ('pos', 'path', 'uid') "
-                "VALUES (?, ?, coalesce((SELECT uid FROM Identify "
-                    "WHERE path = ?), -1));");
-        q << pos << path << path;
+        Q q("INSERT OR REPLACE INTO Playlist ('pos', 'path', 'uid', 'hash') "
+                "VALUES (?, ?2, coalesce((SELECT uid FROM Identify "
+                    "WHERE path = ?2), -1), ?3);");
+        q << pos << normalizer.normalize(path)
+            << (int)PlaylistChecksum::hash(path);
         q.execute();
     }
     WARNIFFAILED();
 }
 
+int PlaylistDb::playlist_insert_batch(int first, const string &batch)
+{
+    int pos = first;
+    try {
+        static SQLQueryHandle insert_item(
+                "INSERT OR REPLACE INTO Playlist "
+                    "('pos', 'path', 'uid', 'hash') "
+                "VALUES (?, ?2, coalesce((SELECT uid FROM Identify "
+                    "WHERE path = ?2), -1), ?3);");
+
+        AutoTransaction a;
+        Q q(insert_item);
+
+        const char *cur = batch.data(), *end = cur + batch.length();
+        while (cur < end)
+        {
+            const char *entry = cur;
+            cur = (const char *)memchr(cur, '\0', end - cur);
+            if (!cur)
+                cur = end;
+            string path(entry, cur++ - entry);
+            q << pos++ << normalizer.normalize(path)
+                << (int)PlaylistChecksum::hash(path);
+            q.execute();
+        }
+
+        a.commit();
+    }
+    WARNIFFAILED();
+
+    return pos - first;
+}
+
+bool PlaylistEdit::fits(int length) const
+{
+    if (pos < 0 || count < 0)
+        return false;
+    if (type == Insert)
+        return pos <= length;
+    if (type == Move && (to < 0 || to + count > length))
+        return false;
+    return pos + count <= length;
+}
+
+int PlaylistEdit::remap(int position) const
+{
+    if (position < pos)
+    {
+        if (type == Insert || type == Remove || type == Replace)
+            return position;
+        return position < to ? position : position + count;
+    }
+    if (position < pos + count)
+    {
+        if (type == Insert)
+            return position + count;
+        if (type == Move)
+            return to + position - pos;
+        return -1;
+    }
+    if (type == Insert)
+        return position + count;
+    if (type == Remove)
+        return position - count;
+    if (type == Replace)
+        return position;
+    position -= count;
+    return position < to ? position : position + count;
+}
+
+// Not an UPDATE: pos has to be unique after every row, and changing
+// the key of every row one at a time is slower than copying them all
+// out and back in order.
+void PlaylistDb::shift_positions(int from, int by)
+{
+    Q("INSERT INTO PlaylistShift "
+            "SELECT pos + ?, path, uid, hash FROM Playlist WHERE pos >= ?;")
+        << by << from << execute;
+    Q("DELETE FROM Playlist WHERE pos >= ?;") << from << execute;
+    Q("INSERT INTO Playlist SELECT * FROM PlaylistShift;").execute();
+    Q("DELETE FROM PlaylistShift;").execute();
+}
+
+void PlaylistDb::playlist_edit(const PlaylistEdit &edit, const string &batch)
+{
+    effective_length_cache = -1;
+    try {
+        AutoTransaction a;
+
+        int end = edit.pos + edit.count;
+        if (edit.type == PlaylistEdit::Insert)
+            shift_positions(edit.pos, edit.count);
+        if (edit.type == PlaylistEdit::Insert
+                || edit.type == PlaylistEdit::Replace)
+        {
+            playlist_insert_batch(edit.pos, batch);
+            // only good for one transfer
+            normalizer.clear();
+        }
+
+        if (edit.type == PlaylistEdit::Remove)
+        {
+            Q("DELETE FROM Playlist WHERE pos >= ? AND pos < ?;")
+                << edit.pos << end << execute;
+            shift_positions(end, -edit.count);
+        }
+
+        if (edit.type == PlaylistEdit::Move)
+        {
+            vector<string> paths;
+            vector<int> uids, hashes;
+            Q q("SELECT path, uid, hash FROM Playlist "
+                    "WHERE pos >= ? AND pos < ? ORDER BY pos;");
+            q << edit.pos << end;
+            while (q.next())
+            {
+                string path;
+                int uid, hash;
+                q >> path >> uid >> hash;
+                paths.push_back(path);
+                uids.push_back(uid);
+                hashes.push_back(hash);
+            }
+
+            Q("DELETE FROM Playlist WHERE pos >= ? AND pos < ?;")
+                << edit.pos << end << execute;
+            shift_positions(end, -edit.count);
+            shift_positions(edit.to, edit.count);
+
+            for (size_t i = 0; i < paths.size(); ++i)
+                Q("INSERT INTO Playlist ('pos', 'path', 'uid', 'hash') "
+                        "VALUES (?, ?, ?, ?);")
+                    << edit.to + (int)i << paths[i] << uids[i] << hashes[i]
+                    << execute;
+        }
+
+        a.commit();
+    }
+    WARNIFFAILED();
+}
+
+PlaylistChecksum PlaylistDb::playlist_checksum()
+{
+    PlaylistChecksum checksum;
+    try {
+        Q q("SELECT hash FROM Playlist ORDER BY pos;");
+        while (q.next())
+        {
+            int hash;
+            q >> hash;
+            checksum.add((unsigned)hash);
+        }
+    }
+    WARNIFFAILED();
+    return checksum;
+}
+
 int PlaylistDb::get_real_playlist_length()
 {
     int result = 0;
@@ -156,6 +344,35 @@ void PlaylistDb::get_random_sample(vector<int> &metacandidates, int size)
     WARNIFFAILED();
 }
 
+void PlaylistDb::get_playlist_positions(vector<int> &positions,
+        const vector<int> &uids, int limit)
+{
+    if (uids.empty() || limit < 1)
+        return;
+
+    // as many placeholders as the limit, however many uids there are,
+    // so that the statement cache does not grow with every call
+    string query = "SELECT pos FROM Filter WHERE uid IN (?";
+    for (int i = 1; i < limit; ++i)
+        query += ", ?";
+    query += ");";
+
+    try {
+        // unknown items have a uid of -1, so pad with a repeat instead
+        Q q(query);
+        for (int i = 0; i < limit; ++i)
+            q << uids[i < (int)uids.size() ? i : 0];
+
+        int pos;
+        while (q.next())
+        {
+            q >> pos;
+            positions.push_back(pos);
+        }
+    }
+    WARNIFFAILED();
+}
+
 void PlaylistDb::clear_matches()
 {
     try {
@@ -22,28 +22,67 @@
 #include "immsconf.h"
 #include "basicdb.h"
 #include "song.h"
+#include "immsutil.h"
 
 #include <vector>
 
+// One change to the playlist: count items at pos are inserted, removed,
+// replaced, or moved so that they start at to.
+class PlaylistEdit
+{
+public:
+    enum Type { Insert, Remove, Replace, Move };
+
+    PlaylistEdit(Type type, int pos, int count, int to = 0)
+        : type(type), pos(pos), count(count), to(to) {}
+
+    // Whether it makes sense for a playlist this long.
+    bool fits(int length) const;
+    // How much longer it makes the playlist.
+    int growth() const
+        { return type == Insert ? count : type == Remove ? -count : 0; }
+    // Where the item at position ends up, or -1 if it is gone.
+    int remap(int position) const;
+
+    Type type;
+    int pos, count, to;
+};
+
 class PlaylistDb
 {
 public:
     PlaylistDb() : effective_length_cache(-1) { clear_matches(); }
     virtual ~PlaylistDb() {};
+    // The path as the player has it: it is stored normalized, next to
+    // its hash for playlist_checksum().
     void playlist_insert_item(int pos, const string &path);
+    // Inserts the NUL terminated paths in batch at first, first + 1, ...
+    // in one transaction. Returns how many there were.
+    int playlist_insert_batch(int first, const string &batch);
+    // Applies an edit that fits, with the new paths for an Insert or a
+    // Replace in the same form as for playlist_insert_batch.
+    void playlist_edit(const PlaylistEdit &edit, const string &batch);
+    // The PlaylistChecksum of the paths as the player sent them.
+    PlaylistChecksum playlist_checksum();
     void playlist_update_identity(int pos, int uid);
     static Song playlist_id_from_item(int pos);
 
     string get_item_from_playlist(int pos);
     int get_unknown_playlist_item();
+    void get_unknown_playlist_items(std::vector<int> &positions,
+            std::vector<string> &paths);
 
     int get_real_playlist_length();
     int get_effective_playlist_length();
     void get_random_sample(std::vector<int> &metacandidates, int size);
+    // Positions of the first limit uids that are on the playlist.
+    void get_playlist_positions(std::vector<int> &positions,
+            const std::vector<int> &uids, int limit);
 
     void playlist_clear();
     void playlist_ready()
     {
+        normalizer.clear();
         sync();
         playlist_updated();
     }
@@ -57,7 +96,11 @@ protected:
     virtual void sql_schema_upgrade(int from = 0) {}
 
 private:
+    void shift_positions(int from, int by);
+
     int effective_length_cache;
+    // kept for the length of a playlist transfer
+    PathNormalizer normalizer;
 };
 
 #endif
@@ -0,0 +1,134 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <math.h>
+
+#include <algorithm>
+
+#include "ratingstate.h"
+#include "flags.h"
+#include "immsutil.h"
+#include "ltqnorm.h"
+#include "sqlite++.h"
+
+#define DELTA_SCALE     0.8
+#define DECAY_LIMIT     60
+#define MIN_TRIALS      10
+
+double RatingState::delta(int played, int flags)
+{
+    return Flags::deltify(played, flags) * DELTA_SCALE;
+}
+
+double RatingState::decay(double delta, double sum)
+{
+    if (sum > DECAY_LIMIT)
+        return 0;
+
+    return delta * log(DECAY_LIMIT + 1 - sum) / log(DECAY_LIMIT);
+}
+
+int RatingState::score(double ones, double zeros, double total,
+        double biasmean)
+{
+    if (!ones && !zeros)
+        zeros = ones = 1;
+
+    if (total < MIN_TRIALS)
+    {
+        double biasmass = MIN_TRIALS - total;
+        ones += biasmass * biasmean;
+        zeros += biasmass * (1 - biasmean);
+    }
+
+    // Clamp off a minimum values to avoid rounding errors.
+    ones = std::max(ones, 0.0001);
+    zeros = std::max(zeros, 0.0001);
+
+    // Calculate the upper bound of the Wilson score. For details, see:
+    // http://www.evanmiller.org/how-not-to-sort-by-average-rating.html.
+    double n = ones + zeros;
+    double z = ltqnorm(0.95);
+    double phat = ones / n;
+    double r = phat + z*z/(2*n) + z * sqrt((phat*(1-phat)+z*z/(4*n))/n);
+    r /= (1+z*z/n);
+
+    return ROUND(r * 100);
+}
+
+void RatingState::add(int played, int flags, time_t when)
+{
+    until = std::max(until, when);
+
+    int delta = Flags::deltify(played, flags);
+    if (!delta)
+        return;
+
+    total += abs(delta);
+    recent.insert(recent.begin(), delta);
+
+    // anything with more than DECAY_LIMIT worth of newer plays
+    // decays to nothing and can be forgotten
+    int sum = 0;
+    for (size_t i = 0; i < recent.size(); ++i)
+    {
+        if (sum * DELTA_SCALE > DECAY_LIMIT)
+        {
+            recent.resize(i);
+            break;
+        }
+        sum += abs(recent[i]);
+    }
+}
+
+int RatingState::rating(double biasmean) const
+{
+    double ones = 0, zeros = 0, sum = 0;
+    for (size_t i = 0; i < recent.size(); ++i)
+    {
+        double delta = recent[i] * DELTA_SCALE;
+        if (delta > 0)
+            ones += decay(delta, sum);
+        else
+            zeros += decay(-delta, sum);
+        sum += fabs(delta);
+    }
+
+    return score(ones, zeros, total * DELTA_SCALE, biasmean);
+}
+
+bool RatingState::load(SQLQuery &q)
+{
+    if (!q.not_null())
+        return false;
+
+    const void *data;
+    size_t n;
+    q >> total >> until;
+    q.view(data, n);
+
+    const signed char *deltas = (const signed char *)data;
+    recent.assign(deltas, deltas + n);
+    return true;
+}
+
+void RatingState::save(SQLQuery &q) const
+{
+    q << total << until;
+    q.bind(recent.empty() ? "" : (const char *)&recent[0], recent.size());
+}
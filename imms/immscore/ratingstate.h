@@ -0,0 +1,65 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#ifndef __RATINGSTATE_H
+#define __RATINGSTATE_H
+
+#include <time.h>
+
+#include <vector>
+
+class SQLQuery;
+
+// What update_rating needs to know about the plays of a song, so that it
+// does not have to walk the whole Journal every time one ends.
+//
+// Every play is weighed by how much play weight came after it, and after
+// DECAY_LIMIT it stops counting at all. So only the newest few plays and
+// the total weight are kept: the rating comes out the same as from the
+// full history, and the state never grows past a few dozen bytes.
+class RatingState
+{
+public:
+    RatingState() : total(0), until(0) {}
+
+    // Fold in a play; plays must come in in time order.
+    void add(int played, int flags, time_t when);
+    time_t get_until() const { return until; }
+
+    int rating(double biasmean) const;
+
+    // Read from or write to the 'total', 'until', 'recent' columns.
+    bool load(SQLQuery &q);
+    void save(SQLQuery &q) const;
+
+    // The pieces of the rating, for anyone that wants to redo it from
+    // scratch: the weight of a play, the decay of a play with 'sum' worth
+    // of newer plays, and the final score.
+    static double delta(int played, int flags);
+    static double decay(double delta, double sum);
+    static int score(double ones, double zeros, double total,
+            double biasmean);
+
+private:
+    // sum of all deltas, and the newest deltas first, unscaled
+    int total;
+    time_t until;
+    std::vector<signed char> recent;
+};
+
+#endif
@@ -0,0 +1,448 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <errno.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "scanner.h"
+#include "song.h"
+#include "songinfo.h"
+#include "fingerprint.h"
+#include "appname.h"
+#include "immsutil.h"
+#include "strmanip.h"
+#include "sqlite++.h"
+
+using std::endl;
+using std::ifstream;
+
+// Files recorded per transaction.
+#define SCAN_COMMIT         500
+// Files handed to a worker ahead of time, so that it never has to wait
+// for the parent; also bounded in bytes so that writing to the worker
+// can never block while it is blocked writing back to us.
+#define SCAN_AHEAD          32
+#define SCAN_AHEAD_BYTES    (16 * 1024)
+
+static const char *audio_extensions[] = {
+    "mp3", "ogg", "flac", "wav", "m4a", "aac", "wma", "mpc", "ape", "wv",
+    "opus", 0
+};
+
+bool LibraryScanner::is_audio(const string &path)
+{
+    string extension = string_tolower(path_get_extension(path));
+    for (const char **i = audio_extensions; *i; ++i)
+        if (extension == *i)
+            return true;
+    return false;
+}
+
+void LibraryScanner::collect(const string &path, vector<string> &files)
+{
+    struct stat statbuf;
+    if (stat(path.c_str(), &statbuf))
+    {
+        LOG(ERROR) << "Could not open " << path << endl;
+        return;
+    }
+
+    if (S_ISDIR(statbuf.st_mode))
+    {
+        vector<string> entries;
+        listdir(path, entries);
+        std::sort(entries.begin(), entries.end());
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            if (entries[i][0] == '.')
+                continue;
+            string entry = path + "/" + entries[i];
+            if (stat(entry.c_str(), &statbuf))
+                continue;
+            if (S_ISDIR(statbuf.st_mode))
+                collect(entry, files);
+            else if (is_audio(entry))
+                files.push_back(path_normalize(entry));
+        }
+        return;
+    }
+
+    ifstream list(path.c_str());
+    string line;
+    while (getline(list, line))
+        if (line != "")
+            files.push_back(path_normalize(line));
+}
+
+// Tags go back to the parent tab separated, one file per line.
+static string field(string s)
+{
+    for (size_t i = 0; i < s.length(); ++i)
+        if (s[i] == '\t' || s[i] == '\n')
+            s[i] = ' ';
+    return s;
+}
+
+LibraryScanner::LibraryScanner(int jobs)
+    : jobs(jobs), started(false), legacy(false), next(0), inflight(0),
+      identified(0), unchanged(0), failed(0)
+{
+    if (this->jobs < 1)
+        this->jobs = std::max((int)sysconf(_SC_NPROCESSORS_ONLN), 1);
+}
+
+LibraryScanner::~LibraryScanner()
+{
+    // anything not committed yet just gets scanned again next time
+    stop();
+}
+
+void LibraryScanner::add(const string &path)
+{
+    if (path.find('\n') != string::npos)
+    {
+        ++failed;
+        return;
+    }
+    files.push_back(path);
+}
+
+bool LibraryScanner::start()
+{
+    started = true;
+
+    try {
+        Q q("SELECT path, modtime FROM Identify;");
+        while (q.next())
+        {
+            string path;
+            time_t modtime;
+            q >> path >> modtime;
+            known[path] = modtime;
+        }
+    }
+    WARNIFFAILED();
+
+    legacy = Song::has_legacy_checksums();
+
+    workers.resize(std::min(jobs, (int)files.size()));
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        Worker &worker = workers[i];
+        worker.pid = start_worker(worker.jobs, worker.results);
+        if (worker.pid >= 0)
+            continue;
+        LOG(ERROR) << "Could not start scanner: " << strerror(errno) << endl;
+        workers.resize(i);
+        break;
+    }
+
+    return !workers.empty();
+}
+
+// Runs in the worker: reads "<known modtime>\t<path>" lines and writes
+// back "<status>\t<modtime>\t<checksum>\t<legacy>\t<artist>\t<album>\t
+// <title>", where status is N for a new or modified file, U for an
+// unchanged one and F if it could not be read. The legacy (MD5) checksum
+// is only worked out if the database still has any.
+void LibraryScanner::work(int jobs, int results)
+{
+    string line;
+    while (read_line(jobs, line))
+    {
+        size_t tab = line.find('\t');
+        time_t known = atol(line.substr(0, tab).c_str());
+        string path = line.substr(tab + 1);
+
+        std::ostringstream reply;
+        struct stat statbuf;
+        if (stat(path.c_str(), &statbuf) || access(path.c_str(), R_OK))
+            reply << "F\t0";
+        else if (statbuf.st_mtime == known)
+            reply << "U\t" << statbuf.st_mtime;
+        else
+        {
+            Fingerprint fingerprint(path);
+            SongInfo info(path);
+            reply << "N\t" << statbuf.st_mtime
+                << "\t" << fingerprint.get()
+                << "\t" << (legacy ? fingerprint.get(FINGERPRINT_MD5) : "")
+                << "\t" << field(info.get_artist())
+                << "\t" << field(info.get_album())
+                << "\t" << field(info.get_title());
+        }
+        reply << "\n";
+
+        string s = reply.str();
+        if (!write_all(results, s.c_str(), s.length()))
+            break;
+    }
+}
+
+// Top up the worker's queue.
+bool LibraryScanner::dispatch(Worker &worker)
+{
+    string batch;
+    while (next < files.size() && worker.paths.size() < SCAN_AHEAD
+            && worker.queued < SCAN_AHEAD_BYTES)
+    {
+        const string &path = files[next++];
+
+        std::map<string, time_t>::iterator i = known.find(path);
+        string line = itos(i == known.end() ? -1 : i->second)
+            + "\t" + path + "\n";
+
+        batch += line;
+        worker.paths.push_back(path);
+        worker.sizes.push_back(line.length());
+        worker.queued += line.length();
+        ++inflight;
+    }
+
+    return batch.empty()
+        || write_all(worker.jobs, batch.c_str(), batch.length());
+}
+
+// Read whatever the worker has to say, without blocking.
+bool LibraryScanner::receive(Worker &worker)
+{
+    char buf[4096];
+    ssize_t n = read(worker.results, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR)
+        return true;
+    if (n <= 0)
+        return false;
+    worker.buffer.append(buf, n);
+
+    size_t start = 0, end;
+    while ((end = worker.buffer.find('\n', start)) != string::npos)
+    {
+        std::istringstream line(worker.buffer.substr(start, end - start));
+        start = end + 1;
+
+        if (worker.paths.empty())
+            return false;
+
+        // status, modtime, checksum, legacy, artist, album, title
+        vector<string> fields;
+        string f;
+        while (getline(line, f, '\t'))
+            fields.push_back(f);
+        fields.resize(7);
+
+        Result result;
+        result.path = worker.paths.front();
+        result.status = fields[0] == "" ? 'F' : fields[0][0];
+        result.modtime = atol(fields[1].c_str());
+        result.checksum = fields[2];
+        result.legacy = fields[3];
+        result.artist = fields[4];
+        result.album = fields[5];
+        result.title = fields[6];
+
+        worker.queued -= worker.sizes.front();
+        worker.paths.pop_front();
+        worker.sizes.pop_front();
+        --inflight;
+
+        pending.push_back(result);
+    }
+    worker.buffer.erase(0, start);
+
+    return true;
+}
+
+// The worker died - whatever it was working on is not retried, since
+// it would most likely take the next one down too.
+void LibraryScanner::lost(Worker &worker)
+{
+    if (!worker.paths.empty())
+        LOG(ERROR) << "Scanner died processing " << worker.paths.front()
+            << endl;
+
+    for (size_t i = 0; i < worker.paths.size(); ++i)
+    {
+        Result result;
+        result.path = worker.paths[i];
+        result.status = 'F';
+        pending.push_back(result);
+    }
+    inflight -= worker.paths.size();
+    worker.paths.clear();
+    worker.sizes.clear();
+    worker.queued = 0;
+
+    close(worker.jobs);
+    close(worker.results);
+    worker.jobs = worker.results = -1;
+    waitpid(worker.pid, 0, 0);
+    worker.pid = -1;
+}
+
+void LibraryScanner::record(const Result &result)
+{
+    int uid = -1;
+    if (result.status != 'F')
+    {
+        Song song = Song::from_scan(result.path, result.modtime,
+                result.checksum, result.legacy,
+                result.artist, result.album, result.title);
+        if (song.isok())
+            uid = song.get_uid();
+    }
+
+    if (uid == -1)
+        ++failed;
+    else if (result.status == 'U')
+        ++unchanged;
+    else
+        ++identified;
+
+    if (uid != -1)
+    {
+        static SQLQueryHandle update_lastseen(
+                "UPDATE Library SET lastseen = ? WHERE uid = ?;");
+        Q(update_lastseen) << time(0) << uid << execute;
+    }
+
+    scanned(result.path, uid);
+}
+
+void LibraryScanner::commit()
+{
+    if (pending.empty())
+        return;
+
+    try {
+        AutoTransaction a(AppName != IMMSD_APP);
+        for (size_t i = 0; i < pending.size(); ++i)
+            record(pending[i]);
+        a.commit();
+    }
+    WARNIFFAILED();
+
+    pending.clear();
+}
+
+bool LibraryScanner::pump(int msecs)
+{
+    if (!started && !start())
+    {
+        // nobody to do the work - give up on all of it
+        for (; next < files.size(); ++next)
+        {
+            Result result;
+            result.path = files[next];
+            result.status = 'F';
+            pending.push_back(result);
+        }
+        commit();
+        return false;
+    }
+
+    // immsd would rather not die if a worker does
+    void (*sigpipe)(int) = signal(SIGPIPE, SIG_IGN);
+
+    struct timeval start, now;
+    gettimeofday(&start, 0);
+
+    while (true)
+    {
+        vector<struct pollfd> busy;
+        vector<Worker *> polled;
+        for (size_t i = 0; i < workers.size(); ++i)
+        {
+            Worker &worker = workers[i];
+            if (worker.pid < 0)
+                continue;
+            if (!dispatch(worker))
+                lost(worker);
+            if (worker.paths.empty())
+                continue;
+            struct pollfd p = { worker.results, POLLIN, 0 };
+            busy.push_back(p);
+            polled.push_back(&worker);
+        }
+        if (busy.empty())
+            break;
+
+        gettimeofday(&now, 0);
+        int left = msecs - usec_diff(start, now) / 1000;
+        if (left <= 0)
+            break;
+
+        int r = poll(&busy[0], busy.size(), left);
+        if (r < 0 && errno != EINTR)
+        {
+            LOG(ERROR) << "poll failed: " << strerror(errno) << endl;
+            break;
+        }
+
+        for (int i = 0; r > 0 && i < (int)busy.size(); ++i)
+            if (busy[i].revents && !receive(*polled[i]))
+                lost(*polled[i]);
+
+        if (pending.size() >= SCAN_COMMIT)
+            commit();
+    }
+
+    commit();
+
+    signal(SIGPIPE, sigpipe);
+
+    // files nobody is left to scan
+    bool alive = false;
+    for (size_t i = 0; i < workers.size(); ++i)
+        alive = alive || workers[i].pid >= 0;
+    if (!alive && next < files.size())
+    {
+        next = files.size();
+        LOG(ERROR) << "All scanners died" << endl;
+    }
+
+    if (next < files.size() || inflight)
+        return true;
+
+    stop();
+    return false;
+}
+
+void LibraryScanner::stop()
+{
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        if (workers[i].pid < 0)
+            continue;
+        close(workers[i].jobs);
+        close(workers[i].results);
+        waitpid(workers[i].pid, 0, 0);
+    }
+    workers.clear();
+}
@@ -0,0 +1,119 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#ifndef __SCANNER_H
+#define __SCANNER_H
+
+#include <time.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+
+#include "immsutil.h"
+
+using std::string;
+using std::vector;
+
+// Identifies a lot of files at once.
+//
+// Stat, checksum and tag reading are done by a pool of forked worker
+// processes, each given a few files at a time over a pipe. The process
+// that owns the scanner is the only one talking to the database: it
+// records the results in large transactions, SCAN_COMMIT files at a time.
+// Files that have not been modified since they were last identified only
+// cost the workers a stat.
+//
+// Nothing blocks for long, so immsd can run one from its event loop by
+// calling pump() with a short timeout; immstool just keeps calling it
+// until it returns false.
+class LibraryScanner : public WorkerPool
+{
+public:
+    // jobs < 1 means one worker per processor
+    LibraryScanner(int jobs = 0);
+    virtual ~LibraryScanner();
+
+    void add(const string &path);
+
+    // Hand out work and record results for up to msecs milliseconds.
+    // Returns false once every file that was added has been dealt with.
+    bool pump(int msecs);
+
+    int get_remaining() const
+        { return (int)(files.size() - next) + inflight; }
+    int get_identified() const { return identified; }
+    int get_unchanged() const { return unchanged; }
+    int get_failed() const { return failed; }
+
+    // Gather audio files from a directory (recursively) or a file list.
+    static void collect(const string &path, vector<string> &files);
+    static bool is_audio(const string &path);
+
+protected:
+    // Called inside the transaction for each file recorded: uid is -1
+    // if it could not be identified.
+    virtual void scanned(const string &path, int uid) {}
+
+private:
+    struct Worker
+    {
+        Worker() : pid(-1), jobs(-1), results(-1), queued(0) {}
+        pid_t pid;
+        int jobs, results;
+        // sent to the worker and not back yet, oldest first
+        std::deque<string> paths;
+        std::deque<size_t> sizes;
+        size_t queued;
+        string buffer;
+    };
+
+    struct Result
+    {
+        string path;
+        char status;
+        time_t modtime;
+        string checksum, legacy, artist, album, title;
+    };
+
+    bool start();
+    void work(int jobs, int results);
+    bool dispatch(Worker &worker);
+    bool receive(Worker &worker);
+    void lost(Worker &worker);
+    void record(const Result &result);
+    void commit();
+    void stop();
+
+    int jobs;
+    bool started, legacy;
+
+    vector<string> files;
+    size_t next;
+    int inflight;
+
+    std::map<string, time_t> known;
+    vector<Worker> workers;
+    vector<Result> pending;
+
+    int identified, unchanged, failed;
+};
+
+#endif
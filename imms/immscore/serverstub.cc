@@ -37,9 +37,12 @@ void IMMSServer::request_playlist_item(int index)
     write_command(osstr.str());
 }
 
+// Clients that know about PlaylistBatch send the paths in bulk, and
+// from then on only what changes; older ones ignore the arguments and
+// send a Playlist line per item.
 void IMMSServer::request_entire_playlist()
 {
-    write_command("GetEntirePlaylist");
+    write_command("GetEntirePlaylist batch delta");
 }
 
 void IMMSServer::reset_selection()
@@ -0,0 +1,187 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <iostream>
+#include <algorithm>
+
+#include "snapshot.h"
+#include "sqlite++.h"
+
+using std::cerr;
+using std::endl;
+
+LibrarySnapshot *LibrarySnapshot::instance;
+
+LibrarySnapshot *LibrarySnapshot::self()
+{
+    if (!instance)
+        instance = new LibrarySnapshot();
+    return instance;
+}
+
+template <typename T>
+void LibrarySnapshot::set(std::vector<T> &column, int index, T value)
+{
+    if (!enabled || index < 0)
+        return;
+    if (index >= (int)column.size())
+        column.resize(index + 1, T(-1));
+    column[index] = value;
+}
+
+void LibrarySnapshot::clear()
+{
+    enabled = false;
+    sids.clear();
+    ratings.clear();
+    playcounters.clear();
+    acoustic.clear();
+    lasts.clear();
+    aids.clear();
+}
+
+void LibrarySnapshot::load()
+{
+    clear();
+    enabled = true;
+
+    bool loaded = false;
+    try {
+        {
+            Q q("SELECT uid, sid, playcounter FROM Library;");
+            while (q.next())
+            {
+                int uid, sid, playcounter;
+                q >> uid >> sid >> playcounter;
+                set_sid(uid, sid);
+                set_playcounter(uid, playcounter);
+            }
+        }
+
+        {
+            Q q("SELECT uid, rating FROM Ratings;");
+            while (q.next())
+            {
+                int uid, rating;
+                q >> uid >> rating;
+                set_rating(uid, rating);
+            }
+        }
+
+        {
+            Q q("SELECT uid FROM A.Acoustic "
+                    "WHERE mfcc NOTNULL AND bpm NOTNULL;");
+            while (q.next())
+            {
+                int uid;
+                q >> uid;
+                set_acoustic(uid);
+            }
+        }
+
+        {
+            Q q("SELECT sid, last FROM Last;");
+            while (q.next())
+            {
+                int sid;
+                time_t last;
+                q >> sid >> last;
+                set_last(sid, last);
+            }
+        }
+
+        {
+            Q q("SELECT sid, aid FROM Info;");
+            while (q.next())
+            {
+                int sid, aid;
+                q >> sid >> aid;
+                set_aid(sid, aid);
+            }
+        }
+
+        // every sid that has an artist is a real song, so if it is not
+        // in Last it has simply never been played
+        lasts.resize(std::max(lasts.size(), aids.size()), -1);
+        for (size_t i = 0; i < lasts.size(); ++i)
+            if (lasts[i] == -1)
+                lasts[i] = 0;
+
+        loaded = true;
+    }
+    WARNIFFAILED();
+
+    // better to know nothing than to know the wrong thing
+    if (!loaded)
+        clear();
+
+#ifdef DEBUG
+    cerr << "snapshot: " << sids.size() << " songs" << endl;
+#endif
+}
+
+time_t LibrarySnapshot::get_last(int sid) const
+{
+    if (sid < 0 || sid >= (int)lasts.size())
+        return -1;
+    return lasts[sid];
+}
+
+void LibrarySnapshot::set_sid(int uid, int sid)
+{
+    set(sids, uid, sid);
+}
+
+void LibrarySnapshot::set_rating(int uid, int rating)
+{
+    set(ratings, uid, rating);
+}
+
+void LibrarySnapshot::set_playcounter(int uid, int playcounter)
+{
+    set(playcounters, uid, playcounter);
+}
+
+void LibrarySnapshot::increment_playcounter(int uid)
+{
+    int playcounter = get_playcounter(uid);
+    if (playcounter != -1)
+        set_playcounter(uid, playcounter + 1);
+}
+
+void LibrarySnapshot::set_acoustic(int uid, bool present)
+{
+    if (!enabled || uid < 0)
+        return;
+    if (uid >= (int)acoustic.size())
+        acoustic.resize(uid + 1, false);
+    acoustic[uid] = present;
+}
+
+void LibrarySnapshot::set_last(int sid, time_t last)
+{
+    // a new sid - anything between it and the end was never played
+    if (enabled && sid >= (int)lasts.size())
+        lasts.resize(sid, 0);
+    set(lasts, sid, last);
+}
+
+void LibrarySnapshot::set_aid(int sid, int aid)
+{
+    set(aids, sid, aid);
+}
@@ -0,0 +1,91 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include <time.h>
+
+#include <vector>
+
+// In memory copy of the per song data the picker looks at for every
+// candidate, stored column by column: sid, rating, play counter and
+// whether there is acoustic data, indexed by uid; last played time and
+// artist, indexed by sid.
+//
+// Only immsd loads it. Song keeps it current as it writes to Library,
+// Ratings, Last, Info and A.Acoustic, and goes to the database for
+// anything that is not known here. Getters return -1 for unknown values.
+class LibrarySnapshot
+{
+public:
+    LibrarySnapshot() : enabled(false) {}
+
+    static LibrarySnapshot *self();
+
+    // (Re)build from the database; clear() drops it and goes back to
+    // answering nothing.
+    void load();
+    void clear();
+    bool is_enabled() const { return enabled; }
+
+    bool is_known(int uid) const { return get(playcounters, uid) != -1; }
+
+    int get_sid(int uid) const { return get(sids, uid); }
+    int get_rating(int uid) const { return get(ratings, uid); }
+    int get_playcounter(int uid) const { return get(playcounters, uid); }
+    // false also means that the song is not known
+    bool has_acoustic(int uid) const
+        { return uid >= 0 && uid < (int)acoustic.size() && acoustic[uid]; }
+
+    // Last is only ever written by immsd, so a sid missing from it was
+    // never played: that comes back as 0 rather than unknown.
+    time_t get_last(int sid) const;
+    int get_aid(int sid) const { return get(aids, sid); }
+
+    void set_sid(int uid, int sid);
+    void set_rating(int uid, int rating);
+    void set_playcounter(int uid, int playcounter);
+    void increment_playcounter(int uid);
+    void set_acoustic(int uid, bool present = true);
+    void set_last(int sid, time_t last);
+    void set_aid(int sid, int aid);
+
+private:
+    template <typename T>
+    static int get(const std::vector<T> &column, int index)
+    {
+        if (index < 0 || index >= (int)column.size())
+            return -1;
+        return column[index];
+    }
+    template <typename T>
+    void set(std::vector<T> &column, int index, T value);
+
+    bool enabled;
+
+    std::vector<int> sids, ratings, playcounters;
+    std::vector<bool> acoustic;
+
+    std::vector<time_t> lasts;
+    std::vector<int> aids;
+
+    static LibrarySnapshot *instance;
+};
+
+#endif
@@ -19,6 +19,7 @@
 #include <ctype.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -29,18 +30,15 @@
 #include "analyzer/mfcckeeper.h"
 
 #include "appname.h"
-#include "flags.h"
 #include "immsutil.h"
-#include "ltqnorm.h"
-#include "md5digest.h"
+#include "fingerprint.h"
+#include "ratingstate.h"
 #include "song.h"
 #include "songinfo.h"
 #include "sqlite++.h"
 #include "strmanip.h"
-
-#define DELTA_SCALE     0.8
-#define DECAY_LIMIT     60
-#define MIN_TRIALS      10
+#include "writebehind.h"
+#include "snapshot.h"
 
 using std::cerr;
 using std::endl;
@@ -127,12 +125,21 @@ void Song::get_tag_info(string &artist, string &album, string &title) const
 
 bool Song::isanalyzed()
 {
+    // the analyzer runs in its own process, so a clear bit might be stale
+    if (LibrarySnapshot::self()->has_acoustic(uid))
+        return true;
+
     try {
-        Q q("SELECT * FROM A.Acoustic WHERE mfcc NOTNULL "
-               "AND bpm NOTNULL AND uid = ?;");
+        static SQLQueryHandle select_analyzed(
+                "SELECT * FROM A.Acoustic WHERE mfcc NOTNULL "
+                "AND bpm NOTNULL AND uid = ?;");
+        Q q(select_analyzed);
         q << uid;
         if (q.next())
+        {
+            LibrarySnapshot::self()->set_acoustic(uid);
             return true;
+        }
     }
     WARNIFFAILED();
     return false;
@@ -148,6 +155,8 @@ void Song::set_acoustic(const MixtureModel &mm, const float *beats)
         q.bind(&mm.gauss, MFCCKeeper::ResultSize);
         q.bind(beats, sizeof(float) * BEATSSIZE);
         q.execute();
+
+        LibrarySnapshot::self()->set_acoustic(uid);
     }
     WARNIFFAILED();
 }
@@ -157,9 +166,13 @@ bool Song::get_acoustic(MixtureModel *mm, float *beats) const
     if (uid < 0)
         return false;
 
+    // not worth trusting a clear bit: the analyzer runs in its own
+    // process, and the data is needed from the database anyway
     try
     {
-        Q q("SELECT mfcc, bpm FROM A.Acoustic WHERE uid = ?;");
+        static SQLQueryHandle select_acoustic(
+                "SELECT mfcc, bpm FROM A.Acoustic WHERE uid = ?;");
+        Q q(select_acoustic);
         q << uid;
 
         if (q.next())
@@ -168,6 +181,7 @@ bool Song::get_acoustic(MixtureModel *mm, float *beats) const
                 q.load(mm->gauss, MFCCKeeper::ResultSize);  
             if (beats)
                 q.load(beats, sizeof(float) * BEATSSIZE);  
+            LibrarySnapshot::self()->set_acoustic(uid);
             return true;
         }
     }
@@ -176,6 +190,34 @@ bool Song::get_acoustic(MixtureModel *mm, float *beats) const
     return false;
 }
 
+template <typename T>
+static const T *aligned_view(const void *data, T *copy, size_t n)
+{
+    if ((unsigned long)data % sizeof(float) == 0)
+        return (const T *)data;
+    memcpy(copy, data, n);
+    return copy;
+}
+
+bool AcousticView::load(SQLQuery &q)
+{
+    const void *mfcc, *bpm;
+    size_t mfccsize, bpmsize;
+    q.view(mfcc, mfccsize).view(bpm, bpmsize);
+
+    if (mfccsize != MFCCKeeper::ResultSize
+            || bpmsize != BeatManager::ResultSize)
+    {
+        mm = 0;
+        beats = 0;
+        return false;
+    }
+
+    mm = aligned_view(mfcc, &mmcopy, mfccsize);
+    beats = aligned_view(bpm, beatscopy, bpmsize);
+    return true;
+}
+
 void Song::update_tag_info(const string &artist, const string &album,
         const string &title)
 {
@@ -224,7 +266,46 @@ void Song::update_tag_info(const string &artist, const string &album,
     } IGNOREFAILURE();
 }
 
-void Song::identify(time_t modtime)
+Song Song::from_scan(const string &path, time_t modtime,
+        const string &checksum, const string &legacy,
+        const string &artist, const string &album, const string &title)
+{
+    Song song;
+    song.path = path;
+
+    // someone else might have gotten to it first
+    if (song.lookup(modtime))
+        return song;
+
+    if (checksum == "")
+    {
+        song.reset();
+        return song;
+    }
+
+    song.update_identity(modtime, checksum, legacy, artist, album, title);
+    return song;
+}
+
+bool Song::has_legacy_checksums()
+{
+    // new rows are never MD5, so once there are none that is that
+    static bool legacy = true;
+    if (!legacy)
+        return false;
+
+    try {
+        Q q("SELECT 1 FROM Identify WHERE checksum_version = ? LIMIT 1;");
+        q << FINGERPRINT_MD5;
+        legacy = q.next();
+    }
+    WARNIFFAILED();
+
+    return legacy;
+}
+
+// Picks up the uid and sid of a known path; true if it is up to date.
+bool Song::lookup(time_t modtime)
 {
     try {
         Q q("SELECT Library.uid, sid, modtime "
@@ -238,40 +319,49 @@ void Song::identify(time_t modtime)
             q >> uid >> sid >> last_modtime;
 
             if (modtime == last_modtime)
-                return;
+                return true;
         }
     } WARNIFFAILED();
 
-    string checksum = Md5Digest::digest_file(path);
+    return false;
+}
 
-    {
-        AutoTransaction a(AppName != IMMSD_APP);
-        _identify(modtime, checksum);
-        a.commit();
-    }
+void Song::identify(time_t modtime)
+{
+    if (lookup(modtime))
+        return;
+
+    Fingerprint fingerprint(path);
+    string checksum = fingerprint.get();
+    string legacy = has_legacy_checksums() ?
+        fingerprint.get(FINGERPRINT_MD5) : "";
 
     SongInfo info;
     info.link(path);
 
-    string artist = info.get_artist();
-    string album = info.get_album();
-    string title = info.get_title();
+    AutoTransaction a(AppName != IMMSD_APP);
+    update_identity(modtime, checksum, legacy,
+            info.get_artist(), info.get_album(), info.get_title());
+    a.commit();
+}
 
-    {
-        AutoTransaction a(AppName != IMMSD_APP);
-        update_tag_info(artist, album, title);
-        a.commit();
-    }
+void Song::update_identity(time_t modtime, const string &checksum,
+        const string &legacy, const string &artist,
+        const string &album, const string &title)
+{
+    _identify(modtime, checksum, legacy);
+    update_tag_info(artist, album, title);
 }
 
-void Song::_identify(time_t modtime, const string &checksum)
+void Song::_identify(time_t modtime, const string &checksum,
+        const string &legacy)
 {
     // old path but modtime has changed - update checksum
     if (uid != -1)
     {
-        Q q("UPDATE Identify SET modtime = ?, "
-                "checksum = ? WHERE path = ?;");
-        q << modtime << checksum << path;
+        Q q("UPDATE Identify SET modtime = ?, checksum = ?, "
+                "checksum_version = ? WHERE path = ?;");
+        q << modtime << checksum << FINGERPRINT_LATEST << path;
         q.execute();
         return;
     }
@@ -279,39 +369,16 @@ void Song::_identify(time_t modtime, const string &checksum)
     // moved or new file and path needs updating
     reset();
 
-    Q q("SELECT uid, path FROM Identify WHERE checksum = ?;");
-    q << checksum;
-
-    bool duplicate;
-    if ((duplicate = q.next()))
-    {
-        // Check if any of the old paths no longer exist 
-        // (aka file was moved) so that we can reuse their uid
-        do
-        {
-            string oldpath;
-            q >> uid >> oldpath;
-
-            if (access(oldpath.c_str(), F_OK))
-            {
-                q.reset();
-
-                sid = -1;
-
-                Q("UPDATE Identify SET path = ?, "
-                        "modtime = ? WHERE path = ?;")
-                    << path << modtime << oldpath << execute;
+    bool duplicate = false;
+    if (take_over_moved(modtime, checksum, checksum,
+                FINGERPRINT_LATEST, duplicate))
+        return;
+    // files identified before the switch only have their MD5 to go by
+    if (!duplicate && legacy != "" && take_over_moved(modtime, checksum,
+                legacy, FINGERPRINT_MD5, duplicate))
+        return;
 
-                Q("UPDATE Library SET sid = -1 WHERE uid = ?;")
-                    << uid << execute;
-#ifdef DEBUG
-                cerr << "identify: moved: uid = " << uid << endl;
-#endif
-                return;
-            }
-        } while (q.next());
-    }
-    else
+    if (!duplicate)
     {
         // figure out what the next uid should be
         Q q("SELECT max(uid) FROM Library;");
@@ -326,15 +393,64 @@ void Song::_identify(time_t modtime, const string &checksum)
 
     // new file - insert into the database
     Q("INSERT INTO Identify "
-            "('path', 'uid', 'modtime', 'checksum') "
-            "VALUES (?, ?, ?, ?);")
-        << path << uid << modtime << checksum << execute;
+            "('path', 'uid', 'modtime', 'checksum', 'checksum_version') "
+            "VALUES (?, ?, ?, ?, ?);")
+        << path << uid << modtime << checksum << FINGERPRINT_LATEST
+        << execute;
 
     if (!duplicate)
         Q("INSERT INTO Library "
                 "('uid', 'sid', 'playcounter', 'lastseen', 'firstseen') "
                 "VALUES (?, ?, ?, ?, ?);")
             << uid << -1 << 0 << time(0) << time(0) << execute;
+
+    if (!duplicate)
+    {
+        LibrarySnapshot::self()->set_sid(uid, -1);
+        LibrarySnapshot::self()->set_playcounter(uid, 0);
+    }
+}
+
+// Look for files with the same contents, going by the given version of
+// the fingerprint. If any of them no longer exist (aka file was moved)
+// reuse its uid, and bring its checksum up to date. Otherwise uid is
+// left at that of the last one found.
+bool Song::take_over_moved(time_t modtime, const string &checksum,
+        const string &match, int version, bool &duplicate)
+{
+    Q q("SELECT uid, path FROM Identify "
+            "WHERE checksum = ? AND checksum_version = ?;");
+    q << match << version;
+
+    while (q.next())
+    {
+        duplicate = true;
+
+        string oldpath;
+        q >> uid >> oldpath;
+
+        if (!access(oldpath.c_str(), F_OK))
+            continue;
+
+        q.reset();
+
+        sid = -1;
+
+        Q("UPDATE Identify SET path = ?, modtime = ?, checksum = ?, "
+                "checksum_version = ? WHERE path = ?;")
+            << path << modtime << checksum << FINGERPRINT_LATEST << oldpath
+            << execute;
+
+        Q("UPDATE Library SET sid = -1 WHERE uid = ?;")
+            << uid << execute;
+        LibrarySnapshot::self()->set_sid(uid, -1);
+#ifdef DEBUG
+        cerr << "identify: moved: uid = " << uid << endl;
+#endif
+        return true;
+    }
+
+    return false;
 }
 
 void Song::set_last(time_t last)
@@ -342,6 +458,13 @@ void Song::set_last(time_t last)
     if (uid < 0)
         return;
 
+    if (sid >= 0 && WriteBehind::self()->is_enabled())
+    {
+        WriteBehind::self()->set_last(sid, last);
+        LibrarySnapshot::self()->set_last(sid, last);
+        return;
+    }
+
     try {
         AutoTransaction a;
 
@@ -353,6 +476,9 @@ void Song::set_last(time_t last)
         q.execute();
 
         a.commit();
+
+        LibrarySnapshot::self()->set_sid(uid, sid);
+        LibrarySnapshot::self()->set_last(sid, last);
     }
     WARNIFFAILED();
 }
@@ -362,12 +488,20 @@ int Song::get_playcounter()
     if (uid < 0)
         return -1;
 
+    int known = LibrarySnapshot::self()->get_playcounter(uid);
+    if (known != -1)
+        return known;
+
+    int pending = WriteBehind::self()->get_playcounter_delta(uid);
+
     if (playcounter != -1)
-        return playcounter;
+        return playcounter + pending;
 
     try
     {
-        Q q("SELECT playcounter FROM Library WHERE uid = ?;");
+        static SQLQueryHandle select_playcounter(
+                "SELECT playcounter FROM Library WHERE uid = ?;");
+        Q q(select_playcounter);
         q << uid;
 
         if (q.next())
@@ -375,7 +509,7 @@ int Song::get_playcounter()
     }
     WARNIFFAILED();
 
-    return playcounter;
+    return playcounter == -1 ? playcounter : playcounter + pending;
 }
 
 void Song::increment_playcounter()
@@ -383,6 +517,14 @@ void Song::increment_playcounter()
     if (uid < 0)
         return;
 
+    LibrarySnapshot::self()->increment_playcounter(uid);
+
+    if (WriteBehind::self()->is_enabled())
+    {
+        WriteBehind::self()->increment_playcounter(uid);
+        return;
+    }
+
     try
     { 
         Q("UPDATE Library SET playcounter = playcounter + 1 WHERE uid = ?;")
@@ -396,6 +538,14 @@ void Song::set_rating(int rating)
     if (uid < 0)
         return;
 
+    LibrarySnapshot::self()->set_rating(uid, rating);
+
+    if (WriteBehind::self()->is_enabled())
+    {
+        WriteBehind::self()->set_rating(uid, rating);
+        return;
+    }
+
     try
     {
         Q q("INSERT OR REPLACE INTO Ratings "
@@ -406,6 +556,25 @@ void Song::set_rating(int rating)
     WARNIFFAILED();
 }
 
+void Song::set_rating_state(const RatingState &state)
+{
+    if (WriteBehind::self()->is_enabled())
+    {
+        WriteBehind::self()->set_rating_state(uid, state);
+        return;
+    }
+
+    try
+    {
+        Q q("INSERT OR REPLACE INTO RatingState "
+               "('uid', 'total', 'until', 'recent') VALUES (?, ?, ?, ?);");
+        q << uid;
+        state.save(q);
+        q.execute();
+    }
+    WARNIFFAILED();
+}
+
 void Song::set_info(const StringPair &info)
 {
     if (uid < 0)
@@ -433,6 +602,7 @@ void Song::set_info(const StringPair &info)
         }
 
         sid = -1;
+        bool new_sid = false;
         Q q("SELECT sid FROM Info WHERE aid = ? AND title = ?;");
         q << aid << title;
         if (q.next())
@@ -449,6 +619,7 @@ void Song::set_info(const StringPair &info)
         else
         {
             register_new_sid();
+            new_sid = true;
 
             Q q("INSERT INTO Info ('sid', 'aid', 'title') VALUES (?, ?, ?);");
             q << sid << aid << title;
@@ -456,6 +627,11 @@ void Song::set_info(const StringPair &info)
         }
 
         a.commit();
+
+        // only once it is in the database for certain
+        LibrarySnapshot::self()->set_sid(uid, sid);
+        if (new_sid)
+            LibrarySnapshot::self()->set_aid(sid, aid);
     }
     WARNIFFAILED();
 
@@ -473,9 +649,19 @@ time_t Song::get_last()
 
     time_t result = 0;
 
+    if (WriteBehind::self()->get_last(sid, &result))
+        return result;
+
+    result = LibrarySnapshot::self()->get_last(sid);
+    if (result != -1)
+        return result;
+    result = 0;
+
     try
     {
-        Q q("SELECT last FROM Last WHERE sid = ?;");
+        static SQLQueryHandle select_last(
+                "SELECT last FROM Last WHERE sid = ?;");
+        Q q(select_last);
         q << sid;
         if (q.next())
             q >> result;
@@ -540,9 +726,18 @@ int Song::get_rating()
     if (uid < 0)
         return rating;
 
+    if (WriteBehind::self()->get_rating(uid, &rating))
+        return rating;
+
+    rating = LibrarySnapshot::self()->get_rating(uid);
+    if (rating != -1)
+        return rating;
+
     try
     {
-        Q q("SELECT rating FROM Ratings WHERE uid = ?;");
+        static SQLQueryHandle select_rating(
+                "SELECT rating FROM Ratings WHERE uid = ?;");
+        Q q(select_rating);
 
         q << uid;
         if (q.next())
@@ -554,14 +749,7 @@ int Song::get_rating()
         AutoTransaction a;
 
         infer_rating();
-        update_rating();
-
-        q << uid;
-        if (q.next())
-        {
-            q >> rating;
-            q.execute();
-        }
+        rating = update_rating();
 
         a.commit();
     }
@@ -582,8 +770,10 @@ StringPair Song::get_info()
 
     try
     {
-        Q q("SELECT title, artist "
+        static SQLQueryHandle select_info(
+                "SELECT title, artist "
                 "FROM Info NATURAL INNER JOIN Artists WHERE sid = ?;");
+        Q q(select_info);
         q << sid;
 
         if (q.next())
@@ -620,14 +810,6 @@ void Song::register_new_sid()
 #endif
 }
 
-static float decay(float delta, float sum)
-{
-    if (sum > DECAY_LIMIT)
-        return 0;
-
-    return delta * log(DECAY_LIMIT + 1 - sum) / log(DECAY_LIMIT);
-}
-
 int Song::update_rating()
 {
     int rating = -1;
@@ -638,8 +820,10 @@ int Song::update_rating()
     {
         float biasmean = 0.5, biastrials = 0;
         {
-            Q q("SELECT sum(mean * trials) / sum(trials), sum(trials) "
+            static SQLQueryHandle select_bias(
+                    "SELECT sum(mean * trials) / sum(trials), sum(trials) "
                     "FROM Bias WHERE uid = ? GROUP BY uid;");
+            Q q(select_bias);
             q << uid;
 
             if (q.next() && q.not_null())
@@ -649,48 +833,48 @@ int Song::update_rating()
             }
         }
 
-        Q q("SELECT played, flags FROM Journal WHERE uid = ? "
-                "ORDER BY time DESC;");
-        q << uid;
-
-        double total = 0, ones = 0, zeros = 0;
-
-        while (q.next())
+        RatingState state;
+        if (!WriteBehind::self()->get_rating_state(uid, &state))
         {
-            int flags;
-            time_t played;
-            q >> played >> flags;
-            double delta = Flags::deltify(played, flags) * DELTA_SCALE;
-            if (delta > 0)
-                ones += decay(delta, total);
-            else
-                zeros += decay(-delta, total);
-            total += fabs(delta);
+            static SQLQueryHandle select_state(
+                    "SELECT total, until, recent FROM RatingState "
+                    "WHERE uid = ?;");
+            Q q(select_state);
+            q << uid;
+            if (q.next())
+                state.load(q);
         }
 
-        if (!ones && !zeros)
-            zeros = ones = 1;
-
-        if (total < MIN_TRIALS)
+        // only the plays since the state was last saved need looking at -
+        // for a song that has never been rated that is all of them
         {
-            double biasmass = MIN_TRIALS - total;
-            ones += biasmass * biasmean;
-            zeros += biasmass * (1 - biasmean);
+            static SQLQueryHandle select_journal(
+                    "SELECT played, flags, time FROM Journal "
+                    "WHERE uid = ? AND time > ? ORDER BY time ASC;");
+            Q q(select_journal);
+            q << uid << state.get_until();
+
+            while (q.next())
+            {
+                int flags;
+                time_t played, when;
+                q >> played >> flags >> when;
+                state.add(played, flags, when);
+            }
         }
 
-        // Clamp off a minimum values to avoid rounding errors.
-        ones = std::max(ones, 0.0001);
-        zeros = std::max(zeros, 0.0001);
+        // plays that have not been written out yet are the most recent ones
+        const std::vector<RecentPlay> &pending = WriteBehind::self()->get_recent();
+        for (size_t i = 0; i < pending.size(); ++i)
+        {
+            if (pending[i].uid != uid || pending[i].time <= state.get_until())
+                continue;
+            state.add(pending[i].played, pending[i].flags, pending[i].time);
+        }
 
-        // Calculate the upper bound of the Wilson score. For details, see:
-        // http://www.evanmiller.org/how-not-to-sort-by-average-rating.html.
-        double n = ones + zeros;
-        double z = ltqnorm(0.95);
-        double phat = ones / n;
-        double r = phat + z*z/(2*n) + z * sqrt((phat*(1-phat)+z*z/(4*n))/n);
-        r /= (1+z*z/n);
+        set_rating_state(state);
 
-        rating = ROUND(r * 100);
+        rating = state.rating(biasmean);
         set_rating(rating);
     }
     WARNIFFAILED();
@@ -22,18 +22,51 @@
 #include <utility>
 #include <string>
 
+#include "analyzer/mfcckeeper.h"
+#include "analyzer/beatkeeper.h"
+
 using std::pair;
 using std::string;
 
 typedef pair<string, string> StringPair;
 
-class MixtureModel;
+class SQLQuery;
+class RatingState;
+
+// Acoustic data read in place from the current row of a query selecting
+// the mfcc and bpm columns, in that order. Nothing gets copied unless the
+// data is not aligned for floats, and the pointers are only good until
+// the query moves on to the next row.
+class AcousticView
+{
+public:
+    AcousticView() : mm(0), beats(0) {}
+    bool load(SQLQuery &q);
+
+    const MixtureModel *mm;
+    const float *beats;
+private:
+    MixtureModel mmcopy;
+    float beatscopy[BEATSSIZE];
+};
 
 class Song
 {
 public:
     Song(const string &path = "", int _uid = -1, int _sid = -1);
 
+    // Identify path from what LibraryScanner found out about it, inside
+    // the caller's transaction. An empty checksum means that the file was
+    // not expected to have changed; legacy is its MD5 fingerprint, if
+    // asked for (see has_legacy_checksums).
+    static Song from_scan(const string &path, time_t modtime,
+            const string &checksum, const string &legacy,
+            const string &artist, const string &album, const string &title);
+
+    // Whether any files are still only known by their MD5 fingerprint,
+    // so that new ones need to be checked against that as well.
+    static bool has_legacy_checksums();
+
     void set_last(time_t last);
     void set_info(const StringPair &info);
     void set_rating(int rating);
@@ -62,14 +95,22 @@ public:
     void reset() { playcounter = uid = sid = -1; artist = title = ""; }
 protected:
     void register_new_sid();
+    void set_rating_state(const RatingState &state);
     void identify(time_t modtime);
+    bool lookup(time_t modtime);
+    void update_identity(time_t modtime, const string &checksum,
+            const string &legacy, const string &artist,
+            const string &album, const string &title);
     void update_tag_info(const string &artist, const string &album,
             const string &title);
 
     int uid, sid, playcounter;
     string title, artist, path;
 private:
-    void _identify(time_t modtime, const string &checksum);
+    void _identify(time_t modtime, const string &checksum,
+            const string &legacy);
+    bool take_over_moved(time_t modtime, const string &checksum,
+            const string &match, int version, bool &duplicate);
 };
 
 #endif
@@ -44,8 +44,13 @@ static void fuzzy_like(sqlite3_context *context, int argc, sqlite3_value** val)
 
 extern sqlite3 *db();
 
+// Seconds between the checkpoints done by maybe_checkpoint().
+// Writers also checkpoint on their own every 1000 pages or so.
+#define CHECKPOINT_INTERVAL     (5*60)
+
 SqlDb::SqlDb()
-    : correlations(new AttachedDatabase()), acoustic(new AttachedDatabase())
+    : correlations(new AttachedDatabase()), acoustic(new AttachedDatabase()),
+      last_checkpoint(time(0))
 {
     if (!access(get_imms_root("imms.db").c_str(), R_OK)
             && access(get_imms_root("imms2.db").c_str(), F_OK))
@@ -78,6 +83,9 @@ SqlDb::~SqlDb()
 
 void SqlDb::close_database()
 {
+    try {
+        checkpoint();
+    } IGNOREFAILURE();
     correlations.release();
     acoustic.release();
     dbcon.close();
@@ -87,3 +95,30 @@ int SqlDb::changes()
 {
     return db() ? sqlite3_changes(db()) : 0;
 }
+
+bool SqlDb::use_wal()
+{
+#if SQLITE_VERSION_NUMBER >= 3007000
+    return sqlite3_libversion_number() >= 3007000;
+#else
+    return false;
+#endif
+}
+
+void SqlDb::checkpoint()
+{
+#if SQLITE_VERSION_NUMBER >= 3007000
+    if (use_wal())
+        sqlite3_wal_checkpoint(db(), 0);
+#endif
+}
+
+void SqlDb::maybe_checkpoint()
+{
+    time_t now = time(0);
+    if (now - last_checkpoint < CHECKPOINT_INTERVAL)
+        return;
+
+    last_checkpoint = now;
+    checkpoint();
+}
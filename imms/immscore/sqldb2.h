@@ -21,6 +21,8 @@
 
 #include <string>
 #include <memory>
+#include <time.h>
+
 #include "sqlite++.h"
 
 using std::string;
@@ -36,9 +38,17 @@ protected:
     void close_database();
     int changes();
 
+    // Write ahead logging support - needs sqlite 3.7.0 or newer.
+    static bool use_wal();
+    // Fold the write ahead logs back into the databases. Passive - it
+    // only copies what no reader still needs and never waits on locks.
+    void checkpoint();
+    void maybe_checkpoint();
+
 private:
     auto_ptr<AttachedDatabase> correlations, acoustic;
     SQLDatabaseConnection dbcon;
+    time_t last_checkpoint;
 };
 
 #endif
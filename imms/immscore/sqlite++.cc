@@ -197,6 +197,7 @@ void AutoTransaction::commit()
 // SQLQueryManager
 
 SQLQueryManager *SQLQueryManager::instance;
+unsigned SQLQueryManager::generation = 1;
 
 sqlite3_stmt *SQLQueryManager::get(const string &query)
 {
@@ -233,6 +234,7 @@ void SQLQueryManager::kill()
 {
     delete instance;
     instance = 0;
+    ++generation;
 }
 
 SQLQueryManager::~SQLQueryManager()
@@ -241,6 +243,17 @@ SQLQueryManager::~SQLQueryManager()
         sqlite3_finalize(i->second);
 }
 
+// SQLQueryHandle
+
+void SQLQueryHandle::prepare()
+{
+    // the statement is owned by the manager, which finalizes it when
+    // the database is closed - and bumps the generation
+    stmt = SQLQueryManager::self()->get(query);
+    if (stmt)
+        generation = SQLQueryManager::generation;
+}
+
 // SQLQuery
 
 SQLQuery::SQLQuery(const string &query) : curbind(0), stmt(0)
@@ -248,6 +261,11 @@ SQLQuery::SQLQuery(const string &query) : curbind(0), stmt(0)
     stmt = SQLQueryManager::self()->get(query);
 }
 
+SQLQuery::SQLQuery(SQLQueryHandle &handle) : curbind(0), stmt(0)
+{
+    stmt = handle.get();
+}
+
 SQLQuery::~SQLQuery()
 {
     reset();
@@ -391,6 +409,18 @@ SQLQuery &SQLQuery::load(void *data, size_t &n)
     return *this;
 }
 
+SQLQuery &SQLQuery::view(const void *&data, size_t &n)
+{
+    data = 0;
+    n = 0;
+    if (!stmt)
+        return *this;
+
+    data = sqlite3_column_blob(stmt, curbind);
+    n = sqlite3_column_bytes(stmt, curbind++);
+    return *this;
+}
+
 SQLQuery &SQLQuery::operator>>(float &i)
 {
     double j = 0;
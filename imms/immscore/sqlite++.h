@@ -98,8 +98,38 @@ private:
     StmtMap statements;
 
     friend class RuntimeErrorBlocker;
+    friend class SQLQueryHandle;
     bool block_errors;
     static SQLQueryManager *instance;
+    // bumped every time the cached statements are finalized
+    static unsigned generation;
+};
+
+// A fixed query that remembers its prepared statement, so that getting
+// to it is a pointer dereference instead of a lookup by the query text.
+// Meant to be declared static at the call site:
+//
+//     static SQLQueryHandle h("SELECT ... WHERE uid = ?;");
+//     Q q(h);
+//
+// Queries built at run time should keep using the string constructor.
+class SQLQueryHandle
+{
+public:
+    explicit SQLQueryHandle(const char *query)
+        : query(query), stmt(0), generation(0) {}
+    sqlite3_stmt *get()
+    {
+        if (generation != SQLQueryManager::generation)
+            prepare();
+        return stmt;
+    }
+private:
+    void prepare();
+
+    const char *query;
+    sqlite3_stmt *stmt;
+    unsigned generation;
 };
 
 class RuntimeErrorBlocker
@@ -117,6 +147,7 @@ class SQLQuery
 {
 public:
     SQLQuery(const string &query);
+    SQLQuery(SQLQueryHandle &handle);
     ~SQLQuery();
 
     void reset();
@@ -147,6 +178,10 @@ public:
         return load(data, real_size);
     };
 
+    // Like load, but hands out sqlite's own copy of the BLOB instead of
+    // copying it. Only valid until the next call to next() or reset().
+    SQLQuery &view(const void *&data, size_t &n);
+
 private:
     int curbind;
 
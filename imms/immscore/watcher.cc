@@ -0,0 +1,391 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include "watcher.h"
+#include "immsutil.h"
+#include "strmanip.h"
+#include "snapshot.h"
+#include "sqlite++.h"
+
+using std::endl;
+using std::ifstream;
+
+#define WATCH_MASK      (IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_FROM \
+                            | IN_MOVED_TO | IN_ONLYDIR)
+
+// Wait for this many seconds without changes before identifying
+// anything, so that copying in a whole album is one scan.
+#define WATCH_SETTLE    5
+// How often to look at everything when not watching.
+#define WATCH_RESCAN    (30*60)
+#define WATCH_JOBS      2
+// msecs per tick the scanner gets
+#define WATCH_SLICE     100
+
+LibraryWatcher::LibraryWatcher()
+    : fd(-1), last_change(0), next_rescan(0), moves(0)
+{
+}
+
+LibraryWatcher::~LibraryWatcher()
+{
+    if (fd >= 0)
+        close(fd);
+}
+
+bool LibraryWatcher::start(const string &config)
+{
+    ifstream in(config.c_str());
+    string line;
+    while (getline(in, line))
+    {
+        line = path_normalize(line);
+        struct stat statbuf;
+        if (line == "" || stat(line.c_str(), &statbuf)
+                || !S_ISDIR(statbuf.st_mode))
+            continue;
+        roots.push_back(line);
+    }
+
+    if (roots.empty())
+        return false;
+
+    // anything could have changed while we were not looking
+    next_rescan = time(0);
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+    {
+        LOG(ERROR) << "inotify: " << strerror(errno) << endl;
+        fall_back();
+        return true;
+    }
+
+    for (size_t i = 0; i < roots.size() && fd >= 0; ++i)
+        add_tree(roots[i], false);
+
+    LOG(INFO) << get_status() << endl;
+    return true;
+}
+
+// Watch dir and everything under it. With scan, the audio files found
+// get identified too, since they might have been there before the watch.
+void LibraryWatcher::add_tree(const string &dir, bool scan)
+{
+    if (fd < 0)
+        return;
+
+    int wd = inotify_add_watch(fd, dir.c_str(), WATCH_MASK);
+    if (wd < 0)
+    {
+        if (errno == ENOSPC)
+        {
+            LOG(ERROR) << "Too many directories to watch, "
+                "rescanning every " << WATCH_RESCAN / 60 << " minutes instead"
+                << endl;
+            fall_back();
+        }
+        return;
+    }
+
+    // been here already - a symlink loop
+    if (watches.count(wd))
+        return;
+    watches[wd] = dir;
+
+    vector<string> entries;
+    listdir(dir, entries);
+    for (size_t i = 0; i < entries.size() && fd >= 0; ++i)
+    {
+        if (entries[i][0] == '.')
+            continue;
+        string entry = dir + "/" + entries[i];
+        struct stat statbuf;
+        if (stat(entry.c_str(), &statbuf))
+            continue;
+        if (S_ISDIR(statbuf.st_mode))
+            add_tree(entry, scan);
+        else if (scan && LibraryScanner::is_audio(entry))
+        {
+            dirty.insert(entry);
+            last_change = time(0);
+        }
+    }
+}
+
+void LibraryWatcher::fall_back()
+{
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+    watches.clear();
+    next_rescan = time(0);
+}
+
+void LibraryWatcher::read_events()
+{
+    char buf[64 * 1024] __attribute__((aligned(8)));
+
+    while (fd >= 0)
+    {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+
+        // the two halves of a rename come one after the other; if the
+        // second one is missing the file went somewhere we do not watch
+        uint32_t cookie = 0;
+        string from;
+        bool fromdir = false;
+
+        for (char *p = buf; p < buf + n; )
+        {
+            struct inotify_event *event = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                LOG(ERROR) << "Missed some changes, rescanning" << endl;
+                next_rescan = time(0);
+                continue;
+            }
+            if (event->mask & IN_IGNORED)
+            {
+                watches.erase(event->wd);
+                continue;
+            }
+
+            std::map<int, string>::iterator dir = watches.find(event->wd);
+            if (dir == watches.end() || !event->len || event->name[0] == '.')
+                continue;
+
+            string path = dir->second + "/" + event->name;
+            bool isdir = event->mask & IN_ISDIR;
+
+            if (from != "" && !(event->mask & IN_MOVED_TO
+                        && event->cookie == cookie))
+            {
+                if (fromdir)
+                    forget_tree(from);
+                from = "";
+            }
+
+            if (event->mask & IN_MOVED_FROM)
+            {
+                cookie = event->cookie;
+                from = path;
+                fromdir = isdir;
+                continue;
+            }
+
+            if (from != "")
+                moved(from, path, isdir);
+            else if (isdir && event->mask & (IN_CREATE | IN_MOVED_TO))
+                add_tree(path, true);
+            else if (!isdir && event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)
+                    && LibraryScanner::is_audio(path))
+            {
+                dirty.insert(path);
+                last_change = time(0);
+            }
+
+            from = "";
+        }
+
+        if (fromdir && from != "")
+            forget_tree(from);
+    }
+}
+
+// Something was renamed within the watched directories. Files that are
+// not known yet still need to be identified.
+void LibraryWatcher::moved(const string &from, const string &to, bool isdir)
+{
+    // everything under from/ sorts between these two, as '0' comes
+    // right after '/' - and that works with the index on path
+    string first = from + "/", last = from + "0";
+    vector<int> uids;
+
+    try {
+        if (isdir)
+        {
+            Q q("SELECT uid FROM Identify WHERE path >= ? AND path < ?;");
+            q << first << last;
+            while (q.next())
+            {
+                int uid;
+                q >> uid;
+                uids.push_back(uid);
+            }
+        }
+        else
+        {
+            Q q("SELECT uid FROM Identify WHERE path = ?;");
+            q << from;
+            if (q.next())
+            {
+                int uid;
+                q >> uid;
+                uids.push_back(uid);
+            }
+        }
+
+        AutoTransaction a;
+
+        if (isdir)
+            Q("UPDATE OR REPLACE Identify "
+                    "SET path = ? || substr(path, length(?) + 1) "
+                    "WHERE path >= ? AND path < ?;")
+                << to << from << first << last << execute;
+        else
+            Q("UPDATE OR REPLACE Identify SET path = ? WHERE path = ?;")
+                << to << from << execute;
+
+        // the path might say something different about the song now
+        for (size_t i = 0; i < uids.size(); ++i)
+            Q("UPDATE Library SET sid = -1 WHERE uid = ?;")
+                << uids[i] << execute;
+
+        a.commit();
+
+        for (size_t i = 0; i < uids.size(); ++i)
+            LibrarySnapshot::self()->set_sid(uids[i], -1);
+    }
+    WARNIFFAILED();
+
+    ++moves;
+
+    if (isdir)
+        rename_watches(from, to);
+    else if (uids.empty() && LibraryScanner::is_audio(to))
+    {
+        dirty.insert(to);
+        last_change = time(0);
+    }
+    dirty.erase(from);
+}
+
+// Keep the paths of the watches, and of the files waiting to be
+// identified, in line with a renamed directory.
+void LibraryWatcher::rename_watches(const string &from, const string &to)
+{
+    string prefix = from + "/";
+
+    for (std::map<int, string>::iterator i = watches.begin();
+            i != watches.end(); ++i)
+    {
+        if (i->second == from)
+            i->second = to;
+        else if (!i->second.compare(0, prefix.length(), prefix))
+            i->second = to + i->second.substr(from.length());
+    }
+
+    std::set<string> renamed;
+    for (std::set<string>::iterator i = dirty.begin(); i != dirty.end(); ++i)
+        if (!i->compare(0, prefix.length(), prefix))
+            renamed.insert(to + i->substr(from.length()));
+        else
+            renamed.insert(*i);
+    dirty.swap(renamed);
+}
+
+// A directory was moved out of sight, but inotify keeps watching it.
+void LibraryWatcher::forget_tree(const string &dir)
+{
+    string prefix = dir + "/";
+
+    for (std::map<int, string>::iterator i = watches.begin();
+            i != watches.end(); )
+    {
+        if (i->second == dir || !i->second.compare(0, prefix.length(), prefix))
+        {
+            inotify_rm_watch(fd, i->first);
+            watches.erase(i++);
+        }
+        else
+            ++i;
+    }
+}
+
+void LibraryWatcher::rescan()
+{
+    vector<string> files;
+    for (size_t i = 0; i < roots.size(); ++i)
+        LibraryScanner::collect(roots[i], files);
+
+    scanner.reset(new LibraryScanner(WATCH_JOBS));
+    for (size_t i = 0; i < files.size(); ++i)
+        scanner->add(files[i]);
+
+    // whatever was waiting is in there as well
+    dirty.clear();
+    next_rescan = fd < 0 ? time(0) + WATCH_RESCAN : 0;
+}
+
+void LibraryWatcher::do_events()
+{
+    if (fd >= 0)
+        read_events();
+
+    if (scanner.get())
+    {
+        if (!scanner->pump(WATCH_SLICE))
+            scanner.reset();
+        return;
+    }
+
+    time_t now = time(0);
+    if (next_rescan && now >= next_rescan)
+    {
+        rescan();
+        return;
+    }
+
+    if (dirty.empty() || now - last_change < WATCH_SETTLE)
+        return;
+
+    scanner.reset(new LibraryScanner(WATCH_JOBS));
+    for (std::set<string>::iterator i = dirty.begin(); i != dirty.end(); ++i)
+        scanner->add(*i);
+    dirty.clear();
+}
+
+string LibraryWatcher::get_status() const
+{
+    std::ostringstream status;
+    if (fd >= 0)
+        status << "watching " << watches.size() << " directories";
+    else
+        status << "rescanning every " << WATCH_RESCAN / 60 << " minutes";
+    status << ", " << moves << " moves, " << dirty.size() << " changed"
+        << (scanner.get() ? ", scanning" : "");
+    return status.str();
+}
@@ -0,0 +1,82 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#ifndef __WATCHER_H
+#define __WATCHER_H
+
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <memory>
+
+#include "scanner.h"
+
+using std::string;
+using std::vector;
+
+// Keeps Identify up to date with the music directories listed, one per
+// line, in the "watch" file in IMMSROOT.
+//
+// Files that appear or change are identified by a LibraryScanner off the
+// selection path, once things have settled for a bit. Moves within the
+// watched directories just rename the paths in Identify. Deleted files
+// keep their rows, as before: their history comes back if they do, and
+// "immstool missing" still lists them.
+//
+// There is one inotify watch per directory. If that runs into the limit
+// or events get lost, the watcher falls back to rescanning everything
+// every WATCH_RESCAN seconds - only modified files cost more than a stat.
+class LibraryWatcher
+{
+public:
+    LibraryWatcher();
+    ~LibraryWatcher();
+
+    // False if there is nothing to watch.
+    bool start(const string &config);
+
+    // Call this periodically.
+    void do_events();
+
+    string get_status() const;
+
+private:
+    void add_tree(const string &dir, bool scan);
+    void read_events();
+    void moved(const string &from, const string &to, bool isdir);
+    void rename_watches(const string &from, const string &to);
+    void forget_tree(const string &dir);
+    void fall_back();
+    void rescan();
+
+    vector<string> roots;
+
+    int fd;
+    std::map<int, string> watches;
+
+    std::set<string> dirty;
+    time_t last_change, next_rescan;
+    std::auto_ptr<LibraryScanner> scanner;
+
+    int moves;
+};
+
+#endif
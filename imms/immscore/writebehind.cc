@@ -0,0 +1,210 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <iostream>
+
+#include "writebehind.h"
+#include "sqlite++.h"
+
+using std::cerr;
+using std::endl;
+
+// Flush after this many plays, or when the oldest pending change
+// is this many seconds old - whichever comes first.
+#define MAX_PENDING_PLAYS       16
+#define MAX_PENDING_TIME        (2*60)
+
+WriteBehind *WriteBehind::instance;
+
+WriteBehind *WriteBehind::self()
+{
+    if (!instance)
+        instance = new WriteBehind();
+    return instance;
+}
+
+void WriteBehind::enable(bool on)
+{
+    if (!on)
+        flush();
+    enabled = on;
+}
+
+void WriteBehind::touch()
+{
+    if (!oldest)
+        oldest = time(0);
+}
+
+bool WriteBehind::empty() const
+{
+    return recent.empty() && lasts.empty()
+        && ratings.empty() && playcounters.empty() && states.empty();
+}
+
+void WriteBehind::add_recent(int uid, int played, int flags, time_t when)
+{
+    touch();
+    recent.push_back(RecentPlay(uid, played, flags, when));
+}
+
+void WriteBehind::set_last(int sid, time_t last)
+{
+    touch();
+    lasts[sid] = last;
+}
+
+void WriteBehind::set_rating(int uid, int rating)
+{
+    touch();
+    ratings[uid] = rating;
+}
+
+void WriteBehind::set_rating_state(int uid, const RatingState &state)
+{
+    touch();
+    states[uid] = state;
+}
+
+void WriteBehind::increment_playcounter(int uid)
+{
+    touch();
+    ++playcounters[uid];
+}
+
+bool WriteBehind::get_last(int sid, time_t *last) const
+{
+    TimeMap::const_iterator i = lasts.find(sid);
+    if (i == lasts.end())
+        return false;
+    *last = i->second;
+    return true;
+}
+
+bool WriteBehind::get_rating(int uid, int *rating) const
+{
+    IntMap::const_iterator i = ratings.find(uid);
+    if (i == ratings.end())
+        return false;
+    *rating = i->second;
+    return true;
+}
+
+bool WriteBehind::get_rating_state(int uid, RatingState *state) const
+{
+    StateMap::const_iterator i = states.find(uid);
+    if (i == states.end())
+        return false;
+    *state = i->second;
+    return true;
+}
+
+int WriteBehind::get_playcounter_delta(int uid) const
+{
+    IntMap::const_iterator i = playcounters.find(uid);
+    return i == playcounters.end() ? 0 : i->second;
+}
+
+void WriteBehind::maybe_flush()
+{
+    if (empty())
+        return;
+
+    if (recent.size() < MAX_PENDING_PLAYS
+            && time(0) - oldest < MAX_PENDING_TIME)
+        return;
+
+    flush();
+}
+
+void WriteBehind::flush()
+{
+    if (empty())
+        return;
+
+#ifdef DEBUG
+    cerr << "flushing " << recent.size() << " pending plays" << endl;
+#endif
+
+    try {
+        AutoTransaction a;
+
+        {
+            Q q("INSERT INTO Journal VALUES (?, ?, ?, ?);");
+            for (size_t i = 0; i < recent.size(); ++i)
+            {
+                q << recent[i].uid << recent[i].played
+                    << recent[i].flags << recent[i].time;
+                q.execute();
+            }
+        }
+
+        {
+            Q q("INSERT OR REPLACE INTO Last ('sid', 'last') VALUES (?, ?);");
+            for (TimeMap::iterator i = lasts.begin(); i != lasts.end(); ++i)
+            {
+                q << i->first << i->second;
+                q.execute();
+            }
+        }
+
+        {
+            Q q("INSERT OR REPLACE INTO Ratings "
+                    "('uid', 'rating', 'dev') VALUES (?, ?, ?);");
+            for (IntMap::iterator i = ratings.begin(); i != ratings.end(); ++i)
+            {
+                q << i->first << i->second << 0;
+                q.execute();
+            }
+        }
+
+        {
+            Q q("INSERT OR REPLACE INTO RatingState "
+                    "('uid', 'total', 'until', 'recent') VALUES (?, ?, ?, ?);");
+            for (StateMap::iterator i = states.begin(); i != states.end(); ++i)
+            {
+                q << i->first;
+                i->second.save(q);
+                q.execute();
+            }
+        }
+
+        {
+            Q q("UPDATE Library SET playcounter = playcounter + ? "
+                    "WHERE uid = ?;");
+            for (IntMap::iterator i = playcounters.begin();
+                    i != playcounters.end(); ++i)
+            {
+                q << i->second << i->first;
+                q.execute();
+            }
+        }
+
+        a.commit();
+
+        // only forget about the changes once they are safely on disk -
+        // if anything failed they get retried on the next flush
+        recent.clear();
+        lasts.clear();
+        ratings.clear();
+        playcounters.clear();
+        states.clear();
+        oldest = 0;
+    }
+    WARNIFFAILED();
+}
@@ -0,0 +1,90 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#ifndef __WRITEBEHIND_H
+#define __WRITEBEHIND_H
+
+#include <time.h>
+
+#include <map>
+#include <vector>
+
+#include "ratingstate.h"
+
+struct RecentPlay
+{
+    RecentPlay(int uid = -1, int played = 0, int flags = 0, time_t time = 0)
+        : uid(uid), played(played), flags(flags), time(time) {}
+    int uid, played, flags;
+    time_t time;
+};
+
+// Holds the per song bookkeeping done by immsd - Journal entries, Last,
+// Ratings, RatingState and play counters - in memory, and writes it out in a single
+// transaction once enough of it piles up or it gets old enough.
+//
+// Only enabled by the daemon; everyone else writes straight through.
+// The getters let readers overlay pending values on top of the database.
+class WriteBehind
+{
+public:
+    WriteBehind() : enabled(false), oldest(0) {}
+
+    static WriteBehind *self();
+
+    // Disabling flushes whatever is pending.
+    void enable(bool on = true);
+    bool is_enabled() const { return enabled; }
+
+    void add_recent(int uid, int played, int flags, time_t when);
+    void set_last(int sid, time_t last);
+    void set_rating(int uid, int rating);
+    void set_rating_state(int uid, const RatingState &state);
+    void increment_playcounter(int uid);
+
+    bool get_last(int sid, time_t *last) const;
+    bool get_rating(int uid, int *rating) const;
+    bool get_rating_state(int uid, RatingState *state) const;
+    int get_playcounter_delta(int uid) const;
+    const std::vector<RecentPlay> &get_recent() const { return recent; }
+
+    bool empty() const;
+
+    // Flush if the queue is too big or too old. Call periodically.
+    void maybe_flush();
+    void flush();
+
+private:
+    typedef std::map<int, int> IntMap;
+    typedef std::map<int, time_t> TimeMap;
+    typedef std::map<int, RatingState> StateMap;
+
+    void touch();
+
+    bool enabled;
+    time_t oldest;
+
+    std::vector<RecentPlay> recent;
+    TimeMap lasts;
+    IntMap ratings, playcounters;
+    StateMap states;
+
+    static WriteBehind *instance;
+};
+
+#endif
@@ -21,17 +21,25 @@
 #include <signal.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <sys/wait.h>
 
 #include <iostream>
 #include <sstream>
 #include <list>
+#include <algorithm>
 
 #include "immsd.h"
 #include "appname.h"
 #include "strmanip.h"
 #include "immsutil.h"
+#include "analysisqueue.h"
+#include "snapshot.h"
+#include "watcher.h"
 
-#define INTERFACE_VERSION "2.1"
+#define INTERFACE_VERSION "2.2"
+
+// Don't try starting the analyzer worker more often than this (seconds)
+#define ANALYZER_RESPAWN    60
 
 using std::cerr;
 using std::cout;
@@ -43,11 +51,52 @@ const string AppName = IMMSD_APP;
 
 static Imms *imms;
 static list<RemoteProcessor*> remotes;
+static AnalyzerProcessor *analyzer;
+static LibraryWatcher *watcher;
+
+#ifdef ANALYZER_ENABLED
+// Start the analyzer worker in the background; it connects back to us.
+static void spawn_analyzer()
+{
+    static time_t last_spawn = 0;
+    if (last_spawn + ANALYZER_RESPAWN > time(0))
+        return;
+    last_spawn = time(0);
+
+    // fork twice so that init reaps the worker, not us
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        LOG(ERROR) << "fork failed: " << strerror(errno) << endl;
+        return;
+    }
+    if (!pid)
+    {
+        if (!fork())
+        {
+            execlp(ANALYZER_APP, ANALYZER_APP, "--worker", (char *)0);
+            LOG(ERROR) << "could not start " << ANALYZER_APP << ": "
+                << strerror(errno) << endl;
+        }
+        _exit(0);
+    }
+    waitpid(pid, 0, 0);
+}
+#endif
 
 gboolean do_events(void *unused)
 {
     if (imms)
         imms->do_events();
+    // the database is only open while a player is connected
+    if (imms && watcher)
+        watcher->do_events();
+#ifdef ANALYZER_ENABLED
+    if (analyzer)
+        analyzer->feed();
+    else if (AnalysisQueue::self()->depth())
+        spawn_analyzer();
+#endif
     return TRUE;
 }
 
@@ -77,6 +126,16 @@ void SocketConnection::process_line(const string &line)
         processor = new RemoteProcessor(this);
         return;
     }
+    if (command == "Analyzer")
+    {
+        if (analyzer)
+        {
+            write("Busy\n");
+            return;
+        }
+        processor = new AnalyzerProcessor(this);
+        return;
+    }
     LOG(ERROR) << "Unknown command: " << command << endl;
 
 };
@@ -113,11 +172,81 @@ void RemoteProcessor::process_line(const string &line)
             imms->sync(true);
         return;
     }
+    if (command == "AnalyzerStatus")
+    {
+        write_command("AnalyzerStatus " + string(analyzer ? "running" : "idle")
+                + ", " + AnalysisQueue::self()->get_status());
+        return;
+    }
+    if (command == "WatcherStatus")
+    {
+        write_command("WatcherStatus "
+                + (watcher ? watcher->get_status() : string("off")));
+        return;
+    }
+    LOG(ERROR) << "Unknown command: " << command << endl;
+}
+
+AnalyzerProcessor::AnalyzerProcessor(SocketConnection *connection)
+    : connection(connection), job_uid(-1)
+{
+    analyzer = this;
+    feed();
+}
+
+AnalyzerProcessor::~AnalyzerProcessor()
+{
+    analyzer = 0;
+
+    // not put back: if the song is what took the worker down,
+    // it would just do it again
+    if (job != "")
+    {
+        LOG(ERROR) << "analyzer exited while processing " << job << endl;
+        AnalysisQueue::self()->finished(false, 0);
+    }
+}
+
+void AnalyzerProcessor::feed()
+{
+    if (job != "" || !AnalysisQueue::self()->pop(job, job_uid))
+        return;
+    write_command("Analyze " + job);
+}
+
+void AnalyzerProcessor::process_line(const string &line)
+{
+    stringstream sstr;
+    sstr << line;
+
+    string command;
+    sstr >> command;
+
+    if (command == "Analyzed")
+    {
+        int result, msecs;
+        sstr >> result >> msecs;
+
+        AnalysisQueue *queue = AnalysisQueue::self();
+        queue->finished(!result, msecs);
+        if (result)
+            LOG(ERROR) << "could not analyze " << job << endl;
+        else if (job_uid >= 0)
+            // the worker wrote it from its own process, so the snapshot
+            // would not know otherwise
+            LibrarySnapshot::self()->set_acoustic(job_uid);
+        if (!queue->depth())
+            LOG(INFO) << "analyzer: " << queue->get_status() << endl;
+
+        job = "";
+        feed();
+        return;
+    }
     LOG(ERROR) << "Unknown command: " << command << endl;
 }
 
 ImmsProcessor::ImmsProcessor(SocketConnection *connection)
-    : connection(connection)
+    : connection(connection), block_pos(0), diverged(false)
 {
     if (!imms)
         imms = new Imms(this);
@@ -138,8 +267,19 @@ void ImmsProcessor::playlist_updated()
         (*i)->write_command("Refresh");
 }
 
-void ImmsProcessor::check_playlist_item(int pos, const string &path)
+// The path that ends a command, exactly as the player sent it.
+static string read_path(stringstream &sstr)
+{
+    string path;
+    getline(sstr, path);
+    if (path != "" && path[0] == ' ')
+        path.erase(0, 1);
+    return path;
+}
+
+void ImmsProcessor::check_playlist_item(int pos, const string &rawpath)
 {
+    string path = path_normalize(rawpath);
     string oldpath = imms->get_item_from_playlist(pos);
     if (oldpath != "")
     {
@@ -151,7 +291,7 @@ void ImmsProcessor::check_playlist_item(int pos, const string &path)
         }
     }
     else
-        imms->playlist_insert_item(pos, path);
+        imms->playlist_insert_item(pos, rawpath);
 }
 
 void ImmsProcessor::process_line(const string &line)
@@ -162,7 +302,9 @@ void ImmsProcessor::process_line(const string &line)
     string command;
     sstr >> command;
 #if defined(DEBUG) && 1
-    if (command != "Playlist" && command != "PlaylistItem")
+    if (command != "Playlist" && command != "PlaylistItem"
+            && command != "PlaylistBatch" && command != "PlaylistInsert"
+            && command != "PlaylistReplace")
         std::cout << "> " << line << endl;
 #endif
 
@@ -178,11 +320,9 @@ void ImmsProcessor::process_line(const string &line)
     {
         int pos;
         sstr >> pos;
-        string path;
-        getline(sstr, path);
-        path = path_normalize(path);
+        string path = read_path(sstr);
         check_playlist_item(pos, path);
-        imms->start_song(pos, path);
+        imms->start_song(pos, path_normalize(path));
         return;
     }
     if (command == "EndSong")
@@ -196,20 +336,55 @@ void ImmsProcessor::process_line(const string &line)
     {
         int pos;
         sstr >> pos;
-        string path;
-        getline(sstr, path);
-        path = path_normalize(path);
-        check_playlist_item(pos, path);
+        check_playlist_item(pos, read_path(sstr));
         return;
     }
     if (command == "Playlist")
     {
         int pos;
         sstr >> pos;
-        string path;
-        getline(sstr, path);
-        path = path_normalize(path);
-        imms->playlist_insert_item(pos, path);
+        imms->playlist_insert_item(pos, read_path(sstr));
+        return;
+    }
+    if (command == "PlaylistBatch" || command == "PlaylistInsert"
+            || command == "PlaylistReplace")
+    {
+        int bytes = -1;
+        sstr >> block_pos >> bytes;
+        if (bytes < 0)
+        {
+            LOG(ERROR) << "malformed playlist batch: " << line << endl;
+            return;
+        }
+        block_command = command;
+        connection->expect_block(bytes);
+        return;
+    }
+    if (command == "PlaylistRemove")
+    {
+        int pos = -1, count = -1;
+        sstr >> pos >> count;
+        if (!diverged && !imms->playlist_edit(
+                    PlaylistEdit(PlaylistEdit::Remove, pos, count), ""))
+            playlist_diverged();
+        return;
+    }
+    if (command == "PlaylistMove")
+    {
+        int pos = -1, count = -1, to = -1;
+        sstr >> pos >> count >> to;
+        if (!diverged && !imms->playlist_edit(
+                    PlaylistEdit(PlaylistEdit::Move, pos, count, to), ""))
+            playlist_diverged();
+        return;
+    }
+    if (command == "PlaylistCheck")
+    {
+        int length = -1;
+        uint64_t sum = 0;
+        sstr >> length >> sum;
+        if (!diverged && !imms->playlist_check(length, sum))
+            playlist_diverged();
         return;
     }
     if (command == "PlaylistEnd")
@@ -225,7 +400,8 @@ void ImmsProcessor::process_line(const string &line)
         LOG(ERROR) << "got playlist length = " << length << endl;
 #endif
         imms->playlist_changed(length);
-        write_command("GetEntirePlaylist");
+        diverged = false;
+        request_entire_playlist();
         return;
     }
     if (command == "SelectNext")
@@ -242,6 +418,31 @@ void ImmsProcessor::process_line(const string &line)
     LOG(ERROR) << "Unknown command: " << command << endl;
 }
 
+void ImmsProcessor::process_block(const string &data)
+{
+    if (block_command == "PlaylistBatch")
+    {
+        imms->playlist_insert_batch(block_pos, data);
+        return;
+    }
+    if (diverged)
+        return;
+
+    int count = std::count(data.begin(), data.end(), '\0');
+    PlaylistEdit::Type type = block_command == "PlaylistInsert" ?
+        PlaylistEdit::Insert : PlaylistEdit::Replace;
+    if (!imms->playlist_edit(PlaylistEdit(type, block_pos, count), data))
+        playlist_diverged();
+}
+
+// Have the player start over with PlaylistChanged.
+void ImmsProcessor::playlist_diverged()
+{
+    LOG(ERROR) << "playlist out of sync - asking for all of it" << endl;
+    diverged = true;
+    write_command("PlaylistChanged");
+}
+
 GMainLoop *loop = 0;
 
 void quit(int signum)
@@ -286,8 +487,24 @@ int main(int argc, char **argv)
 
     SocketListener<SocketConnection> listener(get_imms_root("socket"));
 
+    // only if there is a list of directories to watch
+    watcher = new LibraryWatcher();
+    if (!watcher->start(get_imms_root("watch")))
+    {
+        delete watcher;
+        watcher = 0;
+    }
+
     LOG(INFO) << "version " << PACKAGE_VERSION << " ready..." << endl;
 
     g_main_loop_run(loop);
+
+    // make sure any pending bookkeeping makes it to disk
+    delete imms;
+    imms = 0;
+
+    delete watcher;
+    watcher = 0;
+
     return 0;
 }
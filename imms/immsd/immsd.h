@@ -32,6 +32,8 @@ public:
     SocketConnection(int fd) : processor(0) { init(fd); }
     ~SocketConnection() { delete processor; }
     virtual void process_line(const string &line);
+    virtual void process_block(const string &data)
+        { if (processor) processor->process_block(data); }
     virtual void connection_lost() { delete this; }
 protected:
     LineProcessor *processor;
@@ -49,6 +51,25 @@ protected:
     SocketConnection *connection;
 };
 
+// Talks to the analyzer worker: hands it one song at a time from the
+// AnalysisQueue and keeps count of how it does.
+class AnalyzerProcessor : public LineProcessor
+{
+public:
+    AnalyzerProcessor(SocketConnection *connection);
+    ~AnalyzerProcessor();
+    void write_command(const string &command)
+        { connection->write(command + "\n"); }
+    void process_line(const string &line);
+
+    // Give the worker the next song, unless it is still busy.
+    void feed();
+protected:
+    SocketConnection *connection;
+    string job;
+    int job_uid;
+};
+
 class ImmsProcessor : public IMMSServer, public LineProcessor
 {
 public:
@@ -56,12 +77,21 @@ public:
     ~ImmsProcessor();
     void write_command(const string &command)
         { connection->write(command + "\n"); }
-    void check_playlist_item(int pos, const string &path);
+    // path is as the player sent it
+    void check_playlist_item(int pos, const string &rawpath);
     void process_line(const string &line);
+    void process_block(const string &data);
 
     void playlist_updated();
 protected:
+    void playlist_diverged();
+
     SocketConnection *connection;
+    // the command that the block being received goes with
+    string block_command;
+    int block_pos;
+    // ignore edits until the playlist is sent again
+    bool diverged;
 };
 
 #endif
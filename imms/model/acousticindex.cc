@@ -0,0 +1,499 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+#include "acousticindex.h"
+#include "song.h"
+#include "immsutil.h"
+#include "sqlite++.h"
+
+using std::vector;
+using std::string;
+using std::ofstream;
+using std::endl;
+
+#define INDEX_MAGIC     "IMMSANN"
+#define INDEX_VERSION   1
+
+// Rounds of subspace iteration for finding the principal components
+#define PCA_ROUNDS      100
+
+// The timbre and the beat graph count the same, however many
+// dimensions each of them has.
+#define TIMBRE_DIMS     (2 * Gaussian::NumDimensions)
+
+void acoustic_embedding(const PackedMixtureModel &mm, const float *beats,
+        float embedding[EMBEDDING_DIMS])
+{
+    float *mean = embedding, *spread = embedding + Gaussian::NumDimensions;
+    for (int k = 0; k < Gaussian::NumDimensions; ++k)
+    {
+        double m = 0, m2 = 0;
+        for (int i = 0; i < NUMGAUSS; ++i)
+        {
+            m += mm.weights[i] * mm.means[i][k];
+            m2 += mm.weights[i]
+                * (mm.vars[i][k] + mm.means[i][k] * mm.means[i][k]);
+        }
+        mean[k] = m;
+        spread[k] = sqrt(std::max(m2 - m * m, 0.0));
+    }
+
+    // euclidean distance between cumulative distributions is a stand in
+    // for the earth mover's distance between the beat graphs
+    float *cdf = embedding + TIMBRE_DIMS;
+    float sum = 0;
+    for (int i = 0; i < BEATSSIZE; ++i)
+        sum += beats[i];
+    float scale = sum > 0 ? 100.0 / sum : 0, total = 0;
+    for (int i = 0; i < BEATSBINS; ++i)
+    {
+        for (int j = i * BEATSCOMB; j < std::min((i + 1) * BEATSCOMB,
+                    (int)BEATSSIZE); ++j)
+            total += beats[j] * scale;
+        cdf[i] = total;
+    }
+}
+
+AcousticIndex::AcousticIndex()
+    : map(0), length(0), header(0), dims(0), offsets(0), scales(0),
+      axes(0), uids(0), points(0), projected(0), nodes(0)
+{
+}
+
+AcousticIndex::~AcousticIndex()
+{
+    close();
+}
+
+void AcousticIndex::close()
+{
+    if (map)
+        munmap(map, length);
+    map = 0;
+    length = 0;
+    header = 0;
+    dims = 0;
+    offsets = scales = axes = points = projected = 0;
+    uids = 0;
+    nodes = 0;
+}
+
+int AcousticIndex::size() const
+{
+    return header ? header->count : 0;
+}
+
+bool AcousticIndex::load(const string &filename)
+{
+    close();
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (!fstat(fd, &st) && st.st_size >= (off_t)sizeof(Header))
+    {
+        length = st.st_size;
+        map = mmap(0, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+            map = 0;
+    }
+    ::close(fd);
+
+    if (!map)
+        return false;
+
+    const Header *h = (const Header *)map;
+    size_t expected = sizeof(Header)
+        + (2 + INDEX_DIMS) * EMBEDDING_DIMS * sizeof(float)
+        + h->count * (sizeof(int) + (EMBEDDING_DIMS + INDEX_DIMS)
+                * sizeof(float) + sizeof(Node));
+    if (memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic))
+            || h->version != INDEX_VERSION || h->dims != EMBEDDING_DIMS
+            || h->components != INDEX_DIMS || h->count < 0
+            || length != expected)
+    {
+        LOG(ERROR) << "warning: ignoring stale or damaged " << filename
+            << endl;
+        close();
+        return false;
+    }
+
+    header = h;
+    dims = h->dims;
+    offsets = (const float *)(h + 1);
+    scales = offsets + dims;
+    axes = scales + dims;
+    uids = (const int *)(axes + INDEX_DIMS * dims);
+    points = (const float *)(uids + h->count);
+    projected = points + h->count * dims;
+    nodes = (const Node *)(projected + h->count * INDEX_DIMS);
+    return true;
+}
+
+int AcousticIndex::build(const string &filename)
+{
+    vector<int> uids;
+    vector<float> raw;
+
+    try {
+        Q q("SELECT uid, mfcc, bpm FROM A.Acoustic "
+                "WHERE mfcc NOTNULL AND bpm NOTNULL ORDER BY uid;");
+        AcousticView view;
+        float embedding[EMBEDDING_DIMS];
+
+        while (q.next())
+        {
+            int uid;
+            q >> uid;
+            if (!view.load(q))
+                continue;
+
+            acoustic_embedding(PackedMixtureModel(*view.mm), view.beats,
+                    embedding);
+            uids.push_back(uid);
+            raw.insert(raw.end(), embedding, embedding + EMBEDDING_DIMS);
+        }
+    }
+    catch (std::exception &e)
+    {
+        LOG(ERROR) << e.what() << endl;
+        return -1;
+    }
+
+    return write(filename, uids, raw) ? uids.size() : -1;
+}
+
+static void orthonormalize(vector<double> &v, int n, int dims)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        double *a = &v[i * dims];
+        for (int j = 0; j < i; ++j)
+        {
+            const double *b = &v[j * dims];
+            double dot = 0;
+            for (int k = 0; k < dims; ++k)
+                dot += a[k] * b[k];
+            for (int k = 0; k < dims; ++k)
+                a[k] -= dot * b[k];
+        }
+
+        double norm = 0;
+        for (int k = 0; k < dims; ++k)
+            norm += a[k] * a[k];
+        norm = sqrt(norm);
+        for (int k = 0; k < dims; ++k)
+            a[k] = norm > 1e-12 ? a[k] / norm : (k == i);
+    }
+}
+
+// The top INDEX_DIMS eigenvectors of the covariance of the (already
+// centered) points, by subspace iteration.
+void AcousticIndex::principal_axes(const vector<float> &points, int count,
+        vector<float> &axes)
+{
+    const int dims = EMBEDDING_DIMS;
+
+    vector<double> cov(dims * dims, 0);
+    for (int i = 0; i < count; ++i)
+    {
+        const float *p = &points[i * dims];
+        for (int j = 0; j < dims; ++j)
+            for (int k = 0; k <= j; ++k)
+                cov[j * dims + k] += p[j] * p[k];
+    }
+    for (int j = 0; j < dims; ++j)
+        for (int k = 0; k < j; ++k)
+            cov[k * dims + j] = cov[j * dims + k];
+
+    vector<double> v(INDEX_DIMS * dims), next(INDEX_DIMS * dims);
+    for (size_t i = 0; i < v.size(); ++i)
+        v[i] = imms_random(2000) / 1000.0 - 1;
+    orthonormalize(v, INDEX_DIMS, dims);
+
+    for (int round = 0; round < PCA_ROUNDS; ++round)
+    {
+        for (int i = 0; i < INDEX_DIMS; ++i)
+            for (int j = 0; j < dims; ++j)
+            {
+                double sum = 0;
+                for (int k = 0; k < dims; ++k)
+                    sum += cov[j * dims + k] * v[i * dims + k];
+                next[i * dims + j] = sum;
+            }
+        v.swap(next);
+        orthonormalize(v, INDEX_DIMS, dims);
+    }
+
+    axes.assign(v.begin(), v.end());
+}
+
+bool AcousticIndex::write(const string &filename,
+        const vector<int> &uids, const vector<float> &raw)
+{
+    const int dims = EMBEDDING_DIMS, count = uids.size();
+
+    // standardize every dimension, then weigh the two halves equally
+    vector<float> offsets(dims, 0), scales(dims, 0);
+    for (int k = 0; k < dims; ++k)
+    {
+        double sum = 0, sum2 = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            sum += raw[i * dims + k];
+            sum2 += raw[i * dims + k] * raw[i * dims + k];
+        }
+        double mean = count ? sum / count : 0;
+        double stdv = count ? sqrt(std::max(sum2 / count - mean * mean,
+                    0.0)) : 0;
+        int block = k < TIMBRE_DIMS ? TIMBRE_DIMS : BEATSBINS;
+
+        offsets[k] = mean;
+        scales[k] = stdv > 0 ? 1 / (stdv * sqrt((double)block)) : 0;
+    }
+
+    vector<float> points(raw);
+    for (int i = 0; i < count; ++i)
+        for (int k = 0; k < dims; ++k)
+            points[i * dims + k] =
+                (points[i * dims + k] - offsets[k]) * scales[k];
+
+    vector<float> axes;
+    principal_axes(points, count, axes);
+
+    vector<float> projected(count * INDEX_DIMS);
+    for (int i = 0; i < count; ++i)
+        for (int c = 0; c < INDEX_DIMS; ++c)
+        {
+            float sum = 0;
+            for (int k = 0; k < dims; ++k)
+                sum += axes[c * dims + k] * points[i * dims + k];
+            projected[i * INDEX_DIMS + c] = sum;
+        }
+
+    vector<int> order(count);
+    for (int i = 0; i < count; ++i)
+        order[i] = i;
+    vector<Node> nodes(count);
+    build_tree(projected, order, nodes, 0, count);
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.dims = dims;
+    header.components = INDEX_DIMS;
+    header.count = count;
+
+    // written next to it and moved into place, so that whoever has the
+    // old one mapped can keep on using it
+    string temp = filename + ".tmp";
+    {
+        ofstream out(temp.c_str(), std::ios::binary | std::ios::trunc);
+        out.write((const char *)&header, sizeof(header));
+        out.write((const char *)&offsets[0], dims * sizeof(float));
+        out.write((const char *)&scales[0], dims * sizeof(float));
+        out.write((const char *)&axes[0], INDEX_DIMS * dims * sizeof(float));
+        for (int i = 0; i < count; ++i)
+            out.write((const char *)&uids[order[i]], sizeof(int));
+        for (int i = 0; i < count; ++i)
+            out.write((const char *)&points[order[i] * dims],
+                    dims * sizeof(float));
+        if (count)
+        {
+            out.write((const char *)&projected[0],
+                    count * INDEX_DIMS * sizeof(float));
+            out.write((const char *)&nodes[0], count * sizeof(Node));
+        }
+        out.close();
+        if (!out)
+        {
+            unlink(temp.c_str());
+            return false;
+        }
+    }
+
+    return !rename(temp.c_str(), filename.c_str());
+}
+
+// Lays out the songs between begin and end as a tree, moving their
+// projections into place and keeping track of where they came from.
+void AcousticIndex::build_tree(vector<float> &projected, vector<int> &order,
+        vector<Node> &nodes, int begin, int end)
+{
+    if (begin >= end)
+        return;
+
+    // a random vantage point goes first
+    int vantage = begin + imms_random(end - begin);
+    std::swap(order[begin], order[vantage]);
+    std::swap_ranges(&projected[begin * INDEX_DIMS],
+            &projected[(begin + 1) * INDEX_DIMS],
+            &projected[vantage * INDEX_DIMS]);
+
+    Node &node = nodes[begin];
+    node.radius = 0;
+    node.mid = node.end = end;
+    if (end - begin == 1)
+        return;
+
+    const float *v = &projected[begin * INDEX_DIMS];
+    vector<std::pair<float, int> > by_distance;
+    for (int i = begin + 1; i < end; ++i)
+        by_distance.push_back(std::make_pair(
+                    distance(&projected[i * INDEX_DIMS], v, INDEX_DIMS), i));
+
+    // the closer half goes inside, the rest outside
+    int inside = by_distance.size() / 2;
+    std::nth_element(by_distance.begin(), by_distance.begin() + inside,
+            by_distance.end());
+    node.radius = by_distance[inside].first;
+    node.mid = begin + 1 + inside;
+
+    vector<float> moved(by_distance.size() * INDEX_DIMS);
+    vector<int> moved_order(by_distance.size());
+    for (size_t i = 0; i < by_distance.size(); ++i)
+    {
+        int from = by_distance[i].second;
+        moved_order[i] = order[from];
+        std::copy(&projected[from * INDEX_DIMS],
+                &projected[(from + 1) * INDEX_DIMS], &moved[i * INDEX_DIMS]);
+    }
+    std::copy(moved_order.begin(), moved_order.end(), &order[begin + 1]);
+    std::copy(moved.begin(), moved.end(), &projected[(begin + 1) * INDEX_DIMS]);
+
+    int mid = node.mid;
+    build_tree(projected, order, nodes, begin + 1, mid);
+    build_tree(projected, order, nodes, mid, end);
+}
+
+void AcousticIndex::standardize(const float *embedding, float *point) const
+{
+    for (int k = 0; k < dims; ++k)
+        point[k] = (embedding[k] - offsets[k]) * scales[k];
+}
+
+float AcousticIndex::distance(const float *a, const float *b, int dims)
+{
+    float d = 0;
+    for (int k = 0; k < dims; ++k)
+    {
+        float x = a[k] - b[k];
+        d += x * x;
+    }
+    return sqrtf(d);
+}
+
+void AcousticIndex::nearest(const PackedMixtureModel &mm, const float *beats,
+        int k, vector<int> &out, vector<float> *distances) const
+{
+    float embedding[EMBEDDING_DIMS];
+    acoustic_embedding(mm, beats, embedding);
+    nearest(embedding, k, out, distances);
+}
+
+void AcousticIndex::nearest(const float embedding[EMBEDDING_DIMS], int k,
+        vector<int> &out, vector<float> *distances) const
+{
+    if (!header || !header->count || k < 1)
+        return;
+
+    float point[EMBEDDING_DIMS], query[INDEX_DIMS];
+    standardize(embedding, point);
+    for (int c = 0; c < INDEX_DIMS; ++c)
+    {
+        query[c] = 0;
+        for (int i = 0; i < dims; ++i)
+            query[c] += axes[c * dims + i] * point[i];
+    }
+
+    Heap heap;
+    heap.reserve(k * INDEX_RERANK + 1);
+    search(0, query, k * INDEX_RERANK, heap);
+
+    // compare the ones the tree found in full
+    for (Heap::iterator i = heap.begin(); i != heap.end(); ++i)
+        i->first = distance(point, get_point(i->second), dims);
+    std::sort(heap.begin(), heap.end());
+    if ((int)heap.size() > k)
+        heap.resize(k);
+
+    for (Heap::iterator i = heap.begin(); i != heap.end(); ++i)
+    {
+        out.push_back(uids[i->second]);
+        if (distances)
+            distances->push_back(i->first);
+    }
+}
+
+// The k closest so far are kept in a max heap, so the first one is the
+// one to beat - once there are k of them.
+static inline float to_beat(const vector<std::pair<float, int> > &heap, int k)
+{
+    return (int)heap.size() < k ? HUGE_VALF : heap.front().first;
+}
+
+void AcousticIndex::search(int i, const float *query, int k, Heap &heap) const
+{
+    const Node &node = nodes[i];
+    float d = distance(query, projected + i * INDEX_DIMS, INDEX_DIMS);
+
+    if (d < to_beat(heap, k))
+    {
+        heap.push_back(std::make_pair(d, i));
+        std::push_heap(heap.begin(), heap.end());
+        if ((int)heap.size() > k)
+        {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.pop_back();
+        }
+    }
+
+    bool inside = node.mid > i + 1, outside = node.end > node.mid;
+
+    // everything inside is within radius of the vantage point, and
+    // everything outside is at least that far away from it
+    if (d < node.radius)
+    {
+        if (inside && d - to_beat(heap, k) <= node.radius)
+            search(i + 1, query, k, heap);
+        if (outside && d + to_beat(heap, k) >= node.radius)
+            search(node.mid, query, k, heap);
+    }
+    else
+    {
+        if (outside && d + to_beat(heap, k) >= node.radius)
+            search(node.mid, query, k, heap);
+        if (inside && d - to_beat(heap, k) <= node.radius)
+            search(i + 1, query, k, heap);
+    }
+}
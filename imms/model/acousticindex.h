@@ -0,0 +1,128 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#ifndef __ACOUSTICINDEX_H
+#define __ACOUSTICINDEX_H
+
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+
+#include "klkernel.h"
+#include "distance.h"
+
+// Where immsd and immstool look for it, under IMMSROOT
+#define ACOUSTIC_INDEX  "acoustic.index"
+
+// The timbre (the mixture's overall mean and spread in every dimension)
+// followed by the cumulative beat graph, BEATSCOMB bins at a time.
+#define EMBEDDING_DIMS  (2 * Gaussian::NumDimensions + BEATSBINS)
+
+// Fixed length summary of a song's acoustic data, to compare songs by
+// plain euclidean distance. It is a lot cruder than the SVM, but good
+// enough to find the songs that are worth asking the SVM about.
+void acoustic_embedding(const PackedMixtureModel &mm, const float *beats,
+        float embedding[EMBEDDING_DIMS]);
+
+// Principal components of the embeddings the index is searched by
+#define INDEX_DIMS      12
+
+// Songs compared in full per song asked for
+#define INDEX_RERANK    4
+
+// Nearest neighbours of a song among all of the analyzed ones.
+//
+// The embeddings are standardized over the library, and projected onto
+// their first INDEX_DIMS principal components, which are then stored in
+// a vantage point tree, laid out in the order a search visits it: every
+// node is a song, followed by the subtree of songs closer to it than its
+// radius, and then by the subtree of the rest. Vantage point trees stop
+// pruning anything long before EMBEDDING_DIMS dimensions, so the tree
+// only comes up with INDEX_RERANK times as many songs as were asked for,
+// which are then compared in full. That makes it approximate.
+//
+// "immstool index" builds it from A.Acoustic into a file, which is then
+// mapped into memory read only, so loading it costs next to nothing and
+// it is shared by everyone who has it open. Songs analyzed since it was
+// built are simply not found.
+class AcousticIndex
+{
+public:
+    AcousticIndex();
+    ~AcousticIndex();
+
+    // Returns the number of songs indexed, or -1 if it failed.
+    static int build(const std::string &filename);
+    static bool write(const std::string &filename,
+            const std::vector<int> &uids, const std::vector<float> &raw);
+
+    bool load(const std::string &filename);
+    void close();
+
+    bool is_loaded() const { return header != 0; }
+    int size() const;
+
+    // The k indexed songs closest to the given one, closest first.
+    // Distances are optional.
+    void nearest(const PackedMixtureModel &mm, const float *beats, int k,
+            std::vector<int> &uids, std::vector<float> *distances = 0) const;
+    void nearest(const float embedding[EMBEDDING_DIMS], int k,
+            std::vector<int> &uids, std::vector<float> *distances = 0) const;
+
+    // Exposed for checking the search
+    void standardize(const float *embedding, float *point) const;
+    const float *get_point(int i) const { return points + i * dims; }
+    int get_uid(int i) const { return uids[i]; }
+    static float distance(const float *a, const float *b, int dims);
+
+private:
+    struct Header
+    {
+        char magic[8];
+        int version, dims, components, count;
+    };
+
+    struct Node
+    {
+        float radius;
+        // the outside subtree starts at mid and ends right before end
+        int mid, end;
+    };
+
+    typedef std::vector<std::pair<float, int> > Heap;
+    void search(int node, const float *query, int k, Heap &heap) const;
+
+    static void principal_axes(const std::vector<float> &points, int count,
+            std::vector<float> &axes);
+    static void build_tree(std::vector<float> &projected,
+            std::vector<int> &order, std::vector<Node> &nodes,
+            int begin, int end);
+
+    void *map;
+    size_t length;
+
+    const Header *header;
+    int dims;
+    const float *offsets, *scales, *axes;
+    const int *uids;
+    const float *points, *projected;
+    const Node *nodes;
+};
+
+#endif
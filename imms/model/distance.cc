@@ -24,7 +24,6 @@
 #include <string.h>
 
 #include "distance.h"
-#include "emd.h"
 
 using std::cerr;
 using std::endl;
@@ -47,38 +46,33 @@ float KL_Divergence(const Gaussian &g1, const Gaussian &g2)
     return total;
 }
 
-float EMD::cost[NUMGAUSS][NUMGAUSS];
-
 float EMD::raw_distance(const MixtureModel &m1, const MixtureModel &m2)
 {
-    feature_t features[NUMGAUSS];
-    float w1[NUMGAUSS], w2[NUMGAUSS];
-
-    for (int i = 0; i < NUMGAUSS; ++i)
-    {
-        features[i] = i;
-        w1[i] = m1.gauss[i].weight;
-        w2[i] = m2.gauss[i].weight;
+    GaussSolver solver;
+    return raw_distance(m1, m2, solver);
+}
 
-        for (int j = 0; j < NUMGAUSS; ++j)
-            cost[i][j] = KL_Divergence(m1.gauss[i], m2.gauss[j]);
-    }
+float EMD::raw_distance(const MixtureModel &m1, const MixtureModel &m2,
+        GaussSolver &solver)
+{
+    PackedMixtureModel p1(m1), p2(m2);
+    return raw_distance(p1, p2, solver);
+}
 
-    signature_t s1 = { NUMGAUSS, features, w1 };
-    signature_t s2 = { NUMGAUSS, features, w2 };
-    return emd(&s1, &s2, EMD::gauss_dist, 0, 0);
+float EMD::raw_distance(const PackedMixtureModel &m1,
+        const PackedMixtureModel &m2, GaussSolver &solver)
+{
+    float cost[NUMGAUSS][NUMGAUSS];
+    kl_costs(m1, m2, cost);
+    return solver.distance(cost, m1.weights, NUMGAUSS, m2.weights, NUMGAUSS);
 }
 
-static bool normalize_beat_graph(float beats[BEATSSIZE], float *output, int comb)
+static bool normalize_beat_graph(const float beats[BEATSSIZE], float *output)
 {
-    float sum = 0, min = 1e100;
+    float sum = 0;
 
     for (int i = 0; i < BEATSSIZE; ++i)
-    {
         sum += beats[i];
-        if (beats[i] < min)
-            min = beats[i];
-    }
 
     if (sum == 0)
         return false;
@@ -86,33 +80,58 @@ static bool normalize_beat_graph(float beats[BEATSSIZE], float *output, int comb
     // scale to keep the total area under the curve to be fixed
     float scale = 100.0 / sum;
     for (int i = 0; i < BEATSSIZE; ++i)
-        output[i / comb] += beats[i] * scale;
+        output[i / BEATSCOMB] += beats[i] * scale;
 
     return true;
 }
 
-float EMD::raw_distance(float beats1[BEATSSIZE], float beats2[BEATSSIZE])
+float EMD::raw_distance(const float beats1[BEATSSIZE],
+        const float beats2[BEATSSIZE])
 {
-    static const int comb = 5;
-    static const int OUTSIZE = DIVROUNDUP(BEATSSIZE, comb);
-
-    feature_t features[OUTSIZE];
-
-    for (int i = 0; i < OUTSIZE; ++i)
-        features[i] = i;
+    BeatsSolver solver;
+    return raw_distance(beats1, beats2, solver);
+}
 
-    float b1[OUTSIZE], b2[OUTSIZE];
+float EMD::raw_distance(const float beats1[BEATSSIZE],
+        const float beats2[BEATSSIZE], BeatsSolver &solver)
+{
+    float b1[BEATSBINS], b2[BEATSBINS];
     memset(b1, 0, sizeof(b1));
     memset(b2, 0, sizeof(b2));
 
-    if (!normalize_beat_graph(beats1, b1, comb))
+    if (!normalize_beat_graph(beats1, b1))
         return -1;
-    if (!normalize_beat_graph(beats2, b2, comb))
+    if (!normalize_beat_graph(beats2, b2))
         return -1;
 
-    signature_t s1 = { OUTSIZE, features, b1 };
-    signature_t s2 = { OUTSIZE, features, b2 };
-    return emd(&s1, &s2, EMD::linear_dist, 0, 0);
+    double sum1 = 0, sum2 = 0;
+    for (int i = 0; i < BEATSBINS; ++i)
+    {
+        sum1 += b1[i];
+        sum2 += b2[i];
+    }
+
+    // With the same amount of dirt on both sides and neighbouring bins one
+    // apart, the cheapest way to move it is to carry the difference of the
+    // running totals over each gap - no need to solve for the flow.
+    if (fabs(sum1 - sum2) < EPSILON * sum1)
+    {
+        double carried = 0, total = 0;
+        for (int i = 0; i < BEATSBINS - 1; ++i)
+        {
+            carried += (double)b1[i] - b2[i];
+            total += fabs(carried);
+        }
+        return (float)(total / std::min(sum1, sum2));
+    }
+
+    // Otherwise some of it is left over, which takes the full solver.
+    float cost[BEATSBINS][BEATSBINS];
+    for (int i = 0; i < BEATSBINS; ++i)
+        for (int j = 0; j < BEATSBINS; ++j)
+            cost[i][j] = abs(i - j);
+
+    return solver.distance(cost, b1, BEATSBINS, b2, BEATSBINS);
 }
 
 float song_cepstr_distance(int uid1, int uid2)
@@ -26,17 +26,32 @@
 #include <analyzer/mfcckeeper.h>
 #include <analyzer/beatkeeper.h>
 
+#include "emdsolver.h"
+#include "klkernel.h"
+
+// beat graphs are compared BEATSCOMB bins at a time
+#define BEATSCOMB       5
+#define BEATSBINS       ((BEATSSIZE + BEATSCOMB - 1) / BEATSCOMB)
+
+// Safe to call from any number of threads at once. The versions that take
+// a solver let the caller keep the workspace around between calls.
 struct EMD {
+    typedef EMDSolver<NUMGAUSS, NUMGAUSS> GaussSolver;
+    typedef EMDSolver<BEATSBINS, BEATSBINS> BeatsSolver;
+
     static float raw_distance(const MixtureModel &m1, const MixtureModel &m2);
-    static float raw_distance(float beats1[BEATSSIZE], float beats2[BEATSSIZE]);
-private:
-    static float gauss_dist(int *f1, int *f2)
-        { return cost[*f1][*f2]; }
-    static float linear_dist(int *f1, int *f2)
-        { return abs(*f1 - *f2); }
-    static float cost[NUMGAUSS][NUMGAUSS];
+    static float raw_distance(const MixtureModel &m1, const MixtureModel &m2,
+            GaussSolver &solver);
+    static float raw_distance(const PackedMixtureModel &m1,
+            const PackedMixtureModel &m2, GaussSolver &solver);
+    static float raw_distance(const float beats1[BEATSSIZE],
+            const float beats2[BEATSSIZE]);
+    static float raw_distance(const float beats1[BEATSSIZE],
+            const float beats2[BEATSSIZE], BeatsSolver &solver);
 };
 
+float KL_Divergence(const Gaussian &g1, const Gaussian &g2);
+
 float song_cepstr_distance(int uid1, int uid2);
 float song_bpm_distance(int uid1, int uid2);
 
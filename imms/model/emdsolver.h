@@ -0,0 +1,644 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#ifndef __EMDSOLVER_H
+#define __EMDSOLVER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "emd.h"
+
+// The transportation simplex of emd.c, sized at compile time for at most
+// N1 by N2 features and working on a cost matrix given up front instead
+// of calling back for every pair of features.
+//
+// All the state lives in the object, so every thread (or every caller
+// that wants to avoid setting one up on the stack each time) can keep its
+// own. It takes the same steps as emd() and gives the same answers.
+template <int N1, int N2>
+class EMDSolver
+{
+public:
+    // cost[i][j] is the ground distance between feature i of the first
+    // signature and feature j of the second.
+    float distance(const float cost[N1][N2], const float *w1, int n1,
+            const float *w2, int n2);
+
+private:
+    enum { R = N1 + 1, C = N2 + 1, X = N1 + N2 + 2 };
+
+    struct node1_t
+    {
+        int i;
+        double val;
+        node1_t *Next;
+    };
+
+    struct node2_t
+    {
+        int i, j;
+        double val;
+        node2_t *NextC, *NextR;
+    };
+
+    float init(const float cost[N1][N2], const float *w1, const float *w2);
+    void findBasicVariables(node1_t *U, node1_t *V);
+    bool isOptimal(node1_t *U, node1_t *V);
+    int findLoop(node2_t **Loop);
+    void newSol();
+    void russel(double *S, double *D);
+    void addBasicVariable(int minI, int minJ, double *S, double *D,
+            node1_t *PrevUMinI, node1_t *PrevVMinJ, node1_t *UHead);
+
+    static void fail(const char *where)
+    {
+        fprintf(stderr, "emd: Unexpected error in %s!\n", where);
+        exit(1);
+    }
+
+    int n1, n2;
+    float _C[R][C];
+    node2_t _X[X];
+    node2_t *EndX, *EnterX;
+    char IsX[R][C];
+    node2_t *RowsX[R], *ColsX[C];
+    double maxW;
+    float maxC;
+};
+
+template <int N1, int N2>
+float EMDSolver<N1, N2>::distance(const float cost[N1][N2],
+        const float *w1, int _n1, const float *w2, int _n2)
+{
+    n1 = _n1;
+    n2 = _n2;
+
+    node1_t U[R], V[C];
+    float w = init(cost, w1, w2);
+
+    // if n1 = 1 or n2 = 1 then we are done
+    if (n1 > 1 && n2 > 1)
+    {
+        int itr;
+        for (itr = 1; itr < MAX_ITERATIONS; itr++)
+        {
+            findBasicVariables(U, V);
+            if (isOptimal(U, V))
+                break;
+            newSol();
+        }
+
+        if (itr == MAX_ITERATIONS)
+            fprintf(stderr, "emd: Maximum number of iterations has been "
+                    "reached (%d)\n", MAX_ITERATIONS);
+    }
+
+    double totalCost = 0;
+    for (node2_t *XP = _X; XP < EndX; XP++)
+    {
+        // EnterX is the empty slot; skip the dummy feature and zero flows
+        if (XP == EnterX || XP->i == _n1 || XP->j == _n2 || XP->val == 0)
+            continue;
+        totalCost += (double)XP->val * _C[XP->i][XP->j];
+    }
+
+    return (float)(totalCost / w);
+}
+
+template <int N1, int N2>
+float EMDSolver<N1, N2>::init(const float cost[N1][N2],
+        const float *w1, const float *w2)
+{
+    double S[R], D[C];
+
+    maxC = 0;
+    for (int i = 0; i < n1; i++)
+        for (int j = 0; j < n2; j++)
+        {
+            _C[i][j] = cost[i][j];
+            if (_C[i][j] > maxC)
+                maxC = _C[i][j];
+        }
+
+    double sSum = 0.0;
+    for (int i = 0; i < n1; i++)
+    {
+        S[i] = w1[i];
+        sSum += w1[i];
+        RowsX[i] = NULL;
+    }
+    double dSum = 0.0;
+    for (int j = 0; j < n2; j++)
+    {
+        D[j] = w2[j];
+        dSum += w2[j];
+        ColsX[j] = NULL;
+    }
+
+    // if supply is different from demand, add a zero cost dummy cluster
+    double diff = sSum - dSum;
+    if (fabs(diff) >= EPSILON * sSum)
+    {
+        if (diff < 0.0)
+        {
+            for (int j = 0; j < n2; j++)
+                _C[n1][j] = 0;
+            S[n1] = -diff;
+            RowsX[n1] = NULL;
+            n1++;
+        }
+        else
+        {
+            for (int i = 0; i < n1; i++)
+                _C[i][n2] = 0;
+            D[n2] = diff;
+            ColsX[n2] = NULL;
+            n2++;
+        }
+    }
+
+    for (int i = 0; i < n1; i++)
+        for (int j = 0; j < n2; j++)
+            IsX[i][j] = 0;
+    EndX = _X;
+
+    maxW = sSum > dSum ? sSum : dSum;
+
+    russel(S, D);
+
+    // an empty slot - there are only n1 + n2 - 1 basic variables
+    EnterX = EndX++;
+
+    return sSum > dSum ? dSum : sSum;
+}
+
+template <int N1, int N2>
+void EMDSolver<N1, N2>::findBasicVariables(node1_t *U, node1_t *V)
+{
+    node1_t u0Head, u1Head, *CurU, *PrevU;
+    node1_t v0Head, v1Head, *CurV, *PrevV;
+
+    // initialize the rows list (U) and the columns list (V)
+    u0Head.Next = CurU = U;
+    for (int i = 0; i < n1; i++)
+    {
+        CurU->i = i;
+        CurU->Next = CurU + 1;
+        CurU++;
+    }
+    (--CurU)->Next = NULL;
+    u1Head.Next = NULL;
+
+    CurV = V + 1;
+    v0Head.Next = n2 > 1 ? V + 1 : NULL;
+    for (int j = 1; j < n2; j++)
+    {
+        CurV->i = j;
+        CurV->Next = CurV + 1;
+        CurV++;
+    }
+    (--CurV)->Next = NULL;
+    v1Head.Next = NULL;
+
+    // there are n1 + n2 variables but only n1 + n2 - 1 independent
+    // equations, so set V[0] = 0
+    V[0].i = 0;
+    V[0].val = 0;
+    v1Head.Next = V;
+    v1Head.Next->Next = NULL;
+
+    int UfoundNum = 0, VfoundNum = 0;
+    while (UfoundNum < n1 || VfoundNum < n2)
+    {
+        bool found = false;
+        if (VfoundNum < n2)
+        {
+            // loop over all marked columns
+            PrevV = &v1Head;
+            for (CurV = v1Head.Next; CurV != NULL; CurV = CurV->Next)
+            {
+                int j = CurV->i;
+                // find the variables in column j
+                PrevU = &u0Head;
+                for (CurU = u0Head.Next; CurU != NULL; CurU = CurU->Next)
+                {
+                    int i = CurU->i;
+                    if (IsX[i][j])
+                    {
+                        // compute U[i] and add it to the marked list
+                        CurU->val = _C[i][j] - CurV->val;
+                        PrevU->Next = CurU->Next;
+                        CurU->Next = u1Head.Next;
+                        u1Head.Next = CurU;
+                        CurU = PrevU;
+                    }
+                    else
+                        PrevU = CurU;
+                }
+                PrevV->Next = CurV->Next;
+                VfoundNum++;
+                found = true;
+            }
+        }
+        if (UfoundNum < n1)
+        {
+            // loop over all marked rows
+            PrevU = &u1Head;
+            for (CurU = u1Head.Next; CurU != NULL; CurU = CurU->Next)
+            {
+                int i = CurU->i;
+                // find the variables in row i
+                PrevV = &v0Head;
+                for (CurV = v0Head.Next; CurV != NULL; CurV = CurV->Next)
+                {
+                    int j = CurV->i;
+                    if (IsX[i][j])
+                    {
+                        // compute V[j] and add it to the marked list
+                        CurV->val = _C[i][j] - CurU->val;
+                        PrevV->Next = CurV->Next;
+                        CurV->Next = v1Head.Next;
+                        v1Head.Next = CurV;
+                        CurV = PrevV;
+                    }
+                    else
+                        PrevV = CurV;
+                }
+                PrevU->Next = CurU->Next;
+                UfoundNum++;
+                found = true;
+            }
+        }
+        if (!found)
+            fail("findBasicVariables");
+    }
+}
+
+template <int N1, int N2>
+bool EMDSolver<N1, N2>::isOptimal(node1_t *U, node1_t *V)
+{
+    int minI = 0, minJ = 0;
+
+    // find the minimal Cij - Ui - Vj over all i, j
+    double deltaMin = EMDINF;
+    for (int i = 0; i < n1; i++)
+        for (int j = 0; j < n2; j++)
+            if (!IsX[i][j])
+            {
+                double delta = _C[i][j] - U[i].val - V[j].val;
+                if (deltaMin > delta)
+                {
+                    deltaMin = delta;
+                    minI = i;
+                    minJ = j;
+                }
+            }
+
+    if (deltaMin == EMDINF)
+        fail("isOptimal");
+
+    EnterX->i = minI;
+    EnterX->j = minJ;
+
+    // if no negative deltaMin, we found the optimal solution
+    return deltaMin >= -EPSILON * maxC;
+}
+
+template <int N1, int N2>
+void EMDSolver<N1, N2>::newSol()
+{
+    node2_t *Loop[X], *CurX, *LeaveX = 0;
+
+    // enter the new basic variable
+    int i = EnterX->i, j = EnterX->j;
+    IsX[i][j] = 1;
+    EnterX->NextC = RowsX[i];
+    EnterX->NextR = ColsX[j];
+    EnterX->val = 0;
+    RowsX[i] = EnterX;
+    ColsX[j] = EnterX;
+
+    // find a chain reaction
+    int steps = findLoop(Loop);
+
+    // find the largest value in the loop
+    double xMin = EMDINF;
+    for (int k = 1; k < steps; k += 2)
+        if (Loop[k]->val < xMin)
+        {
+            LeaveX = Loop[k];
+            xMin = Loop[k]->val;
+        }
+
+    // update the loop
+    for (int k = 0; k < steps; k += 2)
+    {
+        Loop[k]->val += xMin;
+        Loop[k + 1]->val -= xMin;
+    }
+
+    // remove the leaving basic variable
+    i = LeaveX->i;
+    j = LeaveX->j;
+    IsX[i][j] = 0;
+    if (RowsX[i] == LeaveX)
+        RowsX[i] = LeaveX->NextC;
+    else
+        for (CurX = RowsX[i]; CurX != NULL; CurX = CurX->NextC)
+            if (CurX->NextC == LeaveX)
+            {
+                CurX->NextC = CurX->NextC->NextC;
+                break;
+            }
+    if (ColsX[j] == LeaveX)
+        ColsX[j] = LeaveX->NextR;
+    else
+        for (CurX = ColsX[j]; CurX != NULL; CurX = CurX->NextR)
+            if (CurX->NextR == LeaveX)
+            {
+                CurX->NextR = CurX->NextR->NextR;
+                break;
+            }
+
+    // the leaving variable is the new empty slot
+    EnterX = LeaveX;
+}
+
+template <int N1, int N2>
+int EMDSolver<N1, N2>::findLoop(node2_t **Loop)
+{
+    char IsUsed[X];
+    for (int i = 0; i < n1 + n2; i++)
+        IsUsed[i] = 0;
+
+    node2_t **CurX = Loop, *NewX;
+    NewX = *CurX = EnterX;
+    IsUsed[EnterX - _X] = 1;
+    int steps = 1;
+
+    do
+    {
+        if (steps % 2 == 1)
+        {
+            // find an unused X in the row
+            NewX = RowsX[NewX->i];
+            while (NewX != NULL && IsUsed[NewX - _X])
+                NewX = NewX->NextC;
+        }
+        else
+        {
+            // find an unused X in the column, or the entering X
+            NewX = ColsX[NewX->j];
+            while (NewX != NULL && IsUsed[NewX - _X] && NewX != EnterX)
+                NewX = NewX->NextR;
+            if (NewX == EnterX)
+                break;
+        }
+
+        if (NewX != NULL)
+        {
+            // add X to the loop
+            *++CurX = NewX;
+            IsUsed[NewX - _X] = 1;
+            steps++;
+        }
+        else
+        {
+            // backtrack
+            do
+            {
+                NewX = *CurX;
+                do
+                {
+                    if (steps % 2 == 1)
+                        NewX = NewX->NextR;
+                    else
+                        NewX = NewX->NextC;
+                } while (NewX != NULL && IsUsed[NewX - _X]);
+
+                if (NewX == NULL)
+                {
+                    IsUsed[*CurX - _X] = 0;
+                    CurX--;
+                    steps--;
+                }
+            } while (NewX == NULL && CurX >= Loop);
+
+            IsUsed[*CurX - _X] = 0;
+            *CurX = NewX;
+            IsUsed[NewX - _X] = 1;
+        }
+    } while (CurX >= Loop);
+
+    if (CurX == Loop)
+        fail("findLoop");
+
+    return steps;
+}
+
+template <int N1, int N2>
+void EMDSolver<N1, N2>::russel(double *S, double *D)
+{
+    int minI = 0, minJ = 0;
+    double deltaMin, oldVal, diff;
+    double Delta[R][C];
+    node1_t Ur[R], Vr[C];
+    node1_t uHead, *CurU, *PrevU;
+    node1_t vHead, *CurV, *PrevV;
+    node1_t *PrevUMinI = 0, *PrevVMinJ = 0, *Remember;
+
+    // initialize the rows list (Ur) and the columns list (Vr)
+    uHead.Next = CurU = Ur;
+    for (int i = 0; i < n1; i++)
+    {
+        CurU->i = i;
+        CurU->val = -EMDINF;
+        CurU->Next = CurU + 1;
+        CurU++;
+    }
+    (--CurU)->Next = NULL;
+
+    vHead.Next = CurV = Vr;
+    for (int j = 0; j < n2; j++)
+    {
+        CurV->i = j;
+        CurV->val = -EMDINF;
+        CurV->Next = CurV + 1;
+        CurV++;
+    }
+    (--CurV)->Next = NULL;
+
+    // find the maximum row and column values (Ur[i] and Vr[j])
+    for (int i = 0; i < n1; i++)
+        for (int j = 0; j < n2; j++)
+        {
+            float v = _C[i][j];
+            if (Ur[i].val <= v)
+                Ur[i].val = v;
+            if (Vr[j].val <= v)
+                Vr[j].val = v;
+        }
+
+    for (int i = 0; i < n1; i++)
+        for (int j = 0; j < n2; j++)
+            Delta[i][j] = _C[i][j] - Ur[i].val - Vr[j].val;
+
+    // find the basic variables
+    do
+    {
+        // find the smallest Delta[i][j]
+        bool found = false;
+        deltaMin = EMDINF;
+        PrevU = &uHead;
+        for (CurU = uHead.Next; CurU != NULL; CurU = CurU->Next)
+        {
+            int i = CurU->i;
+            PrevV = &vHead;
+            for (CurV = vHead.Next; CurV != NULL; CurV = CurV->Next)
+            {
+                int j = CurV->i;
+                if (deltaMin > Delta[i][j])
+                {
+                    deltaMin = Delta[i][j];
+                    minI = i;
+                    minJ = j;
+                    PrevUMinI = PrevU;
+                    PrevVMinJ = PrevV;
+                    found = true;
+                }
+                PrevV = CurV;
+            }
+            PrevU = CurU;
+        }
+
+        if (!found)
+            break;
+
+        // add X[minI][minJ] to the basis, and adjust supplies and cost
+        Remember = PrevUMinI->Next;
+        addBasicVariable(minI, minJ, S, D, PrevUMinI, PrevVMinJ, &uHead);
+
+        // update the necessary Delta[][]
+        if (Remember == PrevUMinI->Next)
+        {
+            // line minI was deleted
+            for (CurV = vHead.Next; CurV != NULL; CurV = CurV->Next)
+            {
+                int j = CurV->i;
+                if (CurV->val == _C[minI][j])
+                {
+                    // find the new maximum value in the column
+                    oldVal = CurV->val;
+                    CurV->val = -EMDINF;
+                    for (CurU = uHead.Next; CurU != NULL; CurU = CurU->Next)
+                    {
+                        int i = CurU->i;
+                        if (CurV->val <= _C[i][j])
+                            CurV->val = _C[i][j];
+                    }
+
+                    // if needed, adjust the relevant Delta[*][j]
+                    diff = oldVal - CurV->val;
+                    if (fabs(diff) < EPSILON * maxC)
+                        for (CurU = uHead.Next; CurU != NULL;
+                                CurU = CurU->Next)
+                            Delta[CurU->i][j] += diff;
+                }
+            }
+        }
+        else
+        {
+            // column minJ was deleted
+            for (CurU = uHead.Next; CurU != NULL; CurU = CurU->Next)
+            {
+                int i = CurU->i;
+                if (CurU->val == _C[i][minJ])
+                {
+                    // find the new maximum value in the row
+                    oldVal = CurU->val;
+                    CurU->val = -EMDINF;
+                    for (CurV = vHead.Next; CurV != NULL; CurV = CurV->Next)
+                    {
+                        int j = CurV->i;
+                        if (CurU->val <= _C[i][j])
+                            CurU->val = _C[i][j];
+                    }
+
+                    // if needed, adjust the relevant Delta[i][*]
+                    diff = oldVal - CurU->val;
+                    if (fabs(diff) < EPSILON * maxC)
+                        for (CurV = vHead.Next; CurV != NULL;
+                                CurV = CurV->Next)
+                            Delta[i][CurV->i] += diff;
+                }
+            }
+        }
+    } while (uHead.Next != NULL || vHead.Next != NULL);
+}
+
+template <int N1, int N2>
+void EMDSolver<N1, N2>::addBasicVariable(int minI, int minJ,
+        double *S, double *D, node1_t *PrevUMinI, node1_t *PrevVMinJ,
+        node1_t *UHead)
+{
+    double T;
+
+    if (fabs(S[minI] - D[minJ]) <= EPSILON * maxW)
+    {
+        // degenerate case
+        T = S[minI];
+        S[minI] = 0;
+        D[minJ] -= T;
+    }
+    else if (S[minI] < D[minJ])
+    {
+        // supply exhausted
+        T = S[minI];
+        S[minI] = 0;
+        D[minJ] -= T;
+    }
+    else
+    {
+        // demand exhausted
+        T = D[minJ];
+        D[minJ] = 0;
+        S[minI] -= T;
+    }
+
+    // X(minI, minJ) is a basic variable
+    IsX[minI][minJ] = 1;
+
+    EndX->val = T;
+    EndX->i = minI;
+    EndX->j = minJ;
+    EndX->NextC = RowsX[minI];
+    EndX->NextR = ColsX[minJ];
+    RowsX[minI] = EndX;
+    ColsX[minJ] = EndX;
+    EndX++;
+
+    // delete the supply row only if it is empty, and if not the last row
+    if (S[minI] == 0 && UHead->Next->Next != NULL)
+        PrevUMinI->Next = PrevUMinI->Next->Next;
+    else
+        PrevVMinJ->Next = PrevVMinJ->Next->Next;
+}
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <algorithm>
+
+#include "klkernel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KL_X86
+#include <immintrin.h>
+#endif
+
+// Enforce a minimum for variences so we don't get huge distances
+#define MIN_VARIANCE    10.0f
+
+void PackedMixtureModel::pack(const MixtureModel &mm)
+{
+    for (int i = 0; i < NUMGAUSS; ++i)
+    {
+        const Gaussian &g = mm.gauss[i];
+        weights[i] = g.weight;
+
+        for (int k = 0; k < Gaussian::NumDimensions; ++k)
+        {
+            means[i][k] = g.means[k];
+            vars[i][k] = std::max(g.vars[k], MIN_VARIANCE);
+            rvars[i][k] = 1.0f / vars[i][k];
+        }
+
+        // var1 / var2 + var2 / var1 - 2 and the distance of the means
+        // both come out to 0 here
+        for (int k = Gaussian::NumDimensions; k < KL_DIMS; ++k)
+        {
+            means[i][k] = 0;
+            vars[i][k] = rvars[i][k] = 1;
+        }
+    }
+}
+
+static void kl_costs_scalar(const PackedMixtureModel &m1,
+        const PackedMixtureModel &m2, float cost[NUMGAUSS][NUMGAUSS])
+{
+    for (int i = 0; i < NUMGAUSS; ++i)
+        for (int j = 0; j < NUMGAUSS; ++j)
+        {
+            float total = 0;
+            for (int k = 0; k < Gaussian::NumDimensions; ++k)
+            {
+                float d = m1.means[i][k] - m2.means[j][k];
+                total += m1.vars[i][k] * m2.rvars[j][k]
+                    + m2.vars[j][k] * m1.rvars[i][k] - 2
+                    + d * d * (m1.rvars[i][k] + m2.rvars[j][k]);
+            }
+            cost[i][j] = total;
+        }
+}
+
+#ifdef KL_X86
+
+__attribute__((target("sse")))
+static void kl_costs_sse(const PackedMixtureModel &m1,
+        const PackedMixtureModel &m2, float cost[NUMGAUSS][NUMGAUSS])
+{
+    const __m128 two = _mm_set1_ps(2);
+    for (int i = 0; i < NUMGAUSS; ++i)
+        for (int j = 0; j < NUMGAUSS; ++j)
+        {
+            __m128 total = _mm_setzero_ps();
+            for (int k = 0; k < KL_DIMS; k += 4)
+            {
+                __m128 v1 = _mm_loadu_ps(&m1.vars[i][k]);
+                __m128 r1 = _mm_loadu_ps(&m1.rvars[i][k]);
+                __m128 v2 = _mm_loadu_ps(&m2.vars[j][k]);
+                __m128 r2 = _mm_loadu_ps(&m2.rvars[j][k]);
+                __m128 d = _mm_sub_ps(_mm_loadu_ps(&m1.means[i][k]),
+                        _mm_loadu_ps(&m2.means[j][k]));
+
+                __m128 ratios = _mm_sub_ps(_mm_add_ps(
+                            _mm_mul_ps(v1, r2), _mm_mul_ps(v2, r1)), two);
+                __m128 spread = _mm_mul_ps(_mm_mul_ps(d, d),
+                        _mm_add_ps(r1, r2));
+                total = _mm_add_ps(total, _mm_add_ps(ratios, spread));
+            }
+
+            float lanes[4];
+            _mm_storeu_ps(lanes, total);
+            cost[i][j] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        }
+}
+
+__attribute__((target("avx")))
+static void kl_costs_avx(const PackedMixtureModel &m1,
+        const PackedMixtureModel &m2, float cost[NUMGAUSS][NUMGAUSS])
+{
+    const __m256 two = _mm256_set1_ps(2);
+    for (int i = 0; i < NUMGAUSS; ++i)
+        for (int j = 0; j < NUMGAUSS; ++j)
+        {
+            __m256 total = _mm256_setzero_ps();
+            for (int k = 0; k < KL_DIMS; k += 8)
+            {
+                __m256 v1 = _mm256_loadu_ps(&m1.vars[i][k]);
+                __m256 r1 = _mm256_loadu_ps(&m1.rvars[i][k]);
+                __m256 v2 = _mm256_loadu_ps(&m2.vars[j][k]);
+                __m256 r2 = _mm256_loadu_ps(&m2.rvars[j][k]);
+                __m256 d = _mm256_sub_ps(_mm256_loadu_ps(&m1.means[i][k]),
+                        _mm256_loadu_ps(&m2.means[j][k]));
+
+                __m256 ratios = _mm256_sub_ps(_mm256_add_ps(
+                            _mm256_mul_ps(v1, r2), _mm256_mul_ps(v2, r1)),
+                        two);
+                __m256 spread = _mm256_mul_ps(_mm256_mul_ps(d, d),
+                        _mm256_add_ps(r1, r2));
+                total = _mm256_add_ps(total, _mm256_add_ps(ratios, spread));
+            }
+
+            float lanes[8];
+            _mm256_storeu_ps(lanes, total);
+            cost[i][j] = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]))
+                + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+        }
+}
+
+#endif  // KL_X86
+
+static const KLKernel *find_kernels()
+{
+    static KLKernel kernels[4];
+    int n = 0;
+
+#ifdef KL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+    {
+        kernels[n].name = "avx";
+        kernels[n++].costs = kl_costs_avx;
+    }
+    if (__builtin_cpu_supports("sse"))
+    {
+        kernels[n].name = "sse";
+        kernels[n++].costs = kl_costs_sse;
+    }
+#endif
+
+    kernels[n].name = "scalar";
+    kernels[n++].costs = kl_costs_scalar;
+    kernels[n].name = 0;
+    kernels[n].costs = 0;
+
+    return kernels;
+}
+
+// picked once, before main() - and so before there are any threads
+static const KLKernel *kernels = find_kernels();
+static const KLCostFunc best = kernels[0].costs;
+
+void kl_costs(const PackedMixtureModel &m1, const PackedMixtureModel &m2,
+        float cost[NUMGAUSS][NUMGAUSS])
+{
+    best(m1, m2, cost);
+}
+
+const KLKernel *kl_kernels()
+{
+    return kernels;
+}
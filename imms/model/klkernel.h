@@ -0,0 +1,64 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#ifndef __KLKERNEL_H
+#define __KLKERNEL_H
+
+#include <analyzer/mfcckeeper.h>
+
+// Gaussian::NumDimensions rounded up to a whole number of AVX vectors
+#define KL_DIMS         48
+
+// A MixtureModel laid out for computing KL divergences in bulk: one
+// array per field instead of one struct per gaussian, with the variances
+// already clamped, their reciprocals precomputed, and every row padded
+// to KL_DIMS with a dimension that contributes nothing.
+//
+// Every row is a whole number of vectors, so the rows of an aligned
+// model are aligned too. The kernels don't count on it, though: the
+// allocator behind a std::vector of these only promises 8 or 16 bytes.
+struct PackedMixtureModel
+{
+    PackedMixtureModel() {}
+    explicit PackedMixtureModel(const MixtureModel &mm) { pack(mm); }
+    void pack(const MixtureModel &mm);
+
+    float means[NUMGAUSS][KL_DIMS];
+    float vars[NUMGAUSS][KL_DIMS];
+    float rvars[NUMGAUSS][KL_DIMS];
+    float weights[NUMGAUSS];
+};
+
+typedef void (*KLCostFunc)(const PackedMixtureModel &m1,
+        const PackedMixtureModel &m2, float cost[NUMGAUSS][NUMGAUSS]);
+
+struct KLKernel
+{
+    const char *name;
+    KLCostFunc costs;
+};
+
+// cost[i][j] = KL_Divergence(m1.gauss[i], m2.gauss[j]), using the best
+// kernel this CPU can run.
+void kl_costs(const PackedMixtureModel &m1, const PackedMixtureModel &m2,
+        float cost[NUMGAUSS][NUMGAUSS]);
+
+// All the kernels this CPU can run, best first, ending with a null name.
+const KLKernel *kl_kernels();
+
+#endif
@@ -41,6 +41,7 @@
 #include "song.h"
 #include "immsutil.h"
 #include "distance.h"
+#include "svm.h"
 
 using std::endl;
 using std::cout;
@@ -48,18 +49,68 @@ using std::cerr;
 using std::vector;
 using std::auto_ptr;
 
-#ifdef WITH_TORCH
-
-using namespace Torch;
-
 static const int num_inputs = NUM_FEATURES;
-static const int num_hidden = 25;
-static const int num_outputs = 2;
 static const int stdv = 12;
 
 extern char _binary____data_svm_similarity_start;
 extern char _binary____data_svm_similarity_end;
 
+SVMMachine *load_similarity_svm()
+{
+    auto_ptr<SVMMachine> machine(new SVMMachine(1./(stdv*stdv)));
+
+    string filename = get_imms_root("svm-similarity");
+    if (file_exists(filename))
+    {
+        LOG(INFO) << "Overriding the built in model with " << filename;
+        machine->load(filename);
+    }
+    else
+    {
+        static const size_t data_size = &_binary____data_svm_similarity_end
+            - &_binary____data_svm_similarity_start;
+        machine->load(&_binary____data_svm_similarity_start, data_size);
+    }
+
+    if (machine->num_inputs() != num_inputs)
+        LOG(ERROR) << "warning: failed to load the similarity model" << endl;
+
+    return machine.release();
+}
+
+class SVMModel : public Model {
+public:
+    SVMModel() : machine(load_similarity_svm()) {}
+
+    float evaluate(float *features) {
+        if (machine->num_inputs() != num_inputs)
+            return 0;
+        return machine->evaluate(features) / 3;
+    }
+
+    void evaluate_batch(float *features, int rows, float *scores) {
+        if (machine->num_inputs() != num_inputs)
+        {
+            std::fill(scores, scores + rows, 0.0f);
+            return;
+        }
+        machine->evaluate_batch(features, rows, scores);
+        for (int i = 0; i < rows; ++i)
+            scores[i] /= 3;
+    }
+
+private:
+    auto_ptr<SVMMachine> machine;
+};
+
+SVMSimilarityModel::SVMSimilarityModel()
+    : SimilarityModel(new SVMModel()) 
+{ }
+
+#ifdef WITH_TORCH
+
+using namespace Torch;
+
 class XFileModeSetter {
 public:
     XFileModeSetter() { DiskXFile::setLittleEndianMode(); }
@@ -90,9 +141,11 @@ private:
     MeanVarNorm normalizer;
 };
 
-class SVMModel : public Model {
+// The Torch machine that SVMModel stands in for, kept around to check
+// the two against each other.
+class TorchSVMModel : public Model {
 public:
-    SVMModel()
+    TorchSVMModel()
         : kernel(1./(stdv*stdv)), svm(&kernel), normalizer(num_inputs)
     {
         auto_ptr<XFile> model;
@@ -123,6 +176,24 @@ public:
         svm.forward(&feat_seq);
         return svm.outputs->frames[0][0] / 3;
     }
+
+    void evaluate_batch(float *features, int rows, float *scores) {
+        // normalize all of the rows in one pass, in place...
+        Sequence batch(0, num_inputs);
+        for (int i = 0; i < rows; ++i)
+            batch.addFrame(features + i * num_inputs);
+        normalizer.normalize(&batch);
+
+        // ...and feed them through the machine one by one
+        Sequence row(0, num_inputs);
+        row.addFrame(batch.frames[0]);
+        for (int i = 0; i < rows; ++i)
+        {
+            row.frames[0] = batch.frames[i];
+            svm.forward(&row);
+            scores[i] = svm.outputs->frames[0][0] / 3;
+        }
+    }
      
 private:
     GaussianKernel kernel;
@@ -130,15 +201,18 @@ private:
     Normalizer normalizer;
 };
 
-SVMSimilarityModel::SVMSimilarityModel()
-    : SimilarityModel(new SVMModel()) 
+TorchSVMSimilarityModel::TorchSVMSimilarityModel()
+    : SimilarityModel(new TorchSVMModel())
 { }
 
-#else
-SVMSimilarityModel::SVMSimilarityModel()
-    : SimilarityModel(new DummyModel()) { }
 #endif  // WITH_TORCH
 
+void Model::evaluate_batch(float *features, int rows, float *scores)
+{
+    for (int i = 0; i < rows; ++i)
+        scores[i] = evaluate(features + i * NUM_FEATURES);
+}
+
 SimilarityModel::SimilarityModel(Model *model) : model(model)
 {
 }
@@ -147,8 +221,8 @@ SimilarityModel::~SimilarityModel()
 {
 }
 
-float SimilarityModel::evaluate(const MixtureModel &mm1, float *beats1,
-        const MixtureModel &mm2, float *beats2) {
+float SimilarityModel::evaluate(const MixtureModel &mm1, const float *beats1,
+        const MixtureModel &mm2, const float *beats2) {
     vector<float> features;
     extract_features(mm1, beats1, mm2, beats2, &features);
     float feat_array[NUM_FEATURES];
@@ -156,6 +230,29 @@ float SimilarityModel::evaluate(const MixtureModel &mm1, float *beats1,
     return evaluate(feat_array);
 }
 
+float SimilarityModel::evaluate(const PackedMixtureModel &mm1,
+        const float *beats1, const PackedMixtureModel &mm2,
+        const float *beats2) {
+    float features[NUM_FEATURES];
+    extract_features(mm1, beats1, mm2, beats2, features);
+    return evaluate(features);
+}
+
+void SimilarityModel::evaluate_batch(const AcousticSample &reference,
+        const AcousticSample *candidates, int n, float *scores)
+{
+    if (n <= 0)
+        return;
+
+    batch.resize(n * NUM_FEATURES);
+    for (int i = 0; i < n; ++i)
+        extract_features(reference.mm, reference.beats,
+                candidates[i].mm, candidates[i].beats,
+                &batch[i * NUM_FEATURES]);
+
+    model->evaluate_batch(&batch[0], n, scores);
+}
+
 float SimilarityModel::evaluate(float *features)
 {
     return model->evaluate(features);
@@ -173,48 +270,67 @@ float SimilarityModel::evaluate(const Song &s1, const Song &s2)
 
     return evaluate(mm1, b1, mm2, b2);
 }
-static float find_max(float a[BEATSSIZE])
+static float find_max(const float a[BEATSSIZE])
 {
     return *std::max_element(a, a + BEATSSIZE);
 }
 
-static float find_min(float a[BEATSSIZE])
+static float find_min(const float a[BEATSSIZE])
 {
     return *std::min_element(a, a + BEATSSIZE);
 }
 
-static void add_partitions(const MixtureModel &mm, vector<float> *f)
+static float *add_partitions(const PackedMixtureModel &mm, float *f)
 {
     static const int num_partitions = 3;
     float sums[num_partitions];
     for (int i = 0; i < num_partitions; ++i)
         sums[i] = 0;
     for (int i = 0; i < NUMGAUSS; ++i)
-    {
-        const Gaussian &g = mm.gauss[i];
         for (int j = 0; j < NUMCEPSTR; ++j)
-            sums[j / (NUMCEPSTR / num_partitions)] += g.weight * g.means[j];
-    }
+            sums[j / (NUMCEPSTR / num_partitions)] +=
+                mm.weights[i] * mm.means[i][j];
     for (int i = 0; i < num_partitions; ++i)
-        f->push_back(sums[i]);
+        *f++ = sums[i];
+    return f;
 } 
 
 
 void SimilarityModel::extract_features(
-        const MixtureModel &mm1, float *beats1,
-        const MixtureModel &mm2, float *beats2,
+        const MixtureModel &mm1, const float *beats1,
+        const MixtureModel &mm2, const float *beats2,
+        vector<float> *f)
+{
+    PackedMixtureModel p1(mm1), p2(mm2);
+    extract_features(p1, beats1, p2, beats2, f);
+}
+
+void SimilarityModel::extract_features(
+        const PackedMixtureModel &mm1, const float *beats1,
+        const PackedMixtureModel &mm2, const float *beats2,
         vector<float> *f)
 {
-    f->push_back(EMD::raw_distance(mm1, mm2));
-    f->push_back(EMD::raw_distance(beats1, beats2));
+    float features[NUM_FEATURES];
+    extract_features(mm1, beats1, mm2, beats2, features);
+    f->insert(f->end(), features, features + NUM_FEATURES);
+}
+
+void SimilarityModel::extract_features(
+        const PackedMixtureModel &mm1, const float *beats1,
+        const PackedMixtureModel &mm2, const float *beats2,
+        float *f)
+{
+    EMD::GaussSolver solver;
+    *f++ = EMD::raw_distance(mm1, mm2, solver);
+    *f++ = EMD::raw_distance(beats1, beats2);
 
-    add_partitions(mm1, f);
-    add_partitions(mm2, f);
+    f = add_partitions(mm1, f);
+    f = add_partitions(mm2, f);
 
-    f->push_back(find_max(beats1));
-    f->push_back(find_max(beats2));
+    *f++ = find_max(beats1);
+    *f++ = find_max(beats2);
 
-    f->push_back(find_min(beats1));
-    f->push_back(find_min(beats2));
+    *f++ = find_min(beats1);
+    *f++ = find_min(beats2);
 }
 
@@ -22,16 +22,32 @@
 #include <memory>
 #include <vector>
 
+#include "immsconf.h"
+
+#include <analyzer/beatkeeper.h>
+
+#include "klkernel.h"
+
 #define NUM_FEATURES 12
 
 class Song;
-class MixtureModel;
+class SVMMachine;
 
 class Model
 {
 public:
     virtual ~Model() {};
     virtual float evaluate(float *features) = 0;
+    // Scores rows of NUM_FEATURES features each, laid out one after
+    // another. The features may get overwritten.
+    virtual void evaluate_batch(float *features, int rows, float *scores);
+};
+
+// The acoustic data of a song, ready to be compared.
+struct AcousticSample
+{
+    PackedMixtureModel mm;
+    float beats[BEATSSIZE];
 };
 
 class DummyModel : public Model
@@ -46,17 +62,34 @@ public:
     SimilarityModel(Model *model);
     ~SimilarityModel();
     float evaluate(const Song &s1, const Song &s2);
-    float evaluate(const MixtureModel &mm1, float *beats1,
-                   const MixtureModel &mm2, float *beats2);
+    float evaluate(const MixtureModel &mm1, const float *beats1,
+                   const MixtureModel &mm2, const float *beats2);
+    float evaluate(const PackedMixtureModel &mm1, const float *beats1,
+                   const PackedMixtureModel &mm2, const float *beats2);
 
     float evaluate(float *features);
 
+    // scores[i] = evaluate(reference, candidates[i]), for all of them
+    // in one go.
+    void evaluate_batch(const AcousticSample &reference,
+            const AcousticSample *candidates, int n, float *scores);
+
     static void extract_features(
-            const MixtureModel &mm1, float *beats1,
-            const MixtureModel &mm2, float *beats2,
+            const MixtureModel &mm1, const float *beats1,
+            const MixtureModel &mm2, const float *beats2,
             std::vector<float> *features);
+    static void extract_features(
+            const PackedMixtureModel &mm1, const float *beats1,
+            const PackedMixtureModel &mm2, const float *beats2,
+            std::vector<float> *features);
+    // Writes NUM_FEATURES features.
+    static void extract_features(
+            const PackedMixtureModel &mm1, const float *beats1,
+            const PackedMixtureModel &mm2, const float *beats2,
+            float *features);
 private:
     std::auto_ptr<Model> model;
+    std::vector<float> batch;
 };
 
 class SVMSimilarityModel : public SimilarityModel {
@@ -64,4 +97,15 @@ public:
     SVMSimilarityModel();
 };
 
+// The machine behind SVMSimilarityModel: the built in one, or the one
+// in IMMSROOT if there is one. Its output is three times the score.
+SVMMachine *load_similarity_svm();
+
+#ifdef WITH_TORCH
+class TorchSVMSimilarityModel : public SimilarityModel {
+public:
+    TorchSVMSimilarityModel();
+};
+#endif
+
 #endif
@@ -0,0 +1,334 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+#include "pairwise.h"
+#include "model.h"
+#include "song.h"
+#include "immsutil.h"
+#include "sqlite++.h"
+
+using std::vector;
+using std::endl;
+
+// Rows handed to a worker at a time, and results written per transaction.
+#define BLOCK_ROWS          16
+#define COMMIT_BATCH        10000
+
+// Don't bother with distance < 0.3.
+// This way we only get a list of strongly correlated songs.
+#define MIN_DISTANCE        30
+
+// The checkpoint is the A.Acoustic rowid of the last song done, along
+// with how many songs there were up to it. Every analysis gets a new
+// rowid, so songs analyzed since always come after it; if the count no
+// longer matches, songs were purged and a rowid may have been reused.
+static bool read_checkpoint(long &rowid, int &count)
+{
+    std::ifstream in(get_imms_root("distances.checkpoint").c_str());
+    in >> rowid >> count;
+    return !in.fail();
+}
+
+static void write_checkpoint(long rowid, int count)
+{
+    string filename = get_imms_root("distances.checkpoint");
+    string tmpname = filename + ".tmp";
+    {
+        std::ofstream out(tmpname.c_str());
+        out << rowid << " " << count << endl;
+    }
+    rename(tmpname.c_str(), filename.c_str());
+}
+
+struct DistanceWorker
+{
+    DistanceWorker() : pid(-1), in(-1), out(-1), block(-1) {}
+    pid_t pid;
+    int in, out, block;
+    vector<char> buffer;
+};
+
+// Hand out the next block, or tell the worker to go away.
+static void assign(DistanceWorker &worker, int &next, int total, int &busy)
+{
+    if (next < total && write_all(worker.out, &next, sizeof(next)))
+    {
+        worker.block = next;
+        next += BLOCK_ROWS;
+        ++busy;
+        return;
+    }
+
+    close(worker.out);
+    worker.out = -1;
+}
+
+PairwiseDistances::PairwiseDistances(int jobs) : jobs(std::max(jobs, 1))
+{
+}
+
+void PairwiseDistances::load()
+{
+    Q q("SELECT rowid, uid, mfcc, bpm FROM A.Acoustic "
+            "WHERE mfcc NOTNULL AND bpm NOTNULL ORDER BY rowid;");
+    AcousticView view;
+
+    while (q.next())
+    {
+        long rowid;
+        int uid;
+        q >> rowid >> uid;
+        if (!view.load(q))
+            continue;
+
+        rowids.push_back(rowid);
+        uids.push_back(uid);
+        models.push_back(PackedMixtureModel(*view.mm));
+        beats.insert(beats.end(), view.beats, view.beats + BEATSSIZE);
+    }
+}
+
+// Runs in the worker: reads the index of the first row of a block,
+// writes back the strong matches of every song in it followed by
+// a Result with x = -1 to say that the block is done.
+void PairwiseDistances::work(int in, int out)
+{
+    SVMSimilarityModel model;
+    vector<Result> results;
+
+    int start;
+    while (read_all(in, &start, sizeof(start)))
+    {
+        int end = std::min(start + BLOCK_ROWS, (int)uids.size());
+        for (int j = start; j < end; ++j)
+        {
+            for (int i = 0; i < j; ++i)
+            {
+                int dist = ROUND(model.evaluate(models[i], &beats[i * BEATSSIZE],
+                            models[j], &beats[j * BEATSSIZE]) * 100);
+                if (dist < MIN_DISTANCE)
+                    continue;
+
+                Result r = { std::min(uids[i], uids[j]),
+                    std::max(uids[i], uids[j]), dist };
+                results.push_back(r);
+            }
+        }
+
+        Result r = { -1, start, 0 };
+        results.push_back(r);
+
+        if (!write_all(out, &results[0], results.size() * sizeof(Result)))
+            return;
+        results.clear();
+    }
+}
+
+// Writes out the results so far, then moves the checkpoint up to the
+// song that everything has been done for.
+void PairwiseDistances::commit(vector<Result> &results, int done)
+{
+    AutoTransaction at(true);
+    Q q("INSERT OR REPLACE INTO A.Distances ('x', 'y', 'dist') "
+            "VALUES (?, ?, ?);");
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        q << results[i].x << results[i].y << results[i].dist;
+        q.execute();
+    }
+    at.commit();
+
+    results.clear();
+    if (done >= 0)
+        write_checkpoint(rowids[done], done + 1);
+}
+
+bool PairwiseDistances::run()
+{
+    try {
+        load();
+    }
+    WARNIFFAILED();
+
+    // everything up to and including the checkpoint has been done
+    long checkpoint;
+    int count, first = 0, total = uids.size();
+    if (read_checkpoint(checkpoint, count))
+    {
+        first = std::upper_bound(rowids.begin(), rowids.end(), checkpoint)
+            - rowids.begin();
+        if (first != count)
+        {
+            LOG(INFO) << "songs were removed since the last run, "
+                "starting over" << endl;
+            first = 0;
+        }
+    }
+
+    LOG(INFO) << total << " songs, " << total - first << " left to do, "
+        << jobs << " jobs" << endl;
+
+    if (first == total)
+        return true;
+
+    // whatever is there for the songs left to do is from an older
+    // analysis, or from a run that did not get to commit them
+    try {
+        AutoTransaction at(true);
+        Q("DELETE FROM A.Distances WHERE x IN "
+                "(SELECT uid FROM A.Acoustic WHERE rowid > ?) OR y IN "
+                "(SELECT uid FROM A.Acoustic WHERE rowid > ?);")
+            << rowids[first] - 1 << rowids[first] - 1 << execute;
+        at.commit();
+    }
+    WARNIFFAILED();
+
+    // a worker that died should not take us with it
+    signal(SIGPIPE, SIG_IGN);
+
+    vector<DistanceWorker> workers(jobs);
+    for (int w = 0; w < jobs; ++w)
+    {
+        workers[w].pid = start_worker(workers[w].out, workers[w].in);
+        if (workers[w].pid >= 0)
+            continue;
+        LOG(ERROR) << "Could not start worker: " << strerror(errno) << endl;
+        if (!w)
+            return false;
+        workers.resize(w);
+        break;
+    }
+
+    int next = first, done = first, busy = 0;
+    vector<bool> finished;
+    vector<Result> results;
+
+    for (size_t w = 0; w < workers.size(); ++w)
+        assign(workers[w], next, total, busy);
+
+    while (busy)
+    {
+        vector<struct pollfd> fds;
+        vector<int> index;
+        for (size_t w = 0; w < workers.size(); ++w)
+        {
+            if (workers[w].block < 0)
+                continue;
+            struct pollfd pfd = { workers[w].in, POLLIN, 0 };
+            fds.push_back(pfd);
+            index.push_back(w);
+        }
+
+        if (poll(&fds[0], fds.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (size_t f = 0; f < fds.size(); ++f)
+        {
+            if (!fds[f].revents)
+                continue;
+
+            DistanceWorker &worker = workers[index[f]];
+
+            char buf[64 * 1024];
+            ssize_t r = read(worker.in, buf, sizeof(buf));
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+            {
+                LOG(ERROR) << "worker " << worker.pid << " died" << endl;
+                worker.block = -1;
+                --busy;
+                continue;
+            }
+
+            worker.buffer.insert(worker.buffer.end(), buf, buf + r);
+
+            size_t complete = worker.buffer.size() / sizeof(Result);
+            const Result *received = (const Result *)&worker.buffer[0];
+            for (size_t i = 0; i < complete; ++i)
+            {
+                if (received[i].x >= 0)
+                {
+                    results.push_back(received[i]);
+                    continue;
+                }
+
+                int block = (received[i].y - first) / BLOCK_ROWS;
+                if (block >= (int)finished.size())
+                    finished.resize(block + 1, false);
+                finished[block] = true;
+
+                worker.block = -1;
+                --busy;
+                assign(worker, next, total, busy);
+            }
+            worker.buffer.erase(worker.buffer.begin(),
+                    worker.buffer.begin() + complete * sizeof(Result));
+        }
+
+        // the checkpoint can only move past blocks that are all done
+        int before = done;
+        while (done < total && (done - first) / BLOCK_ROWS
+                < (int)finished.size() && finished[(done - first) / BLOCK_ROWS])
+            done = std::min(done + BLOCK_ROWS, total);
+
+        if (results.size() < COMMIT_BATCH && done == before)
+            continue;
+
+        try {
+            commit(results, done > first ? done - 1 : -1);
+        }
+        WARNIFFAILED();
+
+        if (done != before)
+            LOG(INFO) << done << " of " << total << " songs done" << endl;
+    }
+
+    for (size_t w = 0; w < workers.size(); ++w)
+    {
+        if (workers[w].out >= 0)
+            close(workers[w].out);
+        close(workers[w].in);
+        waitpid(workers[w].pid, 0, 0);
+    }
+
+    try {
+        commit(results, done > first ? done - 1 : -1);
+    }
+    WARNIFFAILED();
+
+    return done == total;
+}
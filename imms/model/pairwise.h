@@ -0,0 +1,69 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#ifndef __PAIRWISE_H
+#define __PAIRWISE_H
+
+#include <vector>
+
+#include <analyzer/mfcckeeper.h>
+#include <analyzer/beatkeeper.h>
+
+#include "klkernel.h"
+#include "immsutil.h"
+
+// Fills in A.Distances for every pair of analyzed songs.
+//
+// The acoustic data of all songs is read once, in the order they were
+// analyzed, into flat arrays. Songs are then handed out a few rows at a
+// time to worker processes, which compare each one against every song
+// analyzed before it and report the strong matches back. Neither EMD nor the SVM can be
+// shared between threads, but forked workers get their own copies of
+// those for free and share the read only acoustic data copy-on-write.
+//
+// Results are written in batches. Once every pair up to some song is in
+// the database its place in that order is saved as a checkpoint, so an
+// interrupted run picks up where it left off and a later run only has
+// to deal with songs analyzed (or analyzed again) since.
+class PairwiseDistances : public WorkerPool
+{
+public:
+    PairwiseDistances(int jobs);
+
+    // Returns false if it did not get through all of the songs.
+    bool run();
+
+private:
+    struct Result
+    {
+        int x, y, dist;
+    };
+
+    void load();
+    void work(int in, int out);
+    void commit(std::vector<Result> &results, int done);
+
+    int jobs;
+
+    std::vector<long> rowids;
+    std::vector<int> uids;
+    std::vector<PackedMixtureModel> models;
+    std::vector<float> beats;
+};
+
+#endif
@@ -0,0 +1,322 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <math.h>
+#include <string.h>
+
+#include "svm.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SVM_X86
+#include <immintrin.h>
+#endif
+
+using std::string;
+using std::ifstream;
+using std::ostringstream;
+
+// The positive and the negative halves of the sum each come to around
+// 2e5 for the built in model, for a result of a few units, so every
+// rounding along the way shows in the result. To give the same scores as
+// Torch, the kernels work out the same float exponents its GaussianKernel
+// does, and sum() takes the same expf() of them and adds them up in the
+// same order, in floats. Only the distances are done in parallel: a
+// vector exp() differs from libm's often enough to move the result.
+
+// Support vectors get compared to the input this many at a time
+#define SVM_BLOCK       8
+// Models with more inputs than this are refused
+#define SVM_MAX_INPUTS  64
+
+// Torch's XFiles are a series of tagged blocks:
+//      int taglen, char tag[taglen], int size, int n, data[size * n]
+// all of it little endian, which is what IMMS always writes them as.
+// Everything we need is made of 4 byte ints and floats.
+class XFileReader
+{
+public:
+    XFileReader(const char *data, size_t size)
+        : data(data), end(data + size), ok(true) {}
+
+    bool good() const { return ok; }
+
+    // Starts reading the block called tag, and returns how many values
+    // are in it.
+    int open(const char *tag)
+    {
+        size_t len = strlen(tag);
+        if (!take(4) || decode(data - 4) != (int)len || !take(len)
+                || memcmp(data - len, tag, len) || !take(8)
+                || decode(data - 8) != 4 || decode(data - 4) < 0)
+        {
+            ok = false;
+            return 0;
+        }
+        return decode(data - 4);
+    }
+
+    int read_int()
+    {
+        return take(4) ? decode(data - 4) : 0;
+    }
+    void read(float *values, int n)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            int bits = read_int();
+            memcpy(&values[i], &bits, sizeof(float));
+        }
+    }
+
+    int read_int(const char *tag)
+    {
+        if (open(tag) != 1)
+            ok = false;
+        return read_int();
+    }
+    void read(const char *tag, float *values, int n)
+    {
+        if (open(tag) != n)
+            ok = false;
+        read(values, n);
+    }
+
+private:
+    static int decode(const char *p)
+    {
+        const unsigned char *u = (const unsigned char *)p;
+        return (int)(u[0] | (u[1] << 8) | (u[2] << 16)
+                | ((unsigned)u[3] << 24));
+    }
+    bool take(size_t n)
+    {
+        if (!ok || (size_t)(end - data) < n)
+            return ok = false;
+        data += n;
+        return true;
+    }
+
+    const char *data, *end;
+    bool ok;
+};
+
+bool SVMMachine::load(const string &filename)
+{
+    ifstream in(filename.c_str(), std::ios::binary);
+    ostringstream contents;
+    contents << in.rdbuf();
+    string s = contents.str();
+    return load(s.data(), s.size());
+}
+
+bool SVMMachine::load(const char *data, size_t size)
+{
+    if (parse(data, size))
+        return true;
+
+    bias = 0;
+    inputs = svs = count = 0;
+    means.clear();
+    stdvs.clear();
+    vectors.clear();
+    alphas.clear();
+    return false;
+}
+
+bool SVMMachine::parse(const char *data, size_t size)
+{
+    XFileReader file(data, size);
+
+    // MeanVarNorm, without targets
+    inputs = file.open("IMEANS");
+    if (inputs <= 0 || inputs > SVM_MAX_INPUTS)
+        return false;
+    means.resize(inputs);
+    stdvs.resize(inputs);
+    file.read(&means[0], inputs);
+    file.read("ISTDVS", &stdvs[0], inputs);
+
+    // SVMClassification...
+    file.read("b", &bias, 1);
+    svs = file.read_int("NSV");
+    file.read_int("NSVB");
+    if (!file.good() || svs <= 0)
+        return false;
+
+    count = (svs + SVM_BLOCK - 1) / SVM_BLOCK * SVM_BLOCK;
+    alphas.assign(count, 0);
+    vectors.assign(inputs * count, 0);
+    file.read("SVALPHA", &alphas[0], svs);
+
+    // ...and its support vectors, one single frame sequence each
+    if (file.read_int("NTF") != svs || file.read_int("FS") != inputs)
+        return false;
+
+    std::vector<float> frame(inputs);
+    for (int i = 0; i < svs && file.good(); ++i)
+    {
+        if (file.read_int("NF") != 1)
+            return false;
+        file.read("FRAME", &frame[0], inputs);
+        for (int k = 0; k < inputs; ++k)
+            vectors[k * count + i] = frame[k];
+    }
+
+    return file.good();
+}
+
+static void svm_kernel_scalar(const float *vectors, int count,
+        const float *x, int inputs, float gamma, float *values)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        float dist = 0;
+        for (int k = 0; k < inputs; ++k)
+        {
+            float d = vectors[k * count + i] - x[k];
+            dist += d * d;
+        }
+        values[i] = -gamma * dist;
+    }
+}
+
+#ifdef SVM_X86
+
+__attribute__((target("sse2")))
+static void svm_kernel_sse2(const float *vectors, int count,
+        const float *x, int inputs, float gamma, float *values)
+{
+    const __m128 ngamma = _mm_set1_ps(-gamma);
+
+    for (int i = 0; i < count; i += 4)
+    {
+        __m128 dist = _mm_setzero_ps();
+        for (int k = 0; k < inputs; ++k)
+        {
+            __m128 d = _mm_sub_ps(_mm_loadu_ps(&vectors[k * count + i]),
+                    _mm_set1_ps(x[k]));
+            dist = _mm_add_ps(dist, _mm_mul_ps(d, d));
+        }
+        _mm_storeu_ps(&values[i], _mm_mul_ps(ngamma, dist));
+    }
+}
+
+__attribute__((target("avx2")))
+static void svm_kernel_avx2(const float *vectors, int count,
+        const float *x, int inputs, float gamma, float *values)
+{
+    const __m256 ngamma = _mm256_set1_ps(-gamma);
+
+    for (int i = 0; i < count; i += 8)
+    {
+        __m256 dist = _mm256_setzero_ps();
+        for (int k = 0; k < inputs; ++k)
+        {
+            __m256 d = _mm256_sub_ps(
+                    _mm256_loadu_ps(&vectors[k * count + i]),
+                    _mm256_set1_ps(x[k]));
+            dist = _mm256_add_ps(dist, _mm256_mul_ps(d, d));
+        }
+        _mm256_storeu_ps(&values[i], _mm256_mul_ps(ngamma, dist));
+    }
+}
+
+#endif  // SVM_X86
+
+static const SVMKernel *find_kernels()
+{
+    static SVMKernel kernels[4];
+    int n = 0;
+
+#ifdef SVM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kernels[n].name = "avx2";
+        kernels[n++].eval = svm_kernel_avx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        kernels[n].name = "sse2";
+        kernels[n++].eval = svm_kernel_sse2;
+    }
+#endif
+
+    kernels[n].name = "scalar";
+    kernels[n++].eval = svm_kernel_scalar;
+    kernels[n].name = 0;
+    kernels[n].eval = 0;
+
+    return kernels;
+}
+
+// picked once, before main() - and so before there are any threads
+static const SVMKernel *kernels = find_kernels();
+static const SVMKernelFunc best = kernels[0].eval;
+
+const SVMKernel *svm_kernels()
+{
+    return kernels;
+}
+
+float SVMMachine::evaluate(const float *features, SVMKernelFunc kernel) const
+{
+    float output;
+    evaluate_batch(features, 1, &output, kernel);
+    return output;
+}
+
+void SVMMachine::evaluate_batch(const float *features, int rows,
+        float *outputs, SVMKernelFunc kernel) const
+{
+    if (!inputs)
+    {
+        std::fill(outputs, outputs + rows, 0.0f);
+        return;
+    }
+    if (rows <= 0)
+        return;
+
+    std::vector<float> x(rows * inputs);
+    for (int i = 0; i < rows; ++i)
+        for (int k = 0; k < inputs; ++k)
+            x[i * inputs + k] = (features[i * inputs + k] - means[k])
+                / stdvs[k];
+
+    if (!kernel)
+        kernel = best;
+    std::vector<float> values(count);
+    for (int i = 0; i < rows; ++i)
+    {
+        kernel(&vectors[0], count, &x[i * inputs], inputs, gamma,
+                &values[0]);
+        outputs[i] = sum(values);
+    }
+}
+
+float SVMMachine::sum(const std::vector<float> &values) const
+{
+    float total = 0;
+    for (int i = 0; i < svs; ++i)
+        total += alphas[i] * expf(values[i]);
+    return total + bias;
+}
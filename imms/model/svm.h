@@ -0,0 +1,90 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#ifndef __SVM_H
+#define __SVM_H
+
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+
+// values[i] = -gamma * |x - sv[i]|^2 for count vectors, the exponents of
+// the Gaussian kernel
+typedef void (*SVMKernelFunc)(const float *vectors, int count,
+        const float *x, int inputs, float gamma, float *values);
+
+struct SVMKernel
+{
+    const char *name;
+    SVMKernelFunc eval;
+};
+
+// Evaluation only version of a Gaussian kernel SVMClassification
+// together with the MeanVarNorm in front of it, loaded from the files
+// that Torch saves them to:
+//
+//      f(x) = b + sum(alpha[i] * exp(-gamma * |norm(x) - sv[i]|^2))
+//
+// The support vectors are kept one dimension after another, each padded
+// to a whole number of blocks with vectors whose alpha is 0, so that a
+// block of them can be compared to the input at once.
+class SVMMachine
+{
+public:
+    SVMMachine(float gamma)
+        : gamma(gamma), bias(0), inputs(0), svs(0), count(0) {}
+
+    // Both return false, and leave the machine empty, if the data does
+    // not look like the normalizer followed by the SVM.
+    bool load(const char *data, size_t size);
+    bool load(const std::string &filename);
+
+    bool is_loaded() const { return inputs > 0; }
+    int num_inputs() const { return inputs; }
+    int num_support_vectors() const { return svs; }
+    // what the normalizer expects of the inputs
+    const std::vector<float> &get_means() const { return means; }
+    const std::vector<float> &get_stdvs() const { return stdvs; }
+
+    // The raw output of the SVM for num_inputs() features, with the
+    // best kernel for this CPU unless told otherwise.
+    float evaluate(const float *features, SVMKernelFunc kernel = 0) const;
+    // The same for rows of num_inputs() features laid out one after
+    // another: normalized all in one pass, then scored one by one
+    // with the same buffers.
+    void evaluate_batch(const float *features, int rows, float *outputs,
+            SVMKernelFunc kernel = 0) const;
+
+private:
+    bool parse(const char *data, size_t size);
+    // b + sum(alpha[i] * exp(values[i])), the way Torch adds it up
+    float sum(const std::vector<float> &values) const;
+
+    float gamma, bias;
+    int inputs, svs, count;
+
+    std::vector<float> means, stdvs;
+    // vectors[k * count + i] is the kth dimension of the ith vector
+    std::vector<float> vectors, alphas;
+};
+
+// All the kernels this CPU can run, best first, ending with a null name.
+const SVMKernel *svm_kernels();
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <immsutil.h>
+#include <analyzer/beatkeeper.h>
+
+using std::cout;
+using std::endl;
+using std::vector;
+
+const string AppName = "bench_beats";
+
+// Difference allowed from the plain double loop, relative to the
+// biggest bin. process_window() keeps the order of the sums, so this
+// should really come out as 0.
+#define TOLERANCE       1e-6
+// The bin of the click period has to get at least this much of the
+// biggest one - multiples of the period do just as well.
+#define MIN_PEAK        0.9
+// About as many windows as there are in a song.
+#define WINDOWS         200
+
+static const int bpms[] = { 60, 92, 120, 145, 180, 0 };
+
+// process_window() as it used to be: the windows taking turns in the
+// two halves of the buffer, and a branch for every term.
+static void reference_beats(const vector<float> &power, float *beats)
+{
+    float data[2*MAXBEATLENGTH];
+    memset(data, 0, sizeof(data));
+    memset(beats, 0, sizeof(float) * BEATSSIZE);
+
+    float *current_window = data, *last_window = &data[MAXBEATLENGTH];
+    float *current_position = current_window;
+
+    for (size_t n = 0; n < power.size(); ++n)
+    {
+        *current_position++ = power[n];
+        if (current_position - current_window != MAXBEATLENGTH)
+            continue;
+
+        for (int i = 0; i < MAXBEATLENGTH; ++i)
+        {
+            for (int offset = MINBEATLENGTH; offset < MAXBEATLENGTH; ++offset)
+            {
+                int p = i + offset;
+                float warped = *(p < MAXBEATLENGTH ?
+                        last_window + p : current_window + p - MAXBEATLENGTH);
+                beats[offset - MINBEATLENGTH] += last_window[i] * warped;
+            }
+        }
+
+        float *tmp = current_window;
+        current_window = current_position = last_window;
+        last_window = tmp;
+    }
+}
+
+// Energy of the low mel bands for a click track with a bit of noise,
+// in the units BeatManager takes.
+static vector<double> click_track(int period, int frames)
+{
+    vector<double> lows;
+    for (int i = 0; i < frames; ++i)
+    {
+        double energy = imms_random(1000) / 10000.0;
+        if (i % period == 0)
+            energy += 1;
+        else if (i % period == 1)
+            energy += 0.5;
+        lows.push_back(energy * 1e11);
+    }
+    return lows;
+}
+
+static uint64_t since(struct timeval &start)
+{
+    struct timeval now;
+    gettimeofday(&now, 0);
+    return usec_diff(start, now);
+}
+
+// Checks BeatManager against the old auto-correlation on click tracks
+// of a few tempos, and times both per window.
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 20;
+    if (rounds < 1)
+    {
+        cout << "usage: bench_beats [rounds]" << endl;
+        return -1;
+    }
+
+    int frames = WINDOWS * MAXBEATLENGTH, failures = 0;
+    uint64_t reference_usecs = 0, usecs = 0;
+
+    for (const int *bpm = bpms; *bpm; ++bpm)
+    {
+        int period = ROUND(WINPERSEC * 60 / (float)*bpm);
+        vector<double> lows = click_track(period, frames);
+
+        // exactly what BeatManager hands to BeatKeeper
+        vector<float> power(frames);
+        vector<double> melfreqs(2, 0);
+        for (int i = 0; i < frames; ++i)
+            power[i] = lows[i] / 1e11;
+
+        float reference[BEATSSIZE];
+        struct timeval start;
+        gettimeofday(&start, 0);
+        for (int r = 0; r < rounds; ++r)
+            reference_beats(power, reference);
+        reference_usecs += since(start);
+
+        float beats[BEATSSIZE];
+        gettimeofday(&start, 0);
+        for (int r = 0; r < rounds; ++r)
+        {
+            BeatManager manager;
+            for (int i = 0; i < frames; ++i)
+            {
+                melfreqs[0] = lows[i];
+                manager.process(melfreqs);
+            }
+            memcpy(beats, manager.get_result(), sizeof(beats));
+        }
+        usecs += since(start);
+
+        float top = *std::max_element(reference, reference + BEATSSIZE);
+        double worst = 0;
+        for (int i = 0; i < BEATSSIZE; ++i)
+            worst = std::max(worst, fabs((double)beats[i] - reference[i]) / top);
+
+        float peak = beats[period - MINBEATLENGTH] / top;
+
+        bool ok = worst <= TOLERANCE && peak >= MIN_PEAK;
+        failures += !ok;
+
+        cout << *bpm << " bpm: difference " << worst << ", peak at "
+            << OFFSET2BPM(period - MINBEATLENGTH) << " bpm " << peak
+            << (ok ? "" : "  FAILED") << endl;
+    }
+
+    int windows = rounds * (sizeof(bpms) / sizeof(*bpms) - 1) * WINDOWS;
+    cout << "per window: " << reference_usecs * 1000 / windows
+        << " nsecs before, " << usecs * 1000 / windows << " nsecs now" << endl;
+
+    return failures ? 1 : 0;
+}
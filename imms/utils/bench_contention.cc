@@ -0,0 +1,201 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <immsdb.h>
+#include <immsutil.h>
+#include <analyzer/mfcckeeper.h>
+#include <analyzer/beatkeeper.h>
+
+using std::string;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+const string AppName = "bench_contention";
+
+#define SONGS           5000
+#define WRITE_BATCH     20
+#define PICK_SIZE       100
+
+static char mfcc[MFCCKeeper::ResultSize];
+static float beats[BEATSSIZE];
+
+static void populate(bool rollback)
+{
+    ImmsDb immsdb;
+
+    AutoTransaction a;
+    for (int uid = 0; uid < SONGS; ++uid)
+    {
+        Q("INSERT INTO Library ('uid', 'sid') VALUES (?, ?);")
+            << uid << uid << execute;
+        Q("INSERT INTO Ratings ('uid', 'rating', 'dev') VALUES (?, ?, 0);")
+            << uid << imms_random(100) << execute;
+        Q("INSERT INTO Last ('sid', 'last') VALUES (?, ?);")
+            << uid << time(0) - imms_random(DAY) << execute;
+    }
+    a.commit();
+
+    if (rollback)
+    {
+        Q("PRAGMA journal_mode = DELETE;").execute();
+        Q("PRAGMA C.journal_mode = DELETE;").execute();
+        Q("PRAGMA A.journal_mode = DELETE;").execute();
+    }
+}
+
+// Writes acoustic data in small transactions, like the analyzer does.
+static int writer(time_t until)
+{
+    SQLDatabaseConnection dbcon(get_imms_root("imms2.db"));
+    AttachedDatabase acoustic(get_imms_root("imms.acoustic.db"), "A");
+
+    int commits = 0;
+    while (time(0) < until)
+    {
+        try {
+            AutoTransaction a;
+            for (int i = 0; i < WRITE_BATCH; ++i)
+            {
+                Q q("INSERT OR REPLACE INTO A.Acoustic "
+                        "('uid', 'mfcc', 'bpm') VALUES (?, ?, ?);");
+                q << imms_random(SONGS);
+                q.bind(mfcc, sizeof(mfcc));
+                q.bind(beats, sizeof(beats));
+                q.execute();
+            }
+            a.commit();
+            ++commits;
+        }
+        WARNIFFAILED();
+    }
+    return commits;
+}
+
+// Looks up ratings, last played times and acoustic data of a batch of
+// random candidates, like the picker does, and times every batch.
+static void reader(time_t until)
+{
+    SQLDatabaseConnection dbcon(get_imms_root("imms2.db"));
+    AttachedDatabase acoustic(get_imms_root("imms.acoustic.db"), "A");
+
+    int picks = 0;
+    uint64_t total = 0, worst = 0;
+    while (time(0) < until)
+    {
+        struct timeval start, end;
+        gettimeofday(&start, 0);
+
+        try {
+            for (int i = 0; i < PICK_SIZE; ++i)
+            {
+                int uid = imms_random(SONGS), rating = 0;
+                time_t last = 0;
+
+                Q r("SELECT rating FROM Ratings WHERE uid = ?;");
+                r << uid;
+                if (r.next())
+                    r >> rating;
+
+                Q l("SELECT last FROM Last WHERE sid = ?;");
+                l << uid;
+                if (l.next())
+                    l >> last;
+
+                Q q("SELECT mfcc, bpm FROM A.Acoustic WHERE uid = ?;");
+                q << uid;
+                if (q.next())
+                {
+                    q.load(mfcc, sizeof(mfcc));
+                    q.load(beats, sizeof(beats));
+                }
+            }
+        }
+        WARNIFFAILED();
+
+        gettimeofday(&end, 0);
+        uint64_t usecs = usec_diff(start, end);
+        total += usecs;
+        worst = std::max(worst, usecs);
+        ++picks;
+    }
+
+    cout << picks << " picks of " << PICK_SIZE << " songs, "
+        << (picks ? total / picks : 0) << " usecs average, "
+        << worst << " usecs worst" << endl;
+}
+
+// Runs analyzer style writers against a picker style reader in a scratch
+// IMMSROOT. Pass "rollback" to compare against the old journal mode.
+int main(int argc, char *argv[])
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 10;
+    int writers = argc > 2 ? atoi(argv[2]) : 2;
+    bool rollback = argc > 3 && !strcmp(argv[3], "rollback");
+
+    if (seconds < 1 || writers < 0)
+    {
+        cout << "usage: bench_contention [seconds] [writers] [rollback]"
+            << endl;
+        return -1;
+    }
+
+    char root[] = "/tmp/imms-bench-XXXXXX";
+    if (!mkdtemp(root))
+        return -2;
+    setenv("IMMSROOT", root, 1);
+
+    populate(rollback);
+
+    cout << "journal mode: " << (rollback ? "rollback" : "wal") << ", "
+        << writers << " writers, " << seconds << " seconds" << endl;
+
+    time_t until = time(0) + seconds;
+
+    for (int i = 0; i < writers; ++i)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            cerr << "fork failed" << endl;
+            return -3;
+        }
+        if (!pid)
+        {
+            int commits = writer(until);
+            cout << "writer " << i << ": " << commits << " commits" << endl;
+            _exit(0);
+        }
+    }
+
+    reader(until);
+
+    while (wait(0) > 0);
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <memory>
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include <immsconf.h>
+#include <immsutil.h>
+#include <analyzer/analyzer.h>
+#include <analyzer/decoder.h>
+
+using std::cout;
+using std::endl;
+using std::vector;
+using std::ofstream;
+using std::auto_ptr;
+
+const string AppName = "bench_decode";
+
+#define SECONDS         120
+#define WAV_RATE        44100
+#define WAV_CHANNELS    2
+// what the analyzer reads at a time
+#define CHUNK           READSIZE
+
+static void put(ofstream &out, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i, value >>= 8)
+        out.put((char)(value & 0xff));
+}
+
+// A couple of tones and some noise, as 16 bit stereo PCM.
+static void write_wav(const string &filename)
+{
+    ofstream out(filename.c_str(), std::ios::binary);
+
+    uint32_t frames = SECONDS * WAV_RATE, size = frames * WAV_CHANNELS * 2;
+    out << "RIFF";
+    put(out, 36 + size, 4);
+    out << "WAVEfmt ";
+    put(out, 16, 4);
+    put(out, 1, 2);
+    put(out, WAV_CHANNELS, 2);
+    put(out, WAV_RATE, 4);
+    put(out, WAV_RATE * WAV_CHANNELS * 2, 4);
+    put(out, WAV_CHANNELS * 2, 2);
+    put(out, 16, 2);
+    out << "data";
+    put(out, size, 4);
+
+    for (uint32_t i = 0; i < frames; ++i)
+    {
+        double t = i / (double)WAV_RATE;
+        for (int c = 0; c < WAV_CHANNELS; ++c)
+        {
+            double x = 0.3 * sin(2 * M_PI * 440 * (c + 1) * t)
+                + 0.2 * sin(2 * M_PI * 3000 * t)
+                + 0.1 * (imms_random(2000) / 1000.0 - 1);
+            put(out, (uint16_t)(int16_t)(x * 32767), 2);
+        }
+    }
+}
+
+static vector<float> decode(const char *name, AudioDecoder *decoder)
+{
+    vector<float> samples;
+    if (!decoder->isok())
+    {
+        cout << name << ": could not open" << endl;
+        return samples;
+    }
+
+    struct timeval start, end;
+    gettimeofday(&start, 0);
+
+    float chunk[CHUNK];
+    size_t r;
+    while ((r = decoder->read(chunk, CHUNK)))
+        samples.insert(samples.end(), chunk, chunk + r);
+
+    gettimeofday(&end, 0);
+    uint64_t usecs = std::max((uint64_t)1, usec_diff(start, end));
+
+    cout << name << ": " << samples.size() << " samples in "
+        << usecs / 1000 << " msecs, "
+        << (uint64_t)(samples.size() * 1e6 / usecs) << " samples/sec, "
+        << (uint64_t)(samples.size() / (double)SAMPLERATE * 1e6 / usecs)
+        << "x realtime" << endl;
+    return samples;
+}
+
+// Times decoding a file to what the analyzer takes with sox and, if
+// built with it, libsndfile - by default a generated WAV file.
+int main(int argc, char *argv[])
+{
+    string path;
+    if (argc > 1)
+        path = argv[1];
+    else
+    {
+        char root[] = "/tmp/imms-bench-XXXXXX";
+        if (!mkdtemp(root))
+            return -2;
+        path = string(root) + "/bench.wav";
+        write_wav(path);
+    }
+
+    vector<float> sox;
+    {
+        auto_ptr<AudioDecoder> decoder(new SoxDecoder(path, SAMPLERATE));
+        sox = decode("sox", decoder.get());
+    }
+
+#ifdef WITH_SNDFILE
+    vector<float> sndfile;
+    {
+        auto_ptr<AudioDecoder> decoder(new SndfileDecoder(path, SAMPLERATE));
+        sndfile = decode("libsndfile", decoder.get());
+    }
+
+    // the resamplers differ, so this is just to see that both hear
+    // the same thing
+    size_t n = std::min(sox.size(), sndfile.size());
+    if (n)
+    {
+        double signal = 0, noise = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            signal += pow(sox[i] - 32768, 2);
+            noise += pow(sndfile[i] - sox[i], 2);
+        }
+        cout << "difference: " << 10 * log10(noise / signal) << " dB" << endl;
+    }
+#else
+    cout << "libsndfile: not built in" << endl;
+#endif
+
+    return 0;
+}
@@ -0,0 +1,215 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <immsutil.h>
+#include <model/distance.h>
+#include <model/emd.h>
+
+using std::cout;
+using std::endl;
+using std::vector;
+
+const string AppName = "bench_emd";
+
+// Relative difference allowed between the two, for rounding.
+#define TOLERANCE       1e-4
+
+// The way distance.cc used to call emd(), as the reference.
+static float cost[BEATSBINS][BEATSBINS];
+
+static float cost_dist(feature_t *f1, feature_t *f2)
+{
+    return cost[*f1][*f2];
+}
+
+static float reference(const MixtureModel &m1, const MixtureModel &m2)
+{
+    feature_t features[NUMGAUSS];
+    float w1[NUMGAUSS], w2[NUMGAUSS];
+
+    for (int i = 0; i < NUMGAUSS; ++i)
+    {
+        features[i] = i;
+        w1[i] = m1.gauss[i].weight;
+        w2[i] = m2.gauss[i].weight;
+
+        for (int j = 0; j < NUMGAUSS; ++j)
+            cost[i][j] = KL_Divergence(m1.gauss[i], m2.gauss[j]);
+    }
+
+    signature_t s1 = { NUMGAUSS, features, w1 };
+    signature_t s2 = { NUMGAUSS, features, w2 };
+    return emd(&s1, &s2, cost_dist, 0, 0);
+}
+
+static float reference(const float *beats1, const float *beats2)
+{
+    feature_t features[BEATSBINS];
+    float b1[BEATSBINS], b2[BEATSBINS];
+    memset(b1, 0, sizeof(b1));
+    memset(b2, 0, sizeof(b2));
+
+    float sum1 = 0, sum2 = 0;
+    for (int i = 0; i < BEATSSIZE; ++i)
+    {
+        sum1 += beats1[i];
+        sum2 += beats2[i];
+    }
+    if (sum1 == 0 || sum2 == 0)
+        return -1;
+
+    float scale1 = 100.0 / sum1, scale2 = 100.0 / sum2;
+    for (int i = 0; i < BEATSSIZE; ++i)
+    {
+        b1[i / BEATSCOMB] += beats1[i] * scale1;
+        b2[i / BEATSCOMB] += beats2[i] * scale2;
+    }
+
+    for (int i = 0; i < BEATSBINS; ++i)
+    {
+        features[i] = i;
+        for (int j = 0; j < BEATSBINS; ++j)
+            cost[i][j] = abs(i - j);
+    }
+
+    signature_t s1 = { BEATSBINS, features, b1 };
+    signature_t s2 = { BEATSBINS, features, b2 };
+    return emd(&s1, &s2, cost_dist, 0, 0);
+}
+
+static void random_model(MixtureModel &mm)
+{
+    float total = 0;
+    for (int i = 0; i < NUMGAUSS; ++i)
+    {
+        Gaussian &g = mm.gauss[i];
+        g.weight = imms_random(1000) + 1;
+        total += g.weight;
+        for (int j = 0; j < Gaussian::NumDimensions; ++j)
+        {
+            g.means[j] = imms_random(2000) / 10.0 - 100;
+            g.vars[j] = imms_random(5000) / 10.0 + 1;
+        }
+    }
+    for (int i = 0; i < NUMGAUSS; ++i)
+        mm.gauss[i].weight /= total;
+}
+
+static void random_beats(float *beats)
+{
+    for (int i = 0; i < BEATSSIZE; ++i)
+        beats[i] = imms_random(100000) / 1000.0;
+}
+
+static double difference(float a, float b)
+{
+    return fabs(a - b) / std::max(1.0f, std::max(fabs(a), fabs(b)));
+}
+
+static uint64_t since(struct timeval &start)
+{
+    struct timeval now;
+    gettimeofday(&now, 0);
+    return usec_diff(start, now);
+}
+
+// Compares EMD::raw_distance with the old emd() based distances on
+// random data, and times both. Fails if they ever disagree.
+int main(int argc, char *argv[])
+{
+    int songs = argc > 1 ? atoi(argv[1]) : 200;
+    if (songs < 2)
+    {
+        cout << "usage: bench_emd [songs]" << endl;
+        return -1;
+    }
+
+    vector<MixtureModel> models(songs);
+    vector<float> beats(songs * BEATSSIZE);
+    for (int i = 0; i < songs; ++i)
+    {
+        random_model(models[i]);
+        random_beats(&beats[i * BEATSSIZE]);
+    }
+
+    int pairs = songs * (songs - 1) / 2;
+    vector<float> gauss_old, gauss_new, beats_old, beats_new;
+    gauss_old.reserve(pairs);
+    gauss_new.reserve(pairs);
+    beats_old.reserve(pairs);
+    beats_new.reserve(pairs);
+
+    struct timeval start;
+
+    gettimeofday(&start, 0);
+    for (int i = 0; i < songs; ++i)
+        for (int j = 0; j < i; ++j)
+            gauss_old.push_back(reference(models[i], models[j]));
+    uint64_t gauss_old_usecs = since(start);
+
+    gettimeofday(&start, 0);
+    EMD::GaussSolver gauss_solver;
+    for (int i = 0; i < songs; ++i)
+        for (int j = 0; j < i; ++j)
+            gauss_new.push_back(
+                    EMD::raw_distance(models[i], models[j], gauss_solver));
+    uint64_t gauss_new_usecs = since(start);
+
+    gettimeofday(&start, 0);
+    for (int i = 0; i < songs; ++i)
+        for (int j = 0; j < i; ++j)
+            beats_old.push_back(reference(&beats[i * BEATSSIZE],
+                        &beats[j * BEATSSIZE]));
+    uint64_t beats_old_usecs = since(start);
+
+    gettimeofday(&start, 0);
+    EMD::BeatsSolver beats_solver;
+    for (int i = 0; i < songs; ++i)
+        for (int j = 0; j < i; ++j)
+            beats_new.push_back(EMD::raw_distance(&beats[i * BEATSSIZE],
+                        &beats[j * BEATSSIZE], beats_solver));
+    uint64_t beats_new_usecs = since(start);
+
+    double gauss_worst = 0, beats_worst = 0;
+    for (int i = 0; i < pairs; ++i)
+    {
+        gauss_worst = std::max(gauss_worst,
+                difference(gauss_old[i], gauss_new[i]));
+        beats_worst = std::max(beats_worst,
+                difference(beats_old[i], beats_new[i]));
+    }
+
+    cout << pairs << " pairs" << endl;
+    cout << "mixture models: emd() " << gauss_old_usecs * 1000 / pairs
+        << " nsecs, EMDSolver " << gauss_new_usecs * 1000 / pairs
+        << " nsecs, worst difference " << gauss_worst << endl;
+    cout << "beat graphs:    emd() " << beats_old_usecs * 1000 / pairs
+        << " nsecs, EMDSolver " << beats_new_usecs * 1000 / pairs
+        << " nsecs, worst difference " << beats_worst << endl;
+
+    return gauss_worst > TOLERANCE || beats_worst > TOLERANCE ? 1 : 0;
+}
@@ -0,0 +1,212 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <immsutil.h>
+#include <strmanip.h>
+#include <fingerprint.h>
+#include <md5.h>
+
+using std::string;
+using std::cout;
+using std::endl;
+using std::vector;
+using std::ostringstream;
+
+const string AppName = "bench_fingerprint";
+
+// The checksum as Identify used to get it: stdio, a seek to the end to
+// look for a tag, and md5_stream reading 4K at a time.
+static string reference_digest(const string &filename)
+{
+    unsigned char bin_buffer[16];
+    char hex_buf[33], tag_buf[4] = { 0 };
+
+    FILE *fp = fopen(filename.c_str(), "r");
+    if (!fp)
+        return "bad_checksum";
+
+    long offset = -256 * 4096;
+    fseek(fp, -128, SEEK_END);
+    fread(tag_buf, 4, 1, fp);
+    if (!strncmp(tag_buf, "TAG", 3))
+        offset -= 128;
+
+    if (fseek(fp, offset, SEEK_END))
+        rewind(fp);
+
+    int err = md5_stream(fp, 256, bin_buffer);
+    fclose(fp);
+    if (err)
+        return "bad_checksum";
+
+    for (int i = 0; i < 16; ++i)
+        sprintf(hex_buf + i * 2, "%02x", bin_buffer[i]);
+    return hex_buf;
+}
+
+static void make_files(const string &prefix, int count, int size,
+        vector<string> &files)
+{
+    vector<char> data(size);
+    for (int i = 0; i < count; ++i)
+    {
+        for (int j = 0; j < size; ++j)
+            data[j] = imms_random(256);
+        // some of them with an ID3v1 tag
+        if (i % 3 == 0 && size >= 128)
+            memcpy(&data[size - 128], "TAG", 3);
+
+        ostringstream path;
+        path << prefix << i << ".mp3";
+        int fd = open(path.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0 || write(fd, &data[0], size) != size)
+        {
+            cout << "could not write " << path.str() << endl;
+            exit(-2);
+        }
+        // so that the pages can be dropped later
+        fdatasync(fd);
+        close(fd);
+        files.push_back(path.str());
+    }
+}
+
+static void drop_caches(const vector<string> &files)
+{
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        int fd = open(files[i].c_str(), O_RDONLY);
+        if (fd < 0)
+            continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+enum Method { REFERENCE, MD5, XXH64 };
+
+static string digest(Method method, const string &path)
+{
+    switch (method)
+    {
+        case REFERENCE:
+            return reference_digest(path);
+        case MD5:
+            return Fingerprint(path).get(FINGERPRINT_MD5);
+        default:
+            return Fingerprint(path).get(FINGERPRINT_XXH64);
+    }
+}
+
+static uint64_t run(Method method, const vector<string> &files, bool cold,
+        vector<string> &results)
+{
+    if (cold)
+        drop_caches(files);
+
+    results.clear();
+
+    struct timeval start, end;
+    gettimeofday(&start, 0);
+
+    for (size_t i = 0; i < files.size(); ++i)
+        results.push_back(digest(method, files[i]));
+
+    gettimeofday(&end, 0);
+    return usec_diff(start, end);
+}
+
+// Fingerprints a directory of made up files with the old stdio MD5 code
+// and with Fingerprint, from a cold and from a warm page cache. Checks
+// that the MD5 fingerprints still match what is in existing databases.
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 10000;
+    int kbytes = argc > 2 ? atoi(argv[2]) : 128;
+
+    if (count < 1 || kbytes < 0)
+    {
+        cout << "usage: bench_fingerprint [files] [kbytes]" << endl;
+        return -1;
+    }
+
+    char root[] = "/tmp/imms-bench-XXXXXX";
+    if (!mkdtemp(root))
+        return -2;
+
+    vector<string> files;
+    make_files(string(root) + "/", count, kbytes * 1024, files);
+
+    // a few sizes around the edges of what gets hashed
+    int edges[] = { 0, 3, 127, 128, 1024 * 1024, 1024 * 1024 + 127,
+        1024 * 1024 + 128, 1024 * 1024 + 129, 3 * 1024 * 1024 };
+    vector<string> edge_files;
+    for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); ++i)
+        make_files(string(root) + "/edge" + itos(i) + "-", 1, edges[i],
+                edge_files);
+
+    const char *names[] = { "stdio md5", "md5", "xxh64" };
+    vector<string> expected, results;
+    bool ok = true;
+
+    cout << count << " files of " << kbytes << "KB" << endl;
+
+    for (int cold = 1; cold >= 0; --cold)
+    {
+        for (int m = REFERENCE; m <= XXH64; ++m)
+        {
+            // warm up
+            if (!cold)
+                run((Method)m, files, false, results);
+
+            uint64_t usecs = run((Method)m, files, cold, results);
+            cout << (cold ? "cold " : "warm ") << names[m] << ": "
+                << usecs / count << " usecs per file" << endl;
+
+            if (m == REFERENCE)
+                expected = results;
+            else if (m == MD5 && results != expected)
+                ok = false;
+        }
+    }
+
+    run(REFERENCE, edge_files, false, expected);
+    run(MD5, edge_files, false, results);
+    ok = ok && results == expected;
+
+    files.insert(files.end(), edge_files.begin(), edge_files.end());
+    for (size_t i = 0; i < files.size(); ++i)
+        unlink(files[i].c_str());
+    rmdir(root);
+
+    cout << (ok ? "md5 fingerprints match" : "md5 fingerprints DIFFER")
+        << endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <math.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <immsutil.h>
+#include <analyzer/frontend.h>
+
+using std::cout;
+using std::endl;
+using std::vector;
+
+const string AppName = "bench_frontend";
+
+#define WINDOWS         1000
+// Same arithmetic in the same order, but FFTW may pick different code
+// for the two plans.
+#define TOLERANCE       1e-9
+
+// The steps as Analyzer used to do them for every window.
+class ReferenceFrontEnd
+{
+public:
+    ReferenceFrontEnd() : hanwin(WINDOWSIZE), outdata(NUMFREQS) {}
+    vector<double> process(const float *samples)
+    {
+        for (int i = 0; i < WINDOWSIZE; ++i)
+            pcmfft.input()[i] = (double)samples[i];
+
+        hanwin.apply(pcmfft.input(), WINDOWSIZE);
+
+        pcmfft.execute();
+
+        for (int i = 0; i < NUMFREQS; ++i)
+            outdata[i] = pow(pcmfft.output()[i][0], 2) +
+                pow(pcmfft.output()[i][1], 2);
+
+        vector<double> melfreqs;
+        mfbank.apply(outdata, melfreqs);
+        return melfreqs;
+    }
+private:
+    FFTProvider<WINDOWSIZE> pcmfft;
+    HanningWindow hanwin;
+    MelFilterBank mfbank;
+    vector<double> outdata;
+};
+
+static uint64_t since(struct timeval &start)
+{
+    struct timeval now;
+    gettimeofday(&now, 0);
+    return usec_diff(start, now);
+}
+
+// Runs windows of made up audio through MelFrontEnd and the old steps,
+// checks that they agree, and times both per window.
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 20;
+    if (rounds < 1)
+    {
+        cout << "usage: bench_frontend [rounds]" << endl;
+        return -1;
+    }
+
+    // unsigned 16 bit samples, as the decoders hand them over
+    vector<float> samples(WINDOWS * WINDOWSIZE);
+    for (size_t i = 0; i < samples.size(); ++i)
+        samples[i] = ROUND(32768 + 8000 * sin(i * 0.05) + 4000 * sin(i * 0.7)
+                + imms_random(4000) - 2000);
+
+    ReferenceFrontEnd reference;
+    MelFrontEnd frontend;
+
+    double worst = 0;
+    for (int w = 0; w < WINDOWS; ++w)
+    {
+        const float *window = &samples[w * WINDOWSIZE];
+        vector<double> expected = reference.process(window);
+        vector<double> &mel = frontend.process(window);
+        for (size_t i = 0; i < expected.size(); ++i)
+            worst = std::max(worst,
+                    fabs(mel[i] - expected[i]) / std::max(1.0, expected[i]));
+    }
+
+    struct timeval start;
+    double sink = 0;
+
+    gettimeofday(&start, 0);
+    for (int r = 0; r < rounds; ++r)
+        for (int w = 0; w < WINDOWS; ++w)
+            sink += reference.process(&samples[w * WINDOWSIZE])[0];
+    uint64_t reference_usecs = since(start);
+
+    gettimeofday(&start, 0);
+    for (int r = 0; r < rounds; ++r)
+        for (int w = 0; w < WINDOWS; ++w)
+            sink += frontend.process(&samples[w * WINDOWSIZE])[0];
+    uint64_t usecs = since(start);
+
+    uint64_t windows = (uint64_t)rounds * WINDOWS;
+    cout << "difference " << worst << "; per window: "
+        << reference_usecs * 1000 / windows << " nsecs before, "
+        << usecs * 1000 / windows << " nsecs now"
+        << (sink ? "" : " ") << endl;
+
+    return worst <= TOLERANCE ? 0 : 1;
+}
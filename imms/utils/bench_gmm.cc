@@ -0,0 +1,219 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <math.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <immsutil.h>
+#include <analyzer/analyzer.h>
+#include <analyzer/mfcckeeper.h>
+#include <model/distance.h>
+
+using std::cout;
+using std::endl;
+using std::vector;
+
+const string AppName = "bench_gmm";
+
+// Sections of a song
+#define SECTIONS        6
+// Average length of a stretch in one section, in frames (~2 seconds)
+#define STRETCH         170
+// How much the sampled models may lose on average in log likelihood per
+// frame of the whole song, compared to the ones fitted to every frame,
+// beyond what just fitting those again does: EM landing in a different
+// local optimum easily makes a difference of half a nat.
+#define MAX_LOSS        0.25
+
+static const int minutes[] = { 1, 2, 4, 0 };
+
+static double gaussian()
+{
+    double x = -6;
+    for (int i = 0; i < 12; ++i)
+        x += imms_random(10000) / 10000.0;
+    return x;
+}
+
+// A made up song: cepstra that stay in one of a few sections for a
+// while, with the noise carried over from frame to frame like in music.
+class SyntheticSong
+{
+public:
+    SyntheticSong()
+    {
+        for (int s = 0; s < SECTIONS; ++s)
+            for (int i = 0; i < NUMCEPSTR; ++i)
+            {
+                means[s][i] = gaussian() * 8 / (i + 1);
+                spread[s][i] = 0.5 + imms_random(1000) / 500.0;
+            }
+    }
+    void generate(int frames, vector<float> &cepstra)
+    {
+        cepstra.resize(frames * NUMCEPSTR);
+        float noise[NUMCEPSTR] = { 0 };
+        int section = 0;
+        for (int t = 0; t < frames; ++t)
+        {
+            if (!imms_random(STRETCH))
+                section = imms_random(SECTIONS);
+            for (int i = 0; i < NUMCEPSTR; ++i)
+            {
+                noise[i] = 0.8 * noise[i] + 0.6 * gaussian();
+                cepstra[t * NUMCEPSTR + i] =
+                    means[section][i] + spread[section][i] * noise[i];
+            }
+        }
+    }
+private:
+    float means[SECTIONS][NUMCEPSTR], spread[SECTIONS][NUMCEPSTR];
+};
+
+// Same features as MFCCKeeper builds: cepstra, deltas and deltas of those.
+static void features(const vector<float> &cepstra, vector<float> &out)
+{
+    int frames = cepstra.size() / NUMCEPSTR;
+    float last[NUMCEPSTR] = { 0 }, last_delta[NUMCEPSTR] = { 0 };
+    out.clear();
+    for (int t = 0; t < frames; ++t)
+    {
+        const float *c = &cepstra[t * NUMCEPSTR];
+        float delta[NUMCEPSTR], meta[NUMCEPSTR];
+        for (int i = 0; i < NUMCEPSTR; ++i)
+        {
+            delta[i] = c[i] - last[i];
+            meta[i] = delta[i] - last_delta[i];
+            last[i] = c[i];
+            last_delta[i] = delta[i];
+        }
+        if (t < 2)
+            continue;
+        out.insert(out.end(), c, c + NUMCEPSTR);
+        out.insert(out.end(), delta, delta + NUMCEPSTR);
+        out.insert(out.end(), meta, meta + NUMCEPSTR);
+    }
+}
+
+// Average log likelihood of the frames under the model.
+static double likelihood(const MixtureModel &mm, const vector<float> &frames)
+{
+    const int d = Gaussian::NumDimensions;
+    double total = 0;
+    int n = frames.size() / d;
+    for (int t = 0; t < n; ++t)
+    {
+        const float *x = &frames[t * d];
+        double best = -HUGE_VAL, terms[NUMGAUSS];
+        for (int k = 0; k < NUMGAUSS; ++k)
+        {
+            const Gaussian &g = mm.gauss[k];
+            double l = log(std::max(g.weight, 1e-30f));
+            for (int i = 0; i < d; ++i)
+                l -= 0.5 * (log(2 * M_PI * g.vars[i])
+                        + pow(x[i] - g.means[i], 2) / g.vars[i]);
+            terms[k] = l;
+            best = std::max(best, l);
+        }
+        double sum = 0;
+        for (int k = 0; k < NUMGAUSS; ++k)
+            sum += exp(terms[k] - best);
+        total += best + log(sum);
+    }
+    return total / n;
+}
+
+static uint64_t fit(MFCCKeeper &keeper, vector<float> &cepstra,
+        MixtureModel &mm)
+{
+    for (size_t t = 0; t < cepstra.size(); t += NUMCEPSTR)
+        keeper.process(&cepstra[t]);
+
+    struct timeval start, end;
+    gettimeofday(&start, 0);
+    keeper.finalize();
+    gettimeofday(&end, 0);
+
+    mm = keeper.get_result();
+    return usec_diff(start, end);
+}
+
+// Fits models of synthetic songs of a few lengths to every frame and to
+// the MFCC_RESERVOIR sample, and compares how well and how fast.
+int main(int argc, char *argv[])
+{
+    int songs = argc > 1 ? atoi(argv[1]) : 5;
+    if (songs < 2)
+    {
+        cout << "usage: bench_gmm [songs]" << endl;
+        return -1;
+    }
+
+    int failures = 0;
+
+    for (const int *m = minutes; *m; ++m)
+    {
+        int frames = std::min(*m * 60 * WINPERSEC, MAXFRAMES);
+
+        double loss = 0, refit = 0, drift = 0, apart = 0;
+        uint64_t full_usecs = 0, sampled_usecs = 0;
+        vector<MixtureModel> models;
+
+        for (int s = 0; s < songs; ++s)
+        {
+            SyntheticSong song;
+            vector<float> cepstra, all;
+            song.generate(frames, cepstra);
+            features(cepstra, all);
+
+            MixtureModel full, again, sampled;
+            MFCCKeeper every, every_again, reservoir(MFCC_RESERVOIR);
+            full_usecs += fit(every, cepstra, full);
+            fit(every_again, cepstra, again);
+            sampled_usecs += fit(reservoir, cepstra, sampled);
+
+            double best = likelihood(full, all);
+            loss += best - likelihood(sampled, all);
+            refit += fabs(best - likelihood(again, all));
+            drift += EMD::raw_distance(full, sampled);
+            models.push_back(full);
+        }
+
+        for (int i = 1; i < songs; ++i)
+            apart += EMD::raw_distance(models[i - 1], models[i]);
+
+        bool ok = loss <= refit + MAX_LOSS * songs;
+        failures += !ok;
+
+        cout << *m << " min (" << frames << " frames, "
+            << std::min(frames, MFCC_RESERVOIR) << " kept): finalize "
+            << full_usecs / songs / 1000 << " -> "
+            << sampled_usecs / songs / 1000 << " msecs, "
+            << "log likelihood loss " << loss / songs << " (refit "
+            << refit / songs << "), distance to full model " << drift / songs
+            << " vs " << apart / (songs - 1) << " between songs"
+            << (ok ? "" : "  FAILED") << endl;
+    }
+
+    return failures ? 1 : 0;
+}
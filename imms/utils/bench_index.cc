@@ -0,0 +1,220 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <immsutil.h>
+#include <model/acousticindex.h>
+
+using std::cout;
+using std::endl;
+using std::vector;
+
+const string AppName = "bench_index";
+
+#define QUERIES         1000
+// share of the true nearest neighbours that the index has to find
+#define MIN_RECALL      0.9
+// songs come in groups that sound alike, like albums do, and the groups
+// themselves only differ in a handful of ways, like real music does
+#define GROUP_SIZE      12
+#define NEIGHBOURS      (GROUP_SIZE - 1)
+#define STYLES          8
+
+struct Sound
+{
+    MixtureModel mm;
+    float beats[BEATSSIZE];
+};
+
+static Sound styles[STYLES];
+
+static float noise(float range)
+{
+    return (imms_random(20001) - 10000) * range / 10000;
+}
+
+static void random_styles()
+{
+    for (int s = 0; s < STYLES; ++s)
+    {
+        for (int i = 0; i < NUMGAUSS; ++i)
+            for (int j = 0; j < Gaussian::NumDimensions; ++j)
+            {
+                styles[s].mm.gauss[i].means[j] = noise(20);
+                styles[s].mm.gauss[i].vars[j] = noise(20);
+            }
+        for (int i = 0; i < BEATSSIZE; ++i)
+            styles[s].beats[i] = noise(10);
+    }
+}
+
+// A mix of the styles.
+static void random_group(Sound &group)
+{
+    float mix[STYLES];
+    for (int s = 0; s < STYLES; ++s)
+        mix[s] = noise(1);
+
+    for (int i = 0; i < NUMGAUSS; ++i)
+        for (int j = 0; j < Gaussian::NumDimensions; ++j)
+        {
+            float mean = 0, var = 100;
+            for (int s = 0; s < STYLES; ++s)
+            {
+                mean += mix[s] * styles[s].mm.gauss[i].means[j];
+                var += mix[s] * styles[s].mm.gauss[i].vars[j];
+            }
+            group.mm.gauss[i].means[j] = mean;
+            group.mm.gauss[i].vars[j] = var;
+        }
+
+    for (int i = 0; i < BEATSSIZE; ++i)
+    {
+        float beat = 50;
+        for (int s = 0; s < STYLES; ++s)
+            beat += mix[s] * styles[s].beats[i];
+        group.beats[i] = std::max(beat, 0.0f);
+    }
+}
+
+static void random_song(const Sound &group, Sound &song)
+{
+    for (int i = 0; i < NUMGAUSS; ++i)
+    {
+        Gaussian &g = song.mm.gauss[i];
+        g.weight = 1.0 / NUMGAUSS;
+        for (int j = 0; j < Gaussian::NumDimensions; ++j)
+        {
+            g.means[j] = group.mm.gauss[i].means[j] + noise(2);
+            g.vars[j] = group.mm.gauss[i].vars[j] + noise(5);
+        }
+    }
+    for (int i = 0; i < BEATSSIZE; ++i)
+        song.beats[i] = std::max(group.beats[i] + noise(2), 0.0f);
+}
+
+static uint64_t since(struct timeval &start)
+{
+    struct timeval now;
+    gettimeofday(&now, 0);
+    return usec_diff(start, now);
+}
+
+// Builds an index over a random library in a scratch directory, and
+// times nearest neighbour queries against checking every song. Fails if
+// the index misses too many of the songs that are really the closest.
+int main(int argc, char *argv[])
+{
+    int songs = argc > 1 ? atoi(argv[1]) : 20000;
+    if (songs < NEIGHBOURS)
+    {
+        cout << "usage: bench_index [songs]" << endl;
+        return -1;
+    }
+
+    char root[] = "/tmp/imms-bench-XXXXXX";
+    if (!mkdtemp(root))
+        return -2;
+    string filename = string(root) + "/" + ACOUSTIC_INDEX;
+
+    vector<int> uids(songs);
+    vector<float> raw(songs * EMBEDDING_DIMS);
+    vector<PackedMixtureModel> models(songs);
+    vector<float> beats(songs * BEATSSIZE);
+
+    random_styles();
+
+    Sound group, song;
+    for (int i = 0; i < songs; ++i)
+    {
+        if (i % GROUP_SIZE == 0)
+            random_group(group);
+        random_song(group, song);
+        std::copy(song.beats, song.beats + BEATSSIZE, &beats[i * BEATSSIZE]);
+        models[i].pack(song.mm);
+        uids[i] = i;
+        acoustic_embedding(models[i], &beats[i * BEATSSIZE],
+                &raw[i * EMBEDDING_DIMS]);
+    }
+
+    struct timeval start;
+    gettimeofday(&start, 0);
+    if (!AcousticIndex::write(filename, uids, raw))
+        return -3;
+    cout << "built an index of " << songs << " songs in "
+        << since(start) / 1000 << " msecs" << endl;
+
+    AcousticIndex index;
+    if (!index.load(filename))
+        return -4;
+
+    vector<int> queries(QUERIES);
+    for (int i = 0; i < QUERIES; ++i)
+        queries[i] = imms_random(songs);
+
+    vector<vector<int> > found(QUERIES);
+    gettimeofday(&start, 0);
+    for (int i = 0; i < QUERIES; ++i)
+    {
+        int q = queries[i];
+        index.nearest(models[q], &beats[q * BEATSSIZE], NEIGHBOURS,
+                found[i]);
+    }
+    uint64_t tree_usecs = since(start);
+
+    int hits = 0;
+    gettimeofday(&start, 0);
+    for (int i = 0; i < QUERIES; ++i)
+    {
+        float point[EMBEDDING_DIMS];
+        index.standardize(&raw[queries[i] * EMBEDDING_DIMS], point);
+
+        vector<std::pair<float, int> > all(songs);
+        for (int j = 0; j < songs; ++j)
+            all[j] = std::make_pair(
+                    AcousticIndex::distance(point, index.get_point(j),
+                        EMBEDDING_DIMS),
+                    index.get_uid(j));
+        std::partial_sort(all.begin(), all.begin() + NEIGHBOURS, all.end());
+
+        for (int j = 0; j < NEIGHBOURS; ++j)
+            if (std::find(found[i].begin(), found[i].end(), all[j].second)
+                    != found[i].end())
+                ++hits;
+    }
+    uint64_t brute_usecs = since(start);
+
+    double recall = hits / (double)(QUERIES * NEIGHBOURS);
+    cout << "index: " << tree_usecs / QUERIES << " usecs per query, "
+        << "found " << recall * 100 << "% of the " << NEIGHBOURS
+        << " nearest" << endl;
+    cout << "every song: " << brute_usecs / QUERIES << " usecs per query"
+        << endl;
+
+    unlink(filename.c_str());
+    rmdir(root);
+
+    return recall >= MIN_RECALL ? 0 : 1;
+}
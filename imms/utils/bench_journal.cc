@@ -0,0 +1,103 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <string>
+#include <iostream>
+
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <immsdb.h>
+#include <immsutil.h>
+#include <flags.h>
+
+using std::string;
+using std::cout;
+using std::endl;
+
+const string AppName = "bench_journal";
+
+// Matches CORRELATION_TIME in correlate.cc
+#define REPLAY_WINDOW   (15*30)
+#define SONG_LENGTH     (3*60)
+
+// Replays a synthetic journal through CorrelationDb::expire_recent the same
+// way immsd does - once per played song with a trailing cutoff - inside a
+// scratch IMMSROOT, and reports how long the correlation updates took.
+int main(int argc, char *argv[])
+{
+    int entries = argc > 1 ? atoi(argv[1]) : 20000;
+    int songs = argc > 2 ? atoi(argv[2]) : 5000;
+
+    if (entries < 1 || songs < 1)
+    {
+        cout << "usage: bench_journal [entries] [songs]" << endl;
+        return -1;
+    }
+
+    char root[] = "/tmp/imms-bench-XXXXXX";
+    if (!mkdtemp(root))
+        return -2;
+    setenv("IMMSROOT", root, 1);
+
+    ImmsDb immsdb;
+
+    time_t base = time(0) + 1;
+
+    try {
+        AutoTransaction a;
+        for (int uid = 0; uid < songs; ++uid)
+            Q("INSERT INTO Library ('uid', 'sid') VALUES (?, ?);")
+                << uid << uid << execute;
+
+        Q q("INSERT INTO Journal VALUES (?, ?, ?, ?);");
+        for (int i = 0; i < entries; ++i)
+        {
+            int played = imms_random(4) ? 10 : 5;
+            int flags = imms_random(Flags::idleness << 1);
+            q << imms_random(songs) << played << flags
+                << (long)(base + i * SONG_LENGTH);
+            q.execute();
+        }
+        a.commit();
+    }
+    WARNIFFAILED();
+
+    struct timeval start, end;
+    gettimeofday(&start, 0);
+
+    for (int i = 0; i < entries; ++i)
+        immsdb.expire_recent(base + i * SONG_LENGTH - REPLAY_WINDOW);
+    immsdb.clear_recent();
+
+    gettimeofday(&end, 0);
+
+    uint64_t usecs = usec_diff(start, end);
+    cout << "replayed " << entries << " journal entries over " << songs
+        << " songs in " << usecs / 1000 << " msecs ("
+        << (usecs / entries) << " usecs/entry)" << endl;
+
+    int correlations = 0;
+    Q q("SELECT count(1) FROM C.Correlations;");
+    if (q.next())
+        q >> correlations;
+    cout << correlations << " correlations in " << root << endl;
+
+    return 0;
+}
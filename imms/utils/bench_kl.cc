@@ -0,0 +1,133 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <math.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <immsutil.h>
+#include <model/distance.h>
+#include <model/klkernel.h>
+
+using std::cout;
+using std::endl;
+using std::vector;
+
+const string AppName = "bench_kl";
+
+// Relative difference allowed from KL_Divergence, for rounding.
+#define TOLERANCE       1e-4
+
+typedef vector<float> Costs;
+
+static void random_model(MixtureModel &mm)
+{
+    for (int i = 0; i < NUMGAUSS; ++i)
+    {
+        Gaussian &g = mm.gauss[i];
+        g.weight = 1.0 / NUMGAUSS;
+        for (int j = 0; j < Gaussian::NumDimensions; ++j)
+        {
+            g.means[j] = imms_random(2000) / 10.0 - 100;
+            g.vars[j] = imms_random(5000) / 10.0 + 1;
+        }
+    }
+}
+
+static double difference(float a, float b)
+{
+    return fabs(a - b) / std::max(1.0f, std::max(fabsf(a), fabsf(b)));
+}
+
+static uint64_t since(struct timeval &start)
+{
+    struct timeval now;
+    gettimeofday(&now, 0);
+    return usec_diff(start, now);
+}
+
+static void report(const char *name, uint64_t usecs, int pairs,
+        const Costs &costs, const Costs &reference)
+{
+    double worst = 0;
+    for (size_t i = 0; i < costs.size(); ++i)
+        worst = std::max(worst, difference(costs[i], reference[i]));
+
+    cout << name << ": " << usecs * 1000 / pairs << " nsecs per pair, "
+        << (usecs ? (uint64_t)pairs * 1000000 / usecs : 0)
+        << " pairs per second, worst difference " << worst << endl;
+}
+
+// Times the 5x5 KL cost matrix of every pair of songs with each kernel
+// this CPU can run, against KL_Divergence on the plain MixtureModel.
+int main(int argc, char *argv[])
+{
+    int songs = argc > 1 ? atoi(argv[1]) : 500;
+    if (songs < 2)
+    {
+        cout << "usage: bench_kl [songs]" << endl;
+        return -1;
+    }
+
+    vector<MixtureModel> models(songs);
+    vector<PackedMixtureModel> packed(songs);
+    for (int i = 0; i < songs; ++i)
+    {
+        random_model(models[i]);
+        packed[i].pack(models[i]);
+    }
+
+    int pairs = songs * (songs - 1) / 2;
+    Costs reference;
+    reference.reserve(pairs * NUMGAUSS * NUMGAUSS);
+
+    struct timeval start;
+    gettimeofday(&start, 0);
+    for (int a = 0; a < songs; ++a)
+        for (int b = 0; b < a; ++b)
+            for (int i = 0; i < NUMGAUSS; ++i)
+                for (int j = 0; j < NUMGAUSS; ++j)
+                    reference.push_back(KL_Divergence(
+                                models[a].gauss[i], models[b].gauss[j]));
+    report("KL_Divergence", since(start), pairs, reference, reference);
+
+    bool ok = true;
+    for (const KLKernel *k = kl_kernels(); k->name; ++k)
+    {
+        Costs costs(reference.size());
+        float (*cost)[NUMGAUSS] = (float (*)[NUMGAUSS])&costs[0];
+
+        gettimeofday(&start, 0);
+        for (int a = 0; a < songs; ++a)
+            for (int b = 0; b < a; ++b, cost += NUMGAUSS)
+                k->costs(packed[a], packed[b], cost);
+        uint64_t usecs = since(start);
+
+        report(k->name, usecs, pairs, costs, reference);
+
+        for (size_t i = 0; i < costs.size(); ++i)
+            if (difference(costs[i], reference[i]) > TOLERANCE)
+                ok = false;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <picker.h>
+#include <snapshot.h>
+#include <immsutil.h>
+
+using std::string;
+using std::cout;
+using std::endl;
+using std::ofstream;
+using std::ostringstream;
+
+const string AppName = "bench_picker";
+
+#define ARTISTS     500
+
+// A SongPicker with the playlist held in the database and no player.
+class BenchPicker : public SongPicker
+{
+public:
+    void populate(const string &dir, int songs);
+    int next() { return select_next(); }
+
+protected:
+    virtual void reset_selection() {}
+    virtual void request_playlist_item(int index) {}
+    virtual void get_metacandidates(int size)
+        { PlaylistDb::get_random_sample(metacandidates, size); }
+};
+
+void BenchPicker::populate(const string &dir, int songs)
+{
+    mkdir(dir.c_str(), 0700);
+
+    AutoTransaction a;
+
+    for (int aid = 0; aid < ARTISTS; ++aid)
+    {
+        ostringstream artist;
+        artist << "artist " << aid;
+        Q("INSERT INTO Artists ('aid', 'artist', 'readable', 'trust') "
+                "VALUES (?, ?, ?, 0);")
+            << aid << artist.str() << artist.str() << execute;
+    }
+
+    MixtureModel mm;
+    float beats[BEATSSIZE];
+    memset((void *)&mm, 0, sizeof(mm));
+    memset(beats, 0, sizeof(beats));
+
+    for (int uid = 0; uid < songs; ++uid)
+    {
+        ostringstream path, title;
+        path << dir << "/" << uid << ".mp3";
+        title << "title " << uid;
+        ofstream(path.str().c_str());
+
+        Q("INSERT INTO Identify ('path', 'uid', 'modtime', 'checksum') "
+                "VALUES (?, ?, 0, ?);")
+            << path.str() << uid << title.str() << execute;
+        Q("INSERT INTO Library ('uid', 'sid', 'playcounter') "
+                "VALUES (?, ?, ?);")
+            << uid << uid << imms_random(50) << execute;
+        Q("INSERT INTO Info ('sid', 'aid', 'title') VALUES (?, ?, ?);")
+            << uid << imms_random(ARTISTS) << title.str() << execute;
+        Q("INSERT INTO Ratings ('uid', 'rating', 'dev') VALUES (?, ?, 0);")
+            << uid << imms_random(100) << execute;
+        Q("INSERT INTO Last ('sid', 'last') VALUES (?, ?);")
+            << uid << time(0) - imms_random(30 * DAY) << execute;
+
+        if (uid % 2)
+            Song("", uid).set_acoustic(mm, beats);
+
+        PlaylistDb::playlist_insert_item(uid, path.str());
+    }
+
+    a.commit();
+
+    pl_length = songs;
+    playlist_ready();
+}
+
+// Times SongPicker::select_next over a synthetic library in a scratch
+// IMMSROOT. Pass "snapshot" to serve the candidates from LibrarySnapshot.
+int main(int argc, char *argv[])
+{
+    int selections = argc > 1 ? atoi(argv[1]) : 200;
+    int songs = argc > 2 ? atoi(argv[2]) : 5000;
+    bool snapshot = argc > 3 && !strcmp(argv[3], "snapshot");
+
+    if (selections < 1 || songs < 1)
+    {
+        cout << "usage: bench_picker [selections] [songs] [snapshot]"
+            << endl;
+        return -1;
+    }
+
+    char root[] = "/tmp/imms-bench-XXXXXX";
+    if (!mkdtemp(root))
+        return -2;
+    setenv("IMMSROOT", root, 1);
+
+    BenchPicker picker;
+    picker.populate(string(root) + "/music", songs);
+
+    if (snapshot)
+        LibrarySnapshot::self()->load();
+
+    struct timeval start, end;
+    gettimeofday(&start, 0);
+
+    for (int i = 0; i < selections; ++i)
+        picker.next();
+
+    gettimeofday(&end, 0);
+
+    uint64_t usecs = usec_diff(start, end);
+    cout << selections << " selections from " << songs << " songs "
+        << (snapshot ? "with" : "without") << " the snapshot: "
+        << usecs / selections << " usecs per select_next" << endl;
+
+    return 0;
+}
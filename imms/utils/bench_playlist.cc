@@ -0,0 +1,197 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <immsdb.h>
+#include <immsutil.h>
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::endl;
+using std::ofstream;
+using std::ostringstream;
+using std::stringstream;
+
+const string AppName = "bench_playlist";
+
+// Matches PLAYLIST_BATCH in clientstub.h
+#define PLAYLIST_BATCH      4096
+#define SONGS_PER_DIR       100
+
+// What the Playlist table ended up as, to check both ways agree.
+static void dump_playlist(vector<string> &rows)
+{
+    rows.clear();
+    Q q("SELECT pos, path, uid FROM Playlist ORDER BY pos;");
+    while (q.next())
+    {
+        int pos, uid;
+        string path;
+        q >> pos >> path >> uid;
+        ostringstream row;
+        row << pos << " " << uid << " " << path;
+        rows.push_back(row.str());
+    }
+}
+
+// Times getting a playlist into the database the way immsd does it: a
+// Playlist line per item, and the same playlist as PlaylistBatch
+// messages. The files are real, in a scratch IMMSROOT, since paths are
+// normalized on the way in; every other directory is reached through a
+// symlink, and every other file is already identified. Socket transfer
+// is not included. Then adds one more song with PlaylistEdit, to compare
+// against sending it all again.
+int main(int argc, char *argv[])
+{
+    int items = argc > 1 ? atoi(argv[1]) : 100000;
+
+    if (items < 1)
+    {
+        cout << "usage: bench_playlist [items]" << endl;
+        return -1;
+    }
+
+    char root[] = "/tmp/imms-bench-XXXXXX";
+    if (!mkdtemp(root))
+        return -2;
+    setenv("IMMSROOT", root, 1);
+
+    string music = string(root) + "/music", link = string(root) + "/link";
+    mkdir(music.c_str(), 0700);
+    symlink(music.c_str(), link.c_str());
+
+    ImmsDb immsdb;
+
+    vector<string> paths;
+    try {
+        AutoTransaction a;
+        for (int i = 0; i < items; ++i)
+        {
+            ostringstream dir, file;
+            dir << "/artist " << i / SONGS_PER_DIR;
+            file << dir.str() << "/track " << i % SONGS_PER_DIR << ".mp3";
+            if (!(i % SONGS_PER_DIR))
+                mkdir((music + dir.str()).c_str(), 0700);
+            ofstream((music + file.str()).c_str());
+
+            if (i % 2)
+                Q("INSERT INTO Identify ('path', 'uid', 'modtime', "
+                        "'checksum') VALUES (?, ?, 0, '');")
+                    << music + file.str() << i << execute;
+
+            paths.push_back((i / SONGS_PER_DIR % 2 ? link : music)
+                    + file.str());
+        }
+        a.commit();
+    }
+    WARNIFFAILED();
+
+    vector<string> lines;
+    for (int i = 0; i < items; ++i)
+    {
+        ostringstream line;
+        line << "Playlist " << i << " " << paths[i];
+        lines.push_back(line.str());
+    }
+
+    vector<string> batches;
+    for (int first = 0; first < items; first += PLAYLIST_BATCH)
+    {
+        string batch;
+        for (int i = first; i < items && i < first + PLAYLIST_BATCH; ++i)
+        {
+            batch += paths[i];
+            batch += '\0';
+        }
+        batches.push_back(batch);
+    }
+
+    struct timeval start, end;
+    gettimeofday(&start, 0);
+
+    // ImmsProcessor::process_line
+    immsdb.playlist_clear();
+    for (int i = 0; i < items; ++i)
+    {
+        stringstream sstr;
+        sstr << lines[i];
+        string command;
+        sstr >> command;
+        int pos;
+        sstr >> pos;
+        string path;
+        getline(sstr, path);
+        path = path_normalize(path);
+        immsdb.playlist_insert_item(pos, path);
+    }
+
+    gettimeofday(&end, 0);
+    uint64_t line_usecs = usec_diff(start, end);
+
+    vector<string> by_line, by_batch;
+    dump_playlist(by_line);
+
+    gettimeofday(&start, 0);
+
+    immsdb.playlist_clear();
+    for (size_t i = 0; i < batches.size(); ++i)
+        immsdb.playlist_insert_batch(i * PLAYLIST_BATCH, batches[i]);
+
+    gettimeofday(&end, 0);
+    uint64_t batch_usecs = usec_diff(start, end);
+
+    dump_playlist(by_batch);
+
+    cout << items << " playlist items:" << endl;
+    cout << "  by line:  " << line_usecs / 1000 << " msecs ("
+        << line_usecs * 1000 / items << " nsecs/item)" << endl;
+    cout << "  by batch: " << batch_usecs / 1000 << " msecs ("
+        << batch_usecs * 1000 / items << " nsecs/item)" << endl;
+    cout << "  results " << (by_line == by_batch ? "match" : "DIFFER")
+        << " (" << by_batch.size() << " rows in " << root << ")" << endl;
+
+    // one more song as a delta instead, checksum included: at the end,
+    // and at the start, where every position has to shift
+    string one = paths[0] + '\0';
+    for (int at = items; at >= 0; at -= items)
+    {
+        gettimeofday(&start, 0);
+
+        immsdb.playlist_edit(PlaylistEdit(PlaylistEdit::Insert, at, 1), one);
+        PlaylistChecksum checksum = immsdb.playlist_checksum();
+
+        gettimeofday(&end, 0);
+        uint64_t usecs = usec_diff(start, end);
+
+        cout << "  one more at " << at << " as a delta: " << usecs / 1000
+            << " msecs (" << checksum.get_length() << " items)" << endl;
+    }
+
+    return by_line == by_batch ? 0 : 1;
+}
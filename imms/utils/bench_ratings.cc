@@ -0,0 +1,226 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <immsdb.h>
+#include <immsutil.h>
+#include <flags.h>
+#include <song.h>
+#include <ratingstate.h>
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::endl;
+
+const string AppName = "bench_ratings";
+
+// Every other song gets a history this long at most, long enough for
+// most of it to decay away; the rest stay short.
+#define LONG_HISTORY        2000
+#define SHORT_HISTORY       30
+// How often, on average, update_rating runs between plays
+#define UPDATE_EVERY        8
+// How many plays go by before the listener changes their mind
+#define MOOD_LENGTH         150
+#define SONG_LENGTH         (3*60)
+
+// Ratings are rounded to whole points, so allow for the last
+// one to come out either way.
+#define RATING_TOLERANCE    1
+
+// No Bias rows, so this is what update_rating falls back to
+#define BIASMEAN            0.5
+
+struct Play
+{
+    int played, flags;
+};
+
+// The rating from the whole history, newest play first, the way
+// update_rating used to do it before it kept a RatingState.
+static int rescan(const vector<Play> &history, size_t end)
+{
+    double total = 0, ones = 0, zeros = 0;
+    for (size_t i = end; i-- > 0; )
+    {
+        double delta = RatingState::delta(history[i].played, history[i].flags);
+        if (delta > 0)
+            ones += RatingState::decay(delta, total);
+        else
+            zeros += RatingState::decay(-delta, total);
+        total += fabs(delta);
+    }
+    return RatingState::score(ones, zeros, total, BIASMEAN);
+}
+
+// The same, straight from the Journal.
+static int rescan_journal(int uid)
+{
+    vector<Play> history;
+    Q q("SELECT played, flags FROM Journal WHERE uid = ? "
+            "ORDER BY time ASC;");
+    q << uid;
+
+    while (q.next())
+    {
+        Play p;
+        q >> p.played >> p.flags;
+        history.push_back(p);
+    }
+    return rescan(history, history.size());
+}
+
+// A listener whose taste drifts: how likely a play of this song is to
+// be heard out changes every MOOD_LENGTH plays. Any flags can turn up,
+// jumps and bad plays included.
+static vector<Play> make_history(int plays)
+{
+    vector<Play> history(plays);
+    int liking = 0;
+    for (int i = 0; i < plays; ++i)
+    {
+        if (i % MOOD_LENGTH == 0)
+            liking = imms_random(101);
+        history[i].played = imms_random(100) < liking ? 10 : imms_random(10);
+        history[i].flags = imms_random(Flags::active << 1);
+    }
+    return history;
+}
+
+// Feeds synthetic journals through RatingState one play at a time and
+// through Song::update_rating and the Journal inside a scratch IMMSROOT,
+// and checks both against a full rescan after every step.
+int main(int argc, char *argv[])
+{
+    int songs = argc > 1 ? atoi(argv[1]) : 100;
+
+    if (songs < 1)
+    {
+        cout << "usage: bench_ratings [songs]" << endl;
+        return -1;
+    }
+
+    char root[] = "/tmp/imms-bench-XXXXXX";
+    if (!mkdtemp(root))
+        return -2;
+    setenv("IMMSROOT", root, 1);
+
+    ImmsDb immsdb;
+
+    int checked = 0, off = 0, updates = 0, plays = 0;
+    int decayed = 0, jumped = 0, skipped = 0, longest = 0;
+    uint64_t update_usecs = 0, rescan_usecs = 0;
+    time_t now = time(0);
+
+    for (int uid = 0; uid < songs; ++uid)
+    {
+        vector<Play> history = make_history(
+                1 + imms_random(uid % 2 ? SHORT_HISTORY : LONG_HISTORY));
+        longest = std::max(longest, (int)history.size());
+
+        RatingState state;
+        double total = 0;
+        Song song("", uid, uid);
+
+        for (size_t i = 0; i < history.size(); ++i)
+        {
+            const Play &p = history[i];
+            now += SONG_LENGTH;
+            ++plays;
+
+            double delta = RatingState::delta(p.played, p.flags);
+            if (delta && !RatingState::decay(fabs(delta), total))
+                ++decayed;
+            if (delta && (p.flags & (Flags::jumped_to | Flags::jumped_from)))
+                ++jumped;
+            if (delta && p.played != 10)
+                ++skipped;
+            total += fabs(delta);
+
+            state.add(p.played, p.flags, now);
+            int expected = rescan(history, i + 1);
+            int actual = state.rating(BIASMEAN);
+            ++checked;
+            if (abs(expected - actual) > RATING_TOLERANCE)
+            {
+                ++off;
+                cout << "uid " << uid << ", play " << i << ": state rating "
+                    << actual << ", expected " << expected << endl;
+            }
+
+            try
+            {
+                Q("INSERT INTO Journal VALUES (?, ?, ?, ?);")
+                    << uid << p.played << p.flags << (long)now << execute;
+            }
+            WARNIFFAILED();
+
+            if (imms_random(UPDATE_EVERY) && i + 1 < history.size())
+                continue;
+
+            struct timeval start, updated, rescanned;
+            gettimeofday(&start, 0);
+            actual = song.update_rating();
+            gettimeofday(&updated, 0);
+            try
+            {
+                expected = rescan_journal(uid);
+            }
+            WARNIFFAILED();
+            gettimeofday(&rescanned, 0);
+
+            update_usecs += usec_diff(start, updated);
+            rescan_usecs += usec_diff(updated, rescanned);
+
+            ++updates;
+            if (abs(expected - actual) > RATING_TOLERANCE)
+            {
+                ++off;
+                cout << "uid " << uid << ", play " << i << ": update_rating "
+                    << actual << ", expected " << expected << endl;
+            }
+        }
+    }
+
+    cout << plays << " plays over " << songs << " songs (longest "
+        << longest << "), " << decayed << " past the decay limit, "
+        << jumped << " jumps, " << skipped << " skips" << endl;
+    cout << "update_rating: " << update_usecs / std::max(updates, 1)
+        << " usecs per update, full rescan: "
+        << rescan_usecs / std::max(updates, 1) << " usecs" << endl;
+    cout << checked + updates << " ratings checked, " << off << " off" << endl;
+
+    // make sure the synthetic journals actually got into the cases that
+    // matter, or the agreement above does not say much
+    if (!decayed || !jumped || !skipped || longest < SHORT_HISTORY)
+    {
+        cout << "journals too tame to check against" << endl;
+        return 1;
+    }
+
+    return off ? 1 : 0;
+}
@@ -0,0 +1,220 @@
+/*
+ IMMS: Intelligent Multimedia Management System
+ Copyright (C) 2001-2009 Michael Grigoriev
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+*/
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include <math.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <immsconf.h>
+#include <immsutil.h>
+#include <model/model.h>
+#include <model/svm.h>
+
+using std::cout;
+using std::endl;
+using std::vector;
+using std::auto_ptr;
+
+const string AppName = "bench_svm";
+
+// Difference allowed from the reference, relative to the score or to 1,
+// whichever is bigger. The kernels do the same float arithmetic as Torch
+// in the same order, so anything more than rounding the output is a bug.
+#define TOLERANCE       1e-4
+
+typedef vector<float> Scores;
+
+// Rows with the scores Torch's SVMClassification gives them with the built
+// in model, on x86-64 where its 'real' is a float; checked in every build,
+// Torch or not.
+struct GoldenRow
+{
+    float features[NUM_FEATURES];
+    float torch;
+};
+
+static const GoldenRow golden[] = {
+    { { 92.4466934, 0.664813638, -4.3576088, 19.300827,
+        38.782753, 10.5534916, 18.9318733, 32.1834946,
+        6397445.5, 6749405.5, -2626886.5, 4778794 },
+      -0.272124618 },
+    { { -55.9959412, 0.589367926, 3.79829097, 26.7372169,
+        29.2190037, 13.3014984, 29.2248249, 41.9711189,
+        10929224, 35482.5, 3148109, 6948694 },
+      0.631488144 },
+    { { -3.96753883, 0.889116287, 20.0673828, 19.7755127,
+        32.8591766, 4.18018627, 32.8940887, 42.3627663,
+        7216068.5, 15012586, -1815292, 4089052 },
+      0.0142040253 },
+    { { 60.645668, 1.17561889, 7.98039961, 32.1994934,
+        29.6584339, -21.3744583, 27.6050396, 34.1553192,
+        8216547.5, 5690922.5, 1842260, 187467.25 },
+      -0.305630356 },
+    { { 68.2490921, 0.862292886, -25.6567097, 17.9363823,
+        34.2058296, 6.24986982, 26.4127007, 25.4843464,
+        17833464, 10502965, 1360059.25, 1886569.88 },
+      -0.52987355 },
+    { { 59.0583725, 0.278284132, -6.26439714, 33.9981346,
+        31.0719185, 12.4722977, 26.7715244, 41.8444557,
+        2308216.75, 7029013, 3293096.25, -4249425 },
+      0.550705612 }
+};
+
+// Roughly normal, around what the normalizer expects.
+static void random_features(const SVMMachine &machine, float *features)
+{
+    for (int i = 0; i < NUM_FEATURES; ++i)
+    {
+        float x = -6;
+        for (int j = 0; j < 12; ++j)
+            x += imms_random(10000) / 10000.0;
+        features[i] = machine.get_means()[i] + x * machine.get_stdvs()[i];
+    }
+}
+
+static double difference(float a, float b)
+{
+    return fabs(a - b) / std::max(1.0f, std::max(fabsf(a), fabsf(b)));
+}
+
+static uint64_t since(struct timeval &start)
+{
+    struct timeval now;
+    gettimeofday(&now, 0);
+    return usec_diff(start, now);
+}
+
+static void report(const char *name, uint64_t usecs, const Scores &scores,
+        const Scores &reference)
+{
+    double worst = 0;
+    for (size_t i = 0; i < scores.size(); ++i)
+        worst = std::max(worst, difference(scores[i], reference[i]));
+
+    cout << name << ": " << usecs / scores.size() << " usecs per score, "
+        << "worst difference " << worst << endl;
+}
+
+// Scores random features with each kernel this CPU can run, all in one
+// batch, and with the Torch machine if there is one, and times them.
+// Fails if any of them disagree with the scalar kernel, or with Torch on
+// the golden rows.
+int main(int argc, char *argv[])
+{
+    int rows = argc > 1 ? atoi(argv[1]) : 2000;
+    if (rows < 1)
+    {
+        cout << "usage: bench_svm [rows]" << endl;
+        return -1;
+    }
+
+    auto_ptr<SVMMachine> machine(load_similarity_svm());
+    if (machine->num_inputs() != NUM_FEATURES)
+        return -2;
+
+    cout << machine->num_support_vectors() << " support vectors" << endl;
+
+    vector<float> features(rows * NUM_FEATURES);
+    for (int i = 0; i < rows; ++i)
+        random_features(*machine, &features[i * NUM_FEATURES]);
+
+    struct timeval start;
+    bool ok = true;
+
+    // the plain C kernel, as the reference for the others
+    SVMKernelFunc scalar = 0;
+    for (const SVMKernel *k = svm_kernels(); k->name; ++k)
+        scalar = k->eval;
+
+    Scores reference(rows);
+    for (int i = 0; i < rows; ++i)
+        reference[i] = machine->evaluate(&features[i * NUM_FEATURES],
+                scalar) / 3;
+
+    bool builtin = !file_exists(get_imms_root("svm-similarity"));
+    for (size_t i = 0; builtin && i < sizeof(golden) / sizeof(*golden); ++i)
+    {
+        for (const SVMKernel *k = svm_kernels(); k->name; ++k)
+        {
+            float score = machine->evaluate(golden[i].features, k->eval) / 3;
+            if (difference(score, golden[i].torch) > TOLERANCE)
+            {
+                cout << k->name << ": golden row " << i << " scored "
+                    << score << ", Torch " << golden[i].torch << endl;
+                ok = false;
+            }
+        }
+    }
+
+#ifdef WITH_TORCH
+    TorchSVMSimilarityModel torch;
+    vector<float> copy(features);
+    Scores scores(rows);
+
+    gettimeofday(&start, 0);
+    for (int i = 0; i < rows; ++i)
+        scores[i] = torch.evaluate(&copy[i * NUM_FEATURES]);
+    report("torch", since(start), scores, reference);
+
+    for (int i = 0; i < rows; ++i)
+        if (difference(scores[i], reference[i]) > TOLERANCE)
+            ok = false;
+
+    for (size_t i = 0; builtin && i < sizeof(golden) / sizeof(*golden); ++i)
+    {
+        vector<float> row(golden[i].features,
+                golden[i].features + NUM_FEATURES);
+        if (difference(torch.evaluate(&row[0]), golden[i].torch) > TOLERANCE)
+            ok = false;
+    }
+#endif
+
+    for (const SVMKernel *k = svm_kernels(); k->name; ++k)
+    {
+        Scores scores(rows);
+
+        gettimeofday(&start, 0);
+        for (int i = 0; i < rows; ++i)
+            scores[i] = machine->evaluate(&features[i * NUM_FEATURES],
+                    k->eval) / 3;
+        report(k->name, since(start), scores, reference);
+
+        for (int i = 0; i < rows; ++i)
+            if (difference(scores[i], reference[i]) > TOLERANCE)
+                ok = false;
+    }
+
+    // all of the rows at once, with the best kernel
+    Scores scores(rows);
+    gettimeofday(&start, 0);
+    machine->evaluate_batch(&features[0], rows, &scores[0]);
+    for (int i = 0; i < rows; ++i)
+        scores[i] /= 3;
+    report("batch", since(start), scores, reference);
+
+    for (int i = 0; i < rows; ++i)
+        if (difference(scores[i], reference[i]) > TOLERANCE)
+            ok = false;
+
+    return ok ? 0 : 1;
+}
@@ -39,6 +39,8 @@
 #include <immsutil.h>
 #include <strmanip.h>
 #include <picker.h>
+#include <scanner.h>
+#include <ratingstate.h>
 #include <appname.h>
 #include <string.h>
 
@@ -46,6 +48,8 @@
 #include <analyzer/mfcckeeper.h>
 #include <model/distance.h>
 #include <model/model.h>
+#include <model/pairwise.h>
+#include <model/acousticindex.h>
 
 using std::string;
 using std::cout;
@@ -69,8 +73,10 @@ void do_purge(const string &path);
 void do_closest(const string &path);
 void do_lint();
 void do_identify(const string &path);
+int do_scan(int jobs, const vector<string> &paths);
 void do_update_ratings();
-void do_update_distances();
+int do_verify_ratings();
+void do_repair_ratings();
 
 int main(int argc, char *argv[])
 {
@@ -86,23 +92,48 @@ int main(int argc, char *argv[])
 
     if (!strcmp(argv[1], "ratings"))
     {
-        if (argc > 2)
+        if (argc > 3)
         {
-            cout << "huh??" << endl;
+            cout << "immstool ratings [verify|repair]" << endl;
             return -1;
         }
 
-        do_update_ratings();
+        if (argc == 2)
+            do_update_ratings();
+        else if (!strcmp(argv[2], "verify"))
+            return do_verify_ratings() ? 1 : 0;
+        else if (!strcmp(argv[2], "repair"))
+            do_repair_ratings();
+        else
+        {
+            cout << "immstool ratings [verify|repair]" << endl;
+            return -1;
+        }
     }
     else if (!strcmp(argv[1], "distances"))
     {
-        if (argc > 2)
+        int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+        if (argc == 3)
+            jobs = atoi(argv[2]);
+
+        if (argc > 3 || jobs < 1)
         {
-            cout << "huh??" << endl;
+            cout << "immstool distances [jobs]" << endl;
             return -1;
         }
 
-        do_update_distances();
+        PairwiseDistances distances(jobs);
+        return distances.run() ? 0 : 1;
+    }
+    else if (!strcmp(argv[1], "index"))
+    {
+        int songs = AcousticIndex::build(get_imms_root(ACOUSTIC_INDEX));
+        if (songs < 0)
+        {
+            LOG(ERROR) << "Failed to build the index" << endl;
+            return -2;
+        }
+        cout << "Indexed " << songs << " songs" << endl;
     }
     else if (!strcmp(argv[1], "distance"))
     {
@@ -162,6 +193,23 @@ int main(int argc, char *argv[])
 
         do_identify(argv[2]);
     }
+    else if (!strcmp(argv[1], "scan"))
+    {
+        int jobs = 0, first = 2;
+        if (argc > 3 && !strcmp(argv[2], "-j"))
+        {
+            jobs = atoi(argv[3]);
+            first = 4;
+        }
+
+        if (argc <= first || jobs < 0)
+        {
+            cout << "immstool scan [-j <jobs>] <directory|list> ..." << endl;
+            return -1;
+        }
+
+        return do_scan(jobs, vector<string>(argv + first, argv + argc));
+    }
     else if (!strcmp(argv[1], "missing"))
     {
         do_missing();
@@ -261,9 +309,10 @@ int main(int argc, char *argv[])
 int usage()
 {
     cout << "End user functionality: " << endl;
-    cout << " immstool missing|purge|lint|identify|help" << endl;
+    cout << " immstool missing|purge|lint|identify|scan|help" << endl;
     cout << "Debug functionality: " << endl;
-    cout << " immstool distances|graph" << endl;
+    cout << " immstool ratings [verify|repair]|distances [jobs]|index|graph"
+        << endl;
     return -1;
 }
 
@@ -281,6 +330,12 @@ void do_help()
         "- vacuum the database" << endl;
     cout << "    identify <filename>    " <<
         "- print information about a given file" << endl;
+    cout << "    scan [-j n] <dir|list> " <<
+        "- identify every song in a directory or file list" << endl;
+    cout << "    ratings [verify|repair]" <<
+        "- check the saved rating state against the Journal" << endl;
+    cout << "                           " <<
+        "  'repair' rebuilds it from scratch" << endl;
     cout << "    help                   " << 
         "- show this help" << endl;
 }
@@ -413,6 +468,9 @@ void do_lint()
         Q("DELETE FROM Ratings "
                 "WHERE uid NOT IN (SELECT uid FROM Library);").execute();
 
+        Q("DELETE FROM RatingState "
+                "WHERE uid NOT IN (SELECT uid FROM Library);").execute();
+
         Q("DELETE FROM A.Acoustic "
                 "WHERE uid NOT IN (SELECT uid FROM Library);").execute();
 
@@ -433,6 +491,27 @@ void do_lint()
 
 }
 
+int do_scan(int jobs, const vector<string> &paths)
+{
+    vector<string> files;
+    for (size_t i = 0; i < paths.size(); ++i)
+        LibraryScanner::collect(paths[i], files);
+
+    LibraryScanner scanner(jobs);
+    for (size_t i = 0; i < files.size(); ++i)
+        scanner.add(files[i]);
+
+    while (scanner.pump(5000))
+        LOG(INFO) << scanner.get_remaining() << " of " << files.size()
+            << " files left" << endl;
+
+    cout << files.size() << " files: " << scanner.get_identified()
+        << " identified, " << scanner.get_unchanged() << " unchanged, "
+        << scanner.get_failed() << " failed" << endl;
+
+    return scanner.get_failed() ? 1 : 0;
+}
+
 void do_missing()
 {
     Q q("SELECT path FROM 'Identify';");
@@ -446,7 +525,7 @@ void do_missing()
     }
 }
 
-void do_update_ratings()
+vector<int> journal_uids()
 {
     vector<int> uids;
     try
@@ -460,7 +539,12 @@ void do_update_ratings()
         }
     }
     WARNIFFAILED();
+    return uids;
+}
 
+void do_update_ratings()
+{
+    vector<int> uids = journal_uids();
     for (size_t i = 0; i < uids.size(); ++i)
     {
         Song song("", uids[i]);
@@ -468,103 +552,167 @@ void do_update_ratings()
     }
 }
 
-void do_update_distances()
+double get_biasmean(int uid)
 {
-    vector<int> uids;
-    try
+    Q q("SELECT sum(mean * trials) / sum(trials) "
+            "FROM Bias WHERE uid = ? GROUP BY uid;");
+    q << uid;
+
+    double biasmean = 50;
+    if (q.next() && q.not_null())
+        q >> biasmean;
+    return biasmean / 100.0;
+}
+
+// The rating straight from the whole Journal, the way update_rating
+// used to do it before it kept a RatingState.
+int rescan_rating(int uid)
+{
+    double total = 0, ones = 0, zeros = 0;
+
+    Q q("SELECT played, flags FROM Journal WHERE uid = ? "
+            "ORDER BY time DESC;");
+    q << uid;
+
+    while (q.next())
     {
-        Q q("SELECT uid FROM A.Acoustic WHERE mfcc NOTNULL AND bpm NOTNULL;");
-        while (q.next())
-        {
-            int uid;
-            q >> uid;
-            uids.push_back(uid);
-        }
+        int flags;
+        time_t played;
+        q >> played >> flags;
+        double delta = RatingState::delta(played, flags);
+        if (delta > 0)
+            ones += RatingState::decay(delta, total);
+        else
+            zeros += RatingState::decay(-delta, total);
+        total += fabs(delta);
     }
-    WARNIFFAILED();
 
-    SVMSimilarityModel model;
+    return RatingState::score(ones, zeros, total, get_biasmean(uid));
+}
 
-    size_t numuids = uids.size();
-    for (size_t i = 0; i < numuids; ++i)
+// The rating update_rating would come up with right now.
+int incremental_rating(int uid)
+{
+    RatingState state;
     {
-        int uid = uids[i];
-        set<int> neigh;
-        neigh.insert(uids.begin(), uids.end());
-        neigh.erase(uid);
-        int x, y;
+        Q q("SELECT total, until, recent FROM RatingState WHERE uid = ?;");
+        q << uid;
+        if (q.next())
+            state.load(q);
+    }
 
-        try
-        {
-            Q q("SELECT x, y FROM A.Distances WHERE x = ? OR y = ?;");
-            q << uid << uid;
-            while (q.next()) 
-            {
-                q >> x >> y;
-                if (x == uid && y != uid)
-                    neigh.erase(y);
-                if (x != uid && y == uid)
-                    neigh.erase(x);
-            }
-        }
-        WARNIFFAILED();
+    Q q("SELECT played, flags, time FROM Journal "
+            "WHERE uid = ? AND time > ? ORDER BY time ASC;");
+    q << uid << state.get_until();
 
-        MixtureModel m1;
-        float beats1[BEATSSIZE];
+    while (q.next())
+    {
+        int flags;
+        time_t played, when;
+        q >> played >> flags >> when;
+        state.add(played, flags, when);
+    }
 
-        Song s1("", uid);
-        if (!s1.get_acoustic(&m1, beats1))
-            continue;
+    return state.rating(get_biasmean(uid));
+}
 
-        try {
-            AutoTransaction at(true);
-            Q q("INSERT OR REPLACE INTO A.Distances ('x', 'y', 'dist') "
-                    "VALUES (?, ?, ?);");
+// Ratings are rounded to whole points, so allow for the last
+// one to come out either way.
+#define RATING_TOLERANCE    1
 
-            for (set<int>::iterator j = neigh.begin(); j != neigh.end(); ++j)
-            {
-                MixtureModel m2;
-                float beats2[BEATSSIZE];
+int do_verify_ratings()
+{
+    int checked = 0, bad = 0;
+    vector<int> uids = journal_uids();
 
-                Song s2("", *j);
-                if (!s2.get_acoustic(&m2, beats2))
-                    continue;
+    try
+    {
+        for (size_t i = 0; i < uids.size(); ++i)
+        {
+            int expected = rescan_rating(uids[i]);
+            int actual = incremental_rating(uids[i]);
+            ++checked;
 
-                int small = std::min(uid, *j);
-                int large = std::max(uid, *j);
+            if (abs(expected - actual) <= RATING_TOLERANCE)
+                continue;
 
-                int dist = ROUND(model.evaluate(m1, beats1, m2, beats2) * 100);
+            ++bad;
+            cout << "uid " << uids[i] << ": rating " << actual
+                << ", expected " << expected << endl;
+        }
+    }
+    WARNIFFAILED();
 
-                // Don't bother with distance < 0.3.
-                // This way we only get a list of strongly correlated songs.
-                if (dist < 30)
-                    continue;
+    cout << checked << " ratings checked, " << bad << " off" << endl;
+    return bad;
+}
 
-                cout << "updating " << small << " -> "
-                    << large << " = " << dist << endl;
-                q << small << large << dist;
-                q.execute();
-            }
-            at.commit();
-        }
-        WARNIFFAILED();
+void do_repair_ratings()
+{
+    try
+    {
+        Q("DELETE FROM RatingState;").execute();
     }
+    WARNIFFAILED();
+
+    do_update_ratings();
 }
 
-void do_closest(const string &path)
+// Songs looked up in the index, and shown after scoring them with the SVM
+#define CLOSEST_CANDIDATES  50
+#define CLOSEST_SHOWN       25
+
+// Scores the songs closest to this one by the index with the SVM.
+// Returns false if there is no index to ask.
+static bool closest_from_index(Song &song, multimap<int, int> &closest)
 {
-    Song song(path);
+    AcousticIndex index;
+    if (!index.load(get_imms_root(ACOUSTIC_INDEX)))
+        return false;
 
-    if (!song.isok())
+    MixtureModel mm;
+    AcousticSample sample;
+    if (!song.get_acoustic(&mm, sample.beats))
     {
-        cerr << "immstool: could not identify " << path << endl;
-        return; 
+        cerr << "immstool: song has not been analyzed yet" << endl;
+        return true;
     }
-    
-    int uid = song.get_uid();
+    sample.mm.pack(mm);
 
-    multimap<int, int> closest;
+    vector<int> uids;
+    index.nearest(sample.mm, sample.beats, CLOSEST_CANDIDATES, uids);
+
+    vector<AcousticSample> candidates;
+    vector<int> found;
+    for (size_t i = 0; i < uids.size(); ++i)
+    {
+        AcousticSample other;
+        if (uids[i] == song.get_uid()
+                || !Song("", uids[i]).get_acoustic(&mm, other.beats))
+            continue;
+        other.mm.pack(mm);
+        candidates.push_back(other);
+        found.push_back(uids[i]);
+    }
+    if (candidates.empty())
+        return true;
+
+    SVMSimilarityModel model;
+    vector<float> scores(candidates.size());
+    model.evaluate_batch(sample, &candidates[0], candidates.size(),
+            &scores[0]);
+
+    for (size_t i = 0; i < found.size(); ++i)
+        closest.insert(pair<int, int>(ROUND(scores[i] * 100), found[i]));
+    while (closest.size() > CLOSEST_SHOWN)
+        closest.erase(closest.begin());
+
+    return true;
+}
 
+// The precomputed distances of "immstool distances".
+static void closest_from_table(int uid, multimap<int, int> &closest)
+{
     try
     {
         Q q("SELECT x,y,dist FROM A.Distances WHERE x = ? or y = ? "
@@ -585,6 +733,22 @@ void do_closest(const string &path)
         }
     }
     WARNIFFAILED();
+}
+
+void do_closest(const string &path)
+{
+    Song song(path);
+
+    if (!song.isok())
+    {
+        cerr << "immstool: could not identify " << path << endl;
+        return; 
+    }
+    
+    multimap<int, int> closest;
+
+    if (!closest_from_index(song, closest))
+        closest_from_table(song.get_uid(), closest);
 
     try 
     {